@@ -2,8 +2,10 @@
 
 #include "clad/Differentiator/Differentiator.h"
 #include "clad/Differentiator/Tape.h"
+#include <cmath>
 #include <cstddef>
 #include <cstdint>
+#include <vector>
 
 extern "C" {
 void pushReal8(double x);
@@ -155,6 +157,80 @@ BENCHMARK_TEMPLATE(BM_Gpu_Offload_Storage, 64, 1024)
     ->Range(0, 4096)
     ->Name("BM_Gpu_Offload_Storage/SBO_64_SLAB_1024_GPU");
 
+// Indexed reads over the whole tape. With the slab directory every lookup is
+// constant-time, so the cost per element should not grow with the tape size.
+template <bool DiskOffload, bool GpuOffload>
+static void BM_TapeRandomAccess(benchmark::State& state) {
+  std::size_t n = state.range(0);
+  clad::tape_impl<double, 64, 1024, /*is_Multithread=*/false, DiskOffload,
+                  GpuOffload>
+      t;
+  for (std::size_t i = 0; i < n; ++i)
+    t.emplace_back(static_cast<double>(i));
+  for (auto _ : state) {
+    double sum = 0;
+    for (std::size_t i = n; i-- > 0;)
+      sum += t[i];
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+
+BENCHMARK_TEMPLATE(BM_TapeRandomAccess, /*DiskOffload=*/false,
+                   /*GpuOffload=*/false)
+    ->RangeMultiplier(8)
+    ->Range(1024, 8 << 20)
+    ->Name("BM_TapeRandomAccess/RAM");
+
+BENCHMARK_TEMPLATE(BM_TapeRandomAccess, /*DiskOffload=*/true,
+                   /*GpuOffload=*/false)
+    ->RangeMultiplier(8)
+    ->Range(1024, 8 << 20)
+    ->Name("BM_TapeRandomAccess/DISK");
+
+BENCHMARK_TEMPLATE(BM_TapeRandomAccess, /*DiskOffload=*/true,
+                   /*GpuOffload=*/true)
+    ->RangeMultiplier(8)
+    ->Range(1024, 8 << 20)
+    ->Name("BM_TapeRandomAccess/GPU");
+
+// Round-trips slabs of smooth data through the DiskManager and reports the
+// achieved compression ratio alongside the write+read throughput.
+template <bool Compress>
+static void BM_DiskSlabCompression(benchmark::State& state) {
+  constexpr std::size_t SLAB_SIZE = 1024;
+  const std::size_t slabs = state.range(0);
+  std::vector<double> slab(SLAB_SIZE);
+  std::vector<std::size_t> offsets(slabs);
+  double ratio = 1;
+  for (auto _ : state) {
+    clad::detail::DiskManager<double, SLAB_SIZE> dm(/*use_file_offload=*/false,
+                                                    Compress);
+    for (std::size_t s = 0; s < slabs; ++s) {
+      for (std::size_t i = 0; i < SLAB_SIZE; ++i)
+        slab[i] = std::sin(1e-3 * static_cast<double>(s * SLAB_SIZE + i));
+      offsets[s] = dm.write_slab(slab.data());
+    }
+    for (std::size_t s = slabs; s-- > 0;)
+      dm.read_slab(slab.data(), offsets[s]);
+    benchmark::DoNotOptimize(slab.data());
+    ratio = dm.compression_ratio();
+  }
+  state.counters["Ratio"] = ratio;
+  state.SetBytesProcessed(state.iterations() * slabs * SLAB_SIZE *
+                          sizeof(double));
+}
+
+BENCHMARK_TEMPLATE(BM_DiskSlabCompression, /*Compress=*/false)
+    ->RangeMultiplier(8)
+    ->Range(8, 4096)
+    ->Name("BM_DiskSlabCompression/Raw");
+
+BENCHMARK_TEMPLATE(BM_DiskSlabCompression, /*Compress=*/true)
+    ->RangeMultiplier(8)
+    ->Range(8, 4096)
+    ->Name("BM_DiskSlabCompression/XorDelta");
+
 #include "BenchmarkedFunctions.h"
 static void BM_ReverseGausMemoryP(benchmark::State& state) {
   auto dfdp_grad = clad::gradient(gaus, "p");
@@ -71,4 +71,38 @@ BENCHMARK(BM_TapeThreadSafety)
     ->Args({8, 1000})
     ->Args({16, 1000});
 
+// Every thread pushes and then pops its own values, as a parallel forward and
+// reverse sweep would. Compares the mutex-guarded tape with the sharded one.
+template <typename TapeT>
+static void BM_TapeThreadScaling(benchmark::State& state) {
+  size_t n_threads = state.range(0);
+  size_t pushes_per_thread = state.range(1);
+  for (auto _ : state) {
+    TapeT t;
+    std::vector<std::thread> threads;
+    threads.reserve(n_threads);
+    for (size_t i = 0; i < n_threads; ++i) {
+      threads.emplace_back([&]() {
+        for (size_t j = 0; j < pushes_per_thread; ++j)
+          clad::push(t, 1.0);
+        for (size_t j = 0; j < pushes_per_thread; ++j)
+          benchmark::DoNotOptimize(clad::pop(t));
+      });
+    }
+    for (auto& thread : threads)
+      thread.join();
+  }
+  state.SetItemsProcessed(state.iterations() * n_threads * pushes_per_thread);
+}
+
+BENCHMARK_TEMPLATE(BM_TapeThreadScaling, clad::tape<double, 64, 1024, true>)
+    ->ArgsProduct({benchmark::CreateRange(1, 64, /*multi=*/2), {10000}})
+    ->UseRealTime()
+    ->Name("BM_TapeThreadScaling_Mutex");
+
+BENCHMARK_TEMPLATE(BM_TapeThreadScaling, clad::sharded_tape<double, 64, 1024>)
+    ->ArgsProduct({benchmark::CreateRange(1, 64, /*multi=*/2), {10000}})
+    ->UseRealTime()
+    ->Name("BM_TapeThreadScaling_Sharded");
+
 BENCHMARK_MAIN();
\ No newline at end of file
@@ -0,0 +1,121 @@
+#include "benchmark/benchmark.h"
+
+#include "clad/Differentiator/Differentiator.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+// The reverse pass of a gather scatters into the adjoint of the gathered
+// array, like a histogram: many iterations update the same few elements.
+void gather(const double* w, const int* bin, const double* x, int n,
+            double* y) {
+#pragma omp parallel for
+  for (int i = 0; i < n; i++)
+    y[i] = w[bin[i]] * x[i];
+}
+
+// Hand-written gradients doing the same forward and reverse sweeps as the
+// ones clad generates, but with atomic adjoint updates.
+void gather_grad_atomic(const double* w, const int* bin, const double* x,
+                        int n, double* y, double* dw, double* dy) {
+  gather(w, bin, x, n, y);
+#pragma omp parallel for
+  for (int i = 0; i < n; i++) {
+#pragma omp atomic
+    dw[bin[i]] += x[i] * dy[i];
+    dy[i] = 0;
+  }
+}
+
+// The reverse pass of a stencil updates the neighbours of every element, so
+// consecutive chunks of iterations overlap at their boundaries.
+void stencil(const double* x, int n, double* y) {
+#pragma omp parallel for
+  for (int i = 1; i < n - 1; i++)
+    y[i] = 0.25 * x[i - 1] + 0.5 * x[i] + 0.25 * x[i + 1];
+}
+
+void stencil_grad_atomic(const double* x, int n, double* y, double* dx,
+                         double* dy) {
+  stencil(x, n, y);
+#pragma omp parallel for
+  for (int i = 1; i < n - 1; i++) {
+#pragma omp atomic
+    dx[i - 1] += 0.25 * dy[i];
+#pragma omp atomic
+    dx[i] += 0.5 * dy[i];
+#pragma omp atomic
+    dx[i + 1] += 0.25 * dy[i];
+    dy[i] = 0;
+  }
+}
+
+// The adjoints of the gathered array accumulated with `omp atomic`.
+static void BM_GatherAtomic(benchmark::State& state) {
+  int n = state.range(0);
+  int bins = state.range(1);
+  std::vector<double> w(bins, 1.0), x(n, 1.0), y(n), dw(bins, 0.0), dy(n);
+  std::vector<int> bin(n);
+  for (int i = 0; i < n; i++)
+    bin[i] = (i * 7919) % bins;
+  for (auto _ : state) {
+    std::fill(dy.begin(), dy.end(), 1.0);
+    gather_grad_atomic(w.data(), bin.data(), x.data(), n, y.data(), dw.data(),
+                       dy.data());
+    benchmark::DoNotOptimize(dw.data());
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_GatherAtomic)
+    ->ArgsProduct({{1 << 20}, {16, 4096, 1 << 18}})
+    ->UseRealTime();
+
+// The adjoints of the gathered array accumulated by clad in per-thread
+// buffers merged at the end of the parallel region.
+static void BM_GatherPrivatized(benchmark::State& state) {
+  int n = state.range(0);
+  int bins = state.range(1);
+  std::vector<double> w(bins, 1.0), x(n, 1.0), y(n), dw(bins, 0.0), dy(n);
+  std::vector<int> bin(n);
+  for (int i = 0; i < n; i++)
+    bin[i] = (i * 7919) % bins;
+  auto grad = clad::gradient(gather, "w, y");
+  for (auto _ : state) {
+    std::fill(dy.begin(), dy.end(), 1.0);
+    grad.execute(w.data(), bin.data(), x.data(), n, y.data(), dw.data(),
+                 dy.data());
+    benchmark::DoNotOptimize(dw.data());
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_GatherPrivatized)
+    ->ArgsProduct({{1 << 20}, {16, 4096, 1 << 18}})
+    ->UseRealTime();
+
+static void BM_StencilAtomic(benchmark::State& state) {
+  int n = state.range(0);
+  std::vector<double> x(n, 1.0), y(n), dx(n, 0.0), dy(n);
+  for (auto _ : state) {
+    std::fill(dy.begin(), dy.end(), 1.0);
+    stencil_grad_atomic(x.data(), n, y.data(), dx.data(), dy.data());
+    benchmark::DoNotOptimize(dx.data());
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_StencilAtomic)->Range(1 << 12, 1 << 22)->UseRealTime();
+
+static void BM_StencilPrivatized(benchmark::State& state) {
+  int n = state.range(0);
+  std::vector<double> x(n, 1.0), y(n), dx(n, 0.0), dy(n);
+  auto grad = clad::gradient(stencil, "x, y");
+  for (auto _ : state) {
+    std::fill(dy.begin(), dy.end(), 1.0);
+    grad.execute(x.data(), n, y.data(), dx.data(), dy.data());
+    benchmark::DoNotOptimize(dx.data());
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_StencilPrivatized)->Range(1 << 12, 1 << 22)->UseRealTime();
+
+BENCHMARK_MAIN();
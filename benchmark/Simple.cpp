@@ -4,6 +4,8 @@
 
 #include "BenchmarkedFunctions.h"
 
+#include <vector>
+
 // Benchmark calling via CladFunction::execute
 static void BM_ForwardModePow2Execute(benchmark::State &state) {
   auto dfdx = clad::differentiate(pow2, "x");
@@ -90,6 +92,31 @@ static void BM_VectorForwardModeSumExecute(benchmark::State &state) {
 }
 BENCHMARK(BM_VectorForwardModeSumExecute);
 
+// Benchmark the latency of a gradient whose tapes are rebuilt on every call.
+static void BM_ReverseModeProductColdTapes(benchmark::State& state) {
+  auto grad = clad::gradient(product, "p");
+  int n = state.range(0);
+  std::vector<double> inputs(n, 1.0);
+  std::vector<double> result(n);
+  for (auto _ : state) {
+    grad.execute(inputs.data(), n, result.data());
+    benchmark::DoNotOptimize(result[0]);
+  }
+}
+BENCHMARK(BM_ReverseModeProductColdTapes)->Range(64, 64 << 10);
+
+// Benchmark the same gradient keeping its tapes alive across calls.
+static void BM_ReverseModeProductWarmTapes(benchmark::State& state) {
+  auto grad = clad::gradient<clad::opts::reuse_tapes>(product, "p");
+  int n = state.range(0);
+  std::vector<double> inputs(n, 1.0);
+  std::vector<double> result(n);
+  for (auto _ : state) {
+    grad.execute(inputs.data(), n, result.data());
+    benchmark::DoNotOptimize(result[0]);
+  }
+}
+BENCHMARK(BM_ReverseModeProductWarmTapes)->Range(64, 64 << 10);
 
 // Define our main.
 BENCHMARK_MAIN();
@@ -0,0 +1,223 @@
+#ifndef CLAD_DIFFERENTIATOR_CHECKPOINTING_H
+#define CLAD_DIFFERENTIATOR_CHECKPOINTING_H
+
+#include "clad/Differentiator/CladConfig.h"
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+namespace clad {
+
+/// Binomial checkpointing schedule for reversing the iterations of a loop
+/// marked with `#pragma clad checkpoint loop snapshots(S)`.
+///
+/// The derived code keeps at most `S` snapshots of the state of the loop. Slot
+/// 0 holds the state before the first iteration and is stored by the forward
+/// sweep. Before the adjoint of an iteration, the reverse sweep asks the
+/// schedule how to reach the state before it:
+///
+///   while (_t1.next(_t0 - 1)) {
+///     if (_t1.restoring())
+///       x = clad::back(_t2, _t1.slot());
+///     else if (_t1.storing())
+///       clad::push(_t2, _t1.slot(), x);
+///     else
+///       x = step(x);
+///   }
+///
+/// The schedule restores the closest snapshot and advances from it, storing
+/// new snapshots at the positions of Griewank's binomial schedule. Reversing N
+/// iterations then repeats each of them at most r times, where r is the
+/// smallest number with binomial(S + r, S) >= N.
+///
+/// When the trip count is not known before the loop, the forward sweep calls
+/// record() instead and keeps snapshots every k iterations:
+///
+///   if (_t1.record(_t0 - 1))
+///     clad::push(_t2, _t1.slot(), x);
+///
+/// k starts at 1 and doubles whenever half of the slots are used, dropping
+/// every other snapshot. The reverse sweep then replays each segment from the
+/// snapshot before it, placing binomial snapshots in the free slots.
+class revolve {
+public:
+  CUDA_HOST_DEVICE revolve(std::size_t snapshots)
+      : m_Snapshots(snapshots ? snapshots : 1),
+        m_Steps(new std::size_t[m_Snapshots]),
+        m_Slots(new std::size_t[m_Snapshots]),
+        m_FreeSlots(new std::size_t[m_Snapshots]) {}
+  revolve(const revolve&) = delete;
+  revolve& operator=(const revolve&) = delete;
+  CUDA_HOST_DEVICE ~revolve() {
+    delete[] m_Steps;
+    delete[] m_Slots;
+    delete[] m_FreeSlots;
+  }
+
+  /// Computes the next action needed to get the state before iteration
+  /// \p step. \returns false once the state is there. Iterations must be
+  /// requested in decreasing order; a larger one starts a new reversal.
+  CUDA_HOST_DEVICE bool next(std::size_t step) {
+    if (m_Action == action::turn) {
+      if (step >= m_Target)
+        start(step);
+      else {
+        assert(step + 1 == m_Target && "iterations must be reversed in order");
+        m_Target = step;
+        m_Action = action::none;
+      }
+    }
+    assert(step == m_Target && "iteration changed before the state was ready");
+
+    if (m_Action == action::none) {
+      // Snapshots taken after the requested iteration are no longer needed.
+      while (m_Steps[m_Size - 1] > m_Target)
+        m_FreeSlots[m_Free++] = m_Slots[--m_Size];
+      m_Current = m_Steps[m_Size - 1];
+      m_Slot = m_Slots[m_Size - 1];
+      m_Action = action::restore;
+      plan();
+      return true;
+    }
+    if (m_Current == m_Target) {
+      m_Action = action::turn;
+      return false;
+    }
+    if (m_Current == m_NextSnapshot) {
+      m_Slot = m_FreeSlots[--m_Free];
+      m_Steps[m_Size] = m_Current;
+      m_Slots[m_Size++] = m_Slot;
+      m_Action = action::store;
+      plan();
+      return true;
+    }
+    m_Current++;
+    m_Action = action::advance;
+    return true;
+  }
+
+  /// Called by the forward sweep before iteration \p step. \returns true if
+  /// the state must be saved to slot(). Step 0 starts a new forward sweep.
+  CUDA_HOST_DEVICE bool record(std::size_t step) {
+    if (step == 0) {
+      reset();
+      m_Recorded = true;
+    }
+    if (step % m_Stride)
+      return false;
+    // Keep half of the slots free for the snapshots of the reverse sweep.
+    std::size_t recorded = m_Snapshots > 1 ? m_Snapshots / 2 : 1;
+    if (m_Size == recorded) {
+      thin();
+      if (m_Size == recorded || step % m_Stride)
+        return false;
+    }
+    m_Slot = m_FreeSlots[--m_Free];
+    m_Steps[m_Size] = step;
+    m_Slots[m_Size++] = m_Slot;
+    return true;
+  }
+
+  /// \returns true if the state must be loaded from slot().
+  CUDA_HOST_DEVICE bool restoring() const {
+    return m_Action == action::restore;
+  }
+  /// \returns true if the state must be saved to slot().
+  CUDA_HOST_DEVICE bool storing() const { return m_Action == action::store; }
+  /// The snapshot slot to restore from or store to, in [0, snapshots).
+  CUDA_HOST_DEVICE std::size_t slot() const { return m_Slot; }
+  CUDA_HOST_DEVICE std::size_t snapshots() const { return m_Snapshots; }
+
+private:
+  /// `none` waits for the restore that begins each iteration, `turn` for the
+  /// next iteration to reverse.
+  enum class action : std::uint8_t { none, restore, store, advance, turn };
+
+  /// Begins the reversal of iterations [0, step] from the snapshots recorded
+  /// by the forward sweep, or else from the snapshot in slot 0.
+  CUDA_HOST_DEVICE void start(std::size_t step) {
+    m_Target = step;
+    m_Action = action::none;
+    if (m_Recorded) {
+      m_Recorded = false;
+      return;
+    }
+    reset();
+    m_Steps[0] = 0;
+    m_Slots[0] = m_FreeSlots[--m_Free];
+    m_Size = 1;
+  }
+
+  /// Frees all slots, handing out the lowest ones first.
+  CUDA_HOST_DEVICE void reset() {
+    m_Size = 0;
+    m_Free = 0;
+    m_Stride = 1;
+    for (std::size_t i = m_Snapshots; i > 0; --i)
+      m_FreeSlots[m_Free++] = i - 1;
+  }
+
+  /// Doubles the distance between recorded snapshots and frees the slots of
+  /// those no longer on it. The one before the loop is always kept.
+  CUDA_HOST_DEVICE void thin() {
+    m_Stride *= 2;
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < m_Size; ++i) {
+      if (m_Steps[i] % m_Stride) {
+        m_FreeSlots[m_Free++] = m_Slots[i];
+        continue;
+      }
+      m_Steps[kept] = m_Steps[i];
+      m_Slots[kept++] = m_Slots[i];
+    }
+    m_Size = kept;
+  }
+
+  /// Chooses where to store the next snapshot while advancing from the
+  /// current state to the target iteration.
+  CUDA_HOST_DEVICE void plan() {
+    m_NextSnapshot = SIZE_MAX;
+    std::size_t length = m_Target - m_Current + 1;
+    if (!m_Free || length < 2)
+      return;
+    // With s snapshots, r repetitions reverse binomial(s + r, s) iterations.
+    // Find the smallest such r and leave binomial(s - 1 + r, s - 1) of them
+    // to the part after the new snapshot.
+    std::size_t s = m_Free + 1;
+    std::size_t all = 1;
+    std::size_t right = 1;
+    for (std::size_t r = 1; all < length; ++r) {
+      // Any length fits before the binomial overflows.
+      if (all > SIZE_MAX / (s + r))
+        break;
+      all = all * (s + r) / r;
+      right = right * (s - 1 + r) / r;
+    }
+    std::size_t left = length > right ? length - right : 1;
+    if (left >= length)
+      left = length - 1;
+    m_NextSnapshot = m_Current + left;
+  }
+
+  std::size_t m_Snapshots;
+  /// Stack of stored snapshots: the iteration before which each was taken
+  /// and its slot. The bottom one is the state before the loop.
+  std::size_t* m_Steps;
+  std::size_t* m_Slots;
+  std::size_t m_Size = 0;
+  std::size_t* m_FreeSlots;
+  std::size_t m_Free = 0;
+  std::size_t m_Target = 0;
+  std::size_t m_Current = 0;
+  std::size_t m_NextSnapshot = SIZE_MAX;
+  std::size_t m_Slot = 0;
+  /// Distance between the snapshots recorded by the forward sweep.
+  std::size_t m_Stride = 1;
+  bool m_Recorded = false;
+  action m_Action = action::turn;
+};
+
+} // namespace clad
+
+#endif // CLAD_DIFFERENTIATOR_CHECKPOINTING_H
@@ -45,6 +45,32 @@ enum opts : unsigned {
 
   // Specify that we need a constexpr-enabled CladFunction
   immediate_mode = 1 << (ORDER_BITS + 7),
+
+  // Keep the tapes of the gradient alive across calls on the same thread. A
+  // call nested in another one on the same thread uses local tapes instead.
+  reuse_tapes = 1 << (ORDER_BITS + 8),
+
+  // Store all tape values of the gradient in one arena per invocation.
+  use_tape_arena = 1 << (ORDER_BITS + 11),
+
+  // Store the values of loops with a known trip count in preallocated tapes.
+  fixed_tapes = 1 << (ORDER_BITS + 12),
+
+  // Store the values saved by a loop iteration in one record per iteration.
+  fuse_tapes = 1 << (ORDER_BITS + 13),
+
+  // Take the seed matrices of the jacobian from the caller, e.g. the
+  // compressed seeds of a clad::sparse_jacobian.
+  sparse = 1 << (ORDER_BITS + 14),
+
+  // Compute the jacobian in forward or reverse mode instead of letting clad
+  // pick the mode from the numbers of inputs and outputs.
+  forward_mode = 1 << (ORDER_BITS + 15),
+  reverse_mode = 1 << (ORDER_BITS + 16),
+
+  // Declare the adjoint array parameters of the gradient `__restrict`,
+  // promising that they do not overlap each other or the other arguments.
+  restrict_adjoints = 1 << (ORDER_BITS + 17),
 }; // enum opts
 
 constexpr unsigned GetDerivativeOrder(const unsigned bitmasked_opts) {
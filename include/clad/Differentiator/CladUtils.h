@@ -16,6 +16,7 @@
 #include "clang/Basic/SourceLocation.h"
 #include "clang/Sema/Ownership.h"
 #include "clang/Sema/Sema.h"
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/StringRef.h"
 
 #include <cassert>
@@ -413,6 +414,21 @@ namespace clad {
 
     clang::QualType GetRestoreTrackerType(clang::Sema& S);
 
+    /// Returns type clad::tape_arena
+    clang::QualType GetTapeArenaType(clang::Sema& S);
+
+    /// Returns type clad::revolve
+    clang::QualType GetRevolveType(clang::Sema& S);
+
+    /// Returns type clad::bit_tape
+    clang::QualType GetBitTapeType(clang::Sema& S);
+
+    /// Returns type clad::record_tape
+    clang::QualType GetRecordTapeType(clang::Sema& S);
+
+    /// Returns type clad::omp_schedule
+    clang::QualType GetOMPScheduleType(clang::Sema& S);
+
     void SetSwitchCaseSubStmt(clang::SwitchCase* SC, clang::Stmt* subStmt);
 
     bool IsZeroOrNullValue(const clang::Expr* E);
@@ -443,6 +459,10 @@ namespace clad {
 
     bool hasElidableReverseForwAttribute(const clang::Decl* D);
 
+    /// Returns true if D is annotated with `checkpoint`: calls to it save
+    /// only the inputs the callee overwrites and re-run it in the pullback.
+    bool hasCheckpointAttribute(const clang::Decl* D);
+
     /// Returns true if FD can be differentiated as a pushforward
     /// And be used in the reverse mode.
     bool canUsePushforwardInRevMode(const clang::FunctionDecl* FD);
@@ -459,6 +479,15 @@ namespace clad {
     /// an expression, most likely an index, is injective, meaning no two
     /// threads have the same value.
     bool isInjective(const clang::Expr* E, clang::AnalysisDeclContext* ADC);
+    /// Determines whether an index \p E used in the body of a loop over
+    /// \p LoopVar is injective, meaning no two iterations have the same value,
+    /// i.e. it is `LoopVar`, `c +- E'`, `E' +- c` or `k * E'` for an injective
+    /// E', a loop-invariant c and a non-zero constant k. \p Modified holds the
+    /// variables the loop body changes.
+    bool
+    isInjective(const clang::Expr* E, const clang::VarDecl* LoopVar,
+                const llvm::SmallPtrSetImpl<const clang::VarDecl*>& Modified,
+                const clang::ASTContext& C);
     /// Checks if the return value of the given CallExpr is unused.
     bool hasUnusedReturnValue(clang::ASTContext& C, const clang::CallExpr* CE);
     /// Returns true if the function is empty
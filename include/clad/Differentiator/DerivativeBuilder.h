@@ -107,6 +107,7 @@ struct DerivativeAndOverload {
     friend class VectorPushForwardModeVisitor;
     friend class ReverseModeVisitor;
     friend class HessianModeVisitor;
+    friend class HvpModeVisitor;
     friend class JacobianModeVisitor;
     friend class ReverseModeForwPassVisitor;
     clang::Sema& m_Sema;
@@ -19,6 +19,13 @@ struct DerivedFnInfo {
   std::vector<size_t> m_CUDAGlobalArgsIndexes;
   bool m_UsesEnzyme = false;
   bool m_DeclarationOnly = false;
+  bool m_SparseJacobian = false;
+  bool m_ReverseJacobian = false;
+  bool m_UseTapeArena = false;
+  bool m_ReuseTapes = false;
+  bool m_UseFixedTapes = false;
+  bool m_FuseTapes = false;
+  bool m_RestrictAdjoints = false;
 
   DerivedFnInfo() = default;
   DerivedFnInfo(const DiffRequest& request, clang::FunctionDecl* derivedFn,
@@ -12,6 +12,7 @@ enum class DiffMode {
   reverse,
   hessian,
   hessian_diagonal,
+  hvp,
   jacobian,
   reverse_mode_forward_pass
 };
@@ -35,6 +36,8 @@ inline const char* DiffModeToString(DiffMode mode) {
     return "hessian";
   case DiffMode::hessian_diagonal:
     return "hessian_diagonal";
+  case DiffMode::hvp:
+    return "hvp";
   case DiffMode::jacobian:
     return "jacobian";
   case DiffMode::reverse_mode_forward_pass:
@@ -120,6 +120,9 @@ public:
   /// The key order is reversed to simplify location range lookups.
   mutable std::map<clang::SourceLocation, clang::SourceLocation, std::greater<>>
       m_CladLoopCheckpoints;
+  /// Stores the snapshot budget of `#pragma clad checkpoint loop snapshots(S)`.
+  /// Key: pragma location; value: S.
+  mutable std::map<clang::SourceLocation, unsigned> m_CladLoopSnapshots;
 
   /// Global VarDecl to differentiate, if any.
   ///
@@ -134,6 +137,34 @@ public:
   // A flag to enable the use of enzyme for backend instead of clad
   bool use_enzyme = false;
 
+  /// A flag to store all tape values of the derived function in a single
+  /// clad::tape_arena instead of one clad::tape per stored expression.
+  bool UseTapeArena = false;
+
+  /// A flag to declare the tapes of the derived function `static
+  /// thread_local`, so that repeated calls on a thread reuse their storage.
+  bool ReuseTapes = false;
+
+  /// A flag to store the values of loops whose trip count is known before
+  /// they start in clad::fixed_tape, allocated once with the exact size.
+  bool UseFixedTapes = false;
+
+  /// A flag to store the values saved by each loop iteration as the fields of
+  /// one record on a clad::record_tape instead of on a tape per value.
+  bool FuseTapes = false;
+
+  /// A flag to take the seed matrices of the independent arrays of the
+  /// jacobian from the caller instead of seeding them with identity matrices.
+  bool SparseJacobian = false;
+
+  /// A flag to compute the jacobian with a pullback per row instead of a
+  /// vector forward sweep over all the columns.
+  bool ReverseJacobian = false;
+
+  /// A flag to declare the adjoint array parameters of the gradient
+  /// `__restrict`, which lets clad vectorize the reverse loops writing them.
+  bool RestrictAdjoints = false;
+
   /// UnresolvedLookupExpr or DeclRefExpr representing the custom derivative
   /// overload
   clang::Expr* CustomDerivative = nullptr;
@@ -185,6 +216,13 @@ public:
            EnableVariedAnalysis == other.EnableVariedAnalysis &&
            EnableUsefulAnalysis == other.EnableUsefulAnalysis &&
            DVI == other.DVI && use_enzyme == other.use_enzyme &&
+           UseTapeArena == other.UseTapeArena &&
+           ReuseTapes == other.ReuseTapes &&
+           UseFixedTapes == other.UseFixedTapes &&
+           FuseTapes == other.FuseTapes &&
+           SparseJacobian == other.SparseJacobian &&
+           ReverseJacobian == other.ReverseJacobian &&
+           RestrictAdjoints == other.RestrictAdjoints &&
            DeclarationOnly == other.DeclarationOnly && Global == other.Global &&
            CUDAGlobalArgsIndexes == other.CUDAGlobalArgsIndexes;
   }
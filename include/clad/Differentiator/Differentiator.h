@@ -13,11 +13,14 @@
 #ifdef __CUDACC__
 #include "BuiltinDerivativesCUDA.cuh"
 #endif
+#include "Checkpointing.h"
 #include "CladConfig.h"
 #include "FunctionTraits.h"
 #include "Matrix.h"
 #include "NumericalDiff.h"
 #include "RestoreTracker.h"
+#include "SparseHessian.h"
+#include "SparseJacobian.h"
 #include "Tape.h"
 
 #include <array>
@@ -27,6 +30,7 @@
 #include <initializer_list>
 #include <iterator>
 #ifdef _OPENMP
+#include <atomic>
 #include <omp.h>
 #endif
 #include <type_traits>
@@ -118,6 +122,120 @@ back(tape<T, SBO_SIZE, SLAB_SIZE,
   return of.back();
 }
 
+/// Add \p n consecutive values starting at \p src to the end of the tape.
+/// Used to save whole arrays with a single bulk copy.
+template <typename T, std::size_t SBO_SIZE = 64, std::size_t SLAB_SIZE = 1024,
+          bool DiskOffload = false, bool GpuOffload = false>
+CUDA_HOST_DEVICE void push_n(tape<T, SBO_SIZE, SLAB_SIZE,
+                                  /*is_multithread=*/false, DiskOffload,
+                                  GpuOffload>& to,
+                             const T* src, std::size_t n) {
+  to.push_n(src, n);
+}
+
+/// Remove the last \p n values from the tape and store them, in their
+/// original order, to \p dest.
+template <typename T, std::size_t SBO_SIZE = 64, std::size_t SLAB_SIZE = 1024,
+          bool DiskOffload = false, bool GpuOffload = false>
+CUDA_HOST_DEVICE void pop_n(tape<T, SBO_SIZE, SLAB_SIZE,
+                                 /*is_multithread=*/false, DiskOffload,
+                                 GpuOffload>& to,
+                            T* dest, std::size_t n) {
+  to.pop_n(dest, n);
+}
+
+/// Arena-backed tape access functions.
+/// Add value to the end of the tape, return the same value.
+template <typename T, typename... ArgsT>
+CUDA_HOST_DEVICE T& push(arena_tape<T>& to, ArgsT... val) {
+  to.emplace_back(std::forward<ArgsT>(val)...);
+  return to.back();
+}
+
+/// A specialization for C arrays
+template <typename T, typename U, std::size_t N>
+CUDA_HOST_DEVICE void push(arena_tape<T[N]>& to, const U& val) {
+  to.emplace_back();
+  std::copy(std::begin(val), std::end(val), std::begin(to.back()));
+}
+
+/// Remove the last value from the tape, return it.
+template <typename T> CUDA_HOST_DEVICE T pop(arena_tape<T>& to) {
+  T val = std::move(to.back());
+  to.pop_back();
+  return val;
+}
+
+/// A specialization for C arrays
+template <typename T, std::size_t N>
+CUDA_HOST_DEVICE void pop(arena_tape<T[N]>& to) {
+  to.pop_back();
+}
+
+/// Access return the last value in the tape.
+template <typename T> CUDA_HOST_DEVICE T& back(arena_tape<T>& of) {
+  return of.back();
+}
+
+/// Fixed-size tape access functions. The value of each loop iteration is
+/// addressed by its index \p i instead of by its position on a stack.
+/// Store \p val as the value of iteration \p i, return the stored value.
+template <typename T, typename U>
+CUDA_HOST_DEVICE T& push(fixed_tape<T>& to, std::size_t i, U val) {
+  return to[i] = val;
+}
+
+/// Return the value stored for iteration \p i.
+template <typename T>
+CUDA_HOST_DEVICE T pop(fixed_tape<T>& to, std::size_t i) {
+  return to[i];
+}
+
+/// Access the value stored for iteration \p i.
+template <typename T>
+CUDA_HOST_DEVICE T& back(fixed_tape<T>& of, std::size_t i) {
+  return of[i];
+}
+
+/// Bit-packed tape access functions for conditions and small case numbers.
+/// Add value to the end of the tape, return the same value.
+template <typename T> CUDA_HOST_DEVICE T push(bit_tape& to, T val) {
+  to.push(static_cast<std::uint64_t>(val));
+  return val;
+}
+
+/// Remove the last value from the tape, return it.
+CUDA_HOST_DEVICE inline std::uint64_t pop(bit_tape& to) {
+  std::uint64_t val = to.back();
+  to.pop_back();
+  return val;
+}
+
+/// Access return the last value in the tape.
+CUDA_HOST_DEVICE inline std::uint64_t back(const bit_tape& of) {
+  return of.back();
+}
+
+/// Record tape access functions. The values saved by a loop iteration are the
+/// fields \p f of its record, which is pushed and popped as a whole.
+/// Store \p val to field \p f of the last record, return the stored value.
+template <typename T, typename U>
+CUDA_HOST_DEVICE T& push(record_tape& to, record_field<T> f, U val) {
+  return *::new (to.field<T>(f.offset)) T(val);
+}
+
+/// Return the value of field \p f of the last record.
+template <typename T>
+CUDA_HOST_DEVICE T pop(record_tape& to, record_field<T> f) {
+  return *to.field<T>(f.offset);
+}
+
+/// Access field \p f of the last record.
+template <typename T>
+CUDA_HOST_DEVICE T& back(record_tape& of, record_field<T> f) {
+  return *of.field<T>(f.offset);
+}
+
   /// Thread safe tape access functions with mutex locking mechanism
 /// Thread safe tape access functions with mutex locking mechanism
 #ifndef __CUDACC__
@@ -173,6 +291,52 @@ T& back(
   std::lock_guard<std::mutex> lock(of.mutex());
   return of.back();
 }
+
+/// Add \p n consecutive values starting at \p src to the end of the tape.
+template <typename T, std::size_t SBO_SIZE = 64, std::size_t SLAB_SIZE = 1024,
+          bool DiskOffload = false, bool GpuOffload = false>
+void push_n(tape<T, SBO_SIZE, SLAB_SIZE, /*is_multithreaded=*/true,
+                 DiskOffload, GpuOffload>& to,
+            const T* src, std::size_t n) {
+  std::lock_guard<std::mutex> lock(to.mutex());
+  to.push_n(src, n);
+}
+
+/// Remove the last \p n values from the tape and store them to \p dest.
+template <typename T, std::size_t SBO_SIZE = 64, std::size_t SLAB_SIZE = 1024,
+          bool DiskOffload = false, bool GpuOffload = false>
+void pop_n(tape<T, SBO_SIZE, SLAB_SIZE, /*is_multithreaded=*/true,
+                DiskOffload, GpuOffload>& to,
+           T* dest, std::size_t n) {
+  std::lock_guard<std::mutex> lock(to.mutex());
+  to.pop_n(dest, n);
+}
+
+/// Thread-sharded tape access functions. Every thread operates on its own
+/// shard, so no locking is needed.
+/// Add value to the end of the calling thread's shard, return the same value.
+template <typename T, std::size_t SBO_SIZE = 64, std::size_t SLAB_SIZE = 1024,
+          typename... ArgsT>
+T& push(sharded_tape<T, SBO_SIZE, SLAB_SIZE>& to, ArgsT&&... val) {
+  auto& shard = to.local();
+  shard.emplace_back(std::forward<ArgsT>(val)...);
+  return shard.back();
+}
+
+/// Remove the last value from the calling thread's shard, return it.
+template <typename T, std::size_t SBO_SIZE = 64, std::size_t SLAB_SIZE = 1024>
+T pop(sharded_tape<T, SBO_SIZE, SLAB_SIZE>& to) {
+  auto& shard = to.local();
+  T val = std::move(shard.back());
+  shard.pop_back();
+  return val;
+}
+
+/// Access return the last value in the calling thread's shard.
+template <typename T, std::size_t SBO_SIZE = 64, std::size_t SLAB_SIZE = 1024>
+T& back(sharded_tape<T, SBO_SIZE, SLAB_SIZE>& of) {
+  return of.back();
+}
 #endif
 /// Generic fallback overloads for user-defined custom tape types.
 template <typename T> struct is_clad_tape : std::false_type {};
@@ -180,6 +344,16 @@ template <typename T> struct is_clad_tape : std::false_type {};
 template <typename T, std::size_t SBO, std::size_t SLAB, bool MT, bool Disk,
           bool Gpu>
 struct is_clad_tape<tape_impl<T, SBO, SLAB, MT, Disk, Gpu>> : std::true_type {};
+template <typename T>
+struct is_clad_tape<arena_tape<T>> : std::true_type {};
+template <typename T>
+struct is_clad_tape<fixed_tape<T>> : std::true_type {};
+template <> struct is_clad_tape<bit_tape> : std::true_type {};
+template <> struct is_clad_tape<record_tape> : std::true_type {};
+#ifndef __CUDACC__
+template <typename T, std::size_t SBO, std::size_t SLAB>
+struct is_clad_tape<sharded_tape<T, SBO, SLAB>> : std::true_type {};
+#endif
 
 template <typename TapeType, typename... ArgsT,
           typename std::enable_if<!clad::is_clad_tape<TapeType>::value,
@@ -491,6 +665,9 @@ CUDA_HOST_DEVICE auto back(TapeType& of) -> decltype(of.back()) {
         printf("Use execute_kernel() for global CUDA kernels\n");
         return static_cast<return_type_t<F>>(return_type_t<F>());
       }
+#if defined(CLAD_TAPE_TELEMETRY) && !defined(__CUDA_ARCH__)
+      detail::tape_telemetry telemetry(m_Code);
+#endif
       // here static_cast is used to achieve perfect forwarding
 #ifdef __CUDACC__
       return execute_helper(m_Function, m_CUDAkernel, dim3(0), dim3(0),
@@ -548,6 +725,23 @@ CUDA_HOST_DEVICE auto back(TapeType& of) -> decltype(of.back()) {
       printf("The code is: \n%s\n", getCode());
     }
 
+    /// Return the tape counters accumulated over the calls made through
+    /// execute() so far. Requires `CLAD_TAPE_TELEMETRY`; all zero otherwise.
+    tape_stats getTapeStats() const {
+#if defined(CLAD_TAPE_TELEMETRY) && !defined(__CUDA_ARCH__)
+      return detail::tape_telemetry::get(m_Code);
+#else
+      return tape_stats();
+#endif
+    }
+
+    /// Discards the tape counters accumulated so far.
+    void resetTapeStats() const {
+#if defined(CLAD_TAPE_TELEMETRY) && !defined(__CUDA_ARCH__)
+      detail::tape_telemetry::reset(m_Code);
+#endif
+    }
+
     /// Set object pointed by the functor as the default object for
     /// executing derived member function.
     void setObject(FunctorType* functor) {
@@ -833,6 +1027,28 @@ CUDA_HOST_DEVICE auto back(TapeType& of) -> decltype(of.back()) {
         derivedFn /* will be replaced by hessian*/, code, f);
   }
 
+  /// Generates function which computes the product of the hessian matrix of
+  /// the given function wrt the parameters specified in `args` with a vector,
+  /// at the cost of a few gradients. The vector and the product have the
+  /// layout of a row of the matrix computed by clad::hessian.
+  ///
+  /// \param[in] fn function to differentiate
+  /// \param[in] args independent parameters information
+  /// \returns `CladFunction` object to access the corresponding derived
+  /// function.
+  template <unsigned... BitMaskedOpts, typename ArgSpec = const char*,
+            typename F, typename DerivedFnType = HvpDerivedFnTraits_t<F>,
+            typename = typename std::enable_if<
+                !std::is_class<remove_reference_and_pointer_t<F>>::value>::type>
+  constexpr CladFunction<
+      DerivedFnType, ExtractFunctorTraits_t<F>> __attribute__((annotate("V")))
+  hvp(F f, ArgSpec args = "",
+      DerivedFnType derivedFn = static_cast<DerivedFnType>(nullptr),
+      const char* code = "") {
+    return CladFunction<DerivedFnType, ExtractFunctorTraits_t<F>>(
+        derivedFn /* will be replaced by hvp*/, code);
+  }
+
   /// Generates function which computes jacobian matrix of the given function
   /// wrt the parameters specified in `args` using reverse mode differentiation.
   ///
@@ -931,6 +1147,266 @@ CUDA_HOST_DEVICE auto back(TapeType& of) -> decltype(of.back()) {
       *threadhi = *threadlo + chunksize * stride - incr;
     }
   }
+
+  /// Hands out the iterations of a loop with a `schedule(static, chunk)`,
+  /// `dynamic`, `guided` or `runtime` clause, and logs the chunks each thread
+  /// executes in the forward sweep. The reverse sweep gets them back in
+  /// reverse order on the same thread, which holds the matching tapes:
+  ///
+  ///   _t0.start_dynamic(lo, hi, stride, chunk);
+  ///   while (_t0.next(&_t_chunklo0, &_t_chunkhi0))
+  ///     for (int i = _t_chunklo0; i <= _t_chunkhi0; i += stride) ...
+  ///
+  ///   while (_t0.prev(&_t_chunklo1, &_t_chunkhi1))
+  ///     for (int i = _t_chunkhi1; i >= _t_chunklo1; i -= stride) ...
+  ///
+  /// As in GetStaticSchedule, \p hi is the last iteration. A region executed
+  /// several times is reversed execution by execution.
+  class omp_schedule {
+  public:
+    omp_schedule() { grow(omp_get_max_threads()); }
+    omp_schedule(const omp_schedule&) = delete;
+    omp_schedule& operator=(const omp_schedule&) = delete;
+    ~omp_schedule() {
+      for (int i = 0; i < m_Threads; ++i)
+        delete m_Logs[i];
+      delete[] m_Logs;
+    }
+
+    /// Must be called by every thread of the region before next().
+    void start_static(int lo, int hi, int stride, int chunk) {
+      start(omp_sched_static, lo, hi, stride, chunk);
+    }
+    void start_dynamic(int lo, int hi, int stride, int chunk) {
+      start(omp_sched_dynamic, lo, hi, stride, chunk);
+    }
+    void start_guided(int lo, int hi, int stride, int chunk) {
+      start(omp_sched_guided, lo, hi, stride, chunk);
+    }
+    /// Uses the schedule set by OMP_SCHEDULE or omp_set_schedule.
+    void start_runtime(int lo, int hi, int stride) {
+      omp_sched_t kind = omp_sched_static;
+      int chunk = 0;
+      omp_get_schedule(&kind, &chunk);
+      // Drop the monotonic modifier, stored in the high bits.
+      start(static_cast<omp_sched_t>(kind & 0xff), lo, hi, stride, chunk);
+    }
+
+    /// Assigns the next chunk to the calling thread. \returns false once all
+    /// iterations are assigned.
+    bool next(int* threadlo, int* threadhi) {
+      int tid = omp_get_thread_num();
+      int first = 0;
+      int count = m_Chunk;
+      if (m_Kind == omp_sched_dynamic) {
+        first = m_Next.fetch_add(count);
+      } else if (m_Kind == omp_sched_guided) {
+        // Chunks shrink with the number of remaining iterations.
+        int nth = omp_get_num_threads();
+        first = m_Next.load();
+        do {
+          int left = m_Trip - first;
+          if (left <= 0)
+            break;
+          count = std::max((left + nth - 1) / nth, m_Chunk);
+        } while (!m_Next.compare_exchange_weak(first, first + count));
+      } else {
+        first = m_Logs[tid]->cursor;
+        m_Logs[tid]->cursor += omp_get_num_threads() * count;
+      }
+      if (first >= m_Trip)
+        return false;
+      count = std::min(count, m_Trip - first);
+      *threadlo = m_Lo + first * m_Stride;
+      *threadhi = *threadlo + (count - 1) * m_Stride;
+      m_Logs[tid]->chunks.emplace_back(*threadlo);
+      m_Logs[tid]->chunks.emplace_back(*threadhi);
+      m_Logs[tid]->counts.back()++;
+      return true;
+    }
+
+    /// Returns the chunks the calling thread executed in the last forward
+    /// sweep of the region, last one first. \returns false after the first.
+    bool prev(int* threadlo, int* threadhi) {
+      int tid = omp_get_thread_num();
+      // A thread the forward sweep did not have executed no chunks.
+      if (tid >= m_Threads)
+        return false;
+      tape_impl<int>& chunks = m_Logs[tid]->chunks;
+      tape_impl<int>& counts = m_Logs[tid]->counts;
+      assert(counts.size() && "no forward sweep to reverse");
+      if (!counts.back()) {
+        counts.pop_back();
+        return false;
+      }
+      counts.back()--;
+      *threadhi = chunks.back();
+      chunks.pop_back();
+      *threadlo = chunks.back();
+      chunks.pop_back();
+      return true;
+    }
+
+  private:
+    void start(omp_sched_t kind, int lo, int hi, int stride, int chunk) {
+      assert(stride);
+#pragma omp single
+      {
+        m_Kind = kind;
+        m_Lo = lo;
+        m_Stride = stride;
+        m_Trip = std::max((hi - lo + stride) / stride, 0);
+        int nth = omp_get_num_threads();
+        // Without a chunk size, static gives one block to every thread.
+        if (chunk <= 0)
+          chunk = kind == omp_sched_dynamic || kind == omp_sched_guided
+                      ? 1
+                      : std::max((m_Trip + nth - 1) / nth, 1);
+        m_Chunk = chunk;
+        m_Next.store(0);
+        // A num_threads clause may ask for more threads than the default.
+        if (nth > m_Threads)
+          grow(nth);
+      }
+      // The implicit barrier of single publishes the loop to every thread.
+      int tid = omp_get_thread_num();
+      m_Logs[tid]->cursor = tid * m_Chunk;
+      m_Logs[tid]->counts.emplace_back(0);
+    }
+
+    /// Adds logs for threads up to \p threads. The logs of the existing
+    /// threads keep their chunks, only the table pointing to them moves.
+    void grow(int threads) {
+      auto** logs = new thread_log*[threads];
+      for (int i = 0; i < threads; ++i)
+        logs[i] = i < m_Threads ? m_Logs[i] : new thread_log();
+      delete[] m_Logs;
+      m_Logs = logs;
+      m_Threads = threads;
+    }
+
+    struct thread_log {
+      /// The next iteration of the thread under the static schedule.
+      int cursor = 0;
+      /// The first and last iteration of every chunk.
+      tape_impl<int> chunks;
+      /// The number of chunks of each forward sweep.
+      tape_impl<int> counts;
+    };
+
+    int m_Threads = 0;
+    thread_log** m_Logs = nullptr;
+    std::atomic<int> m_Next{0};
+    omp_sched_t m_Kind = omp_sched_static;
+    int m_Lo = 0;
+    int m_Stride = 1;
+    int m_Trip = 0;
+    int m_Chunk = 1;
+  };
+
+  /// Thread-private adjoint of an array that the iterations of a parallel
+  /// loop update through shared indices, e.g. `_d_w[bin[i]]` or the
+  /// `_d_x[i - 1]` and `_d_x[i + 1]` of a stencil. Every thread accumulates
+  /// into its own buffer, which grows to the largest index it touched. At the
+  /// end of the region, reduce() merges the buffers pairwise in log2(threads)
+  /// rounds and the team adds the result to the adjoint, one slice per thread.
+  template <typename T> class omp_adjoint {
+  public:
+    omp_adjoint()
+        : m_Threads(omp_get_max_threads()), m_Buffers(new buffer[m_Threads]) {}
+    omp_adjoint(const omp_adjoint&) = delete;
+    omp_adjoint& operator=(const omp_adjoint&) = delete;
+    ~omp_adjoint() {
+      for (int i = 0; i < m_Threads; ++i)
+        delete[] m_Buffers[i].data;
+      delete[] m_Buffers;
+    }
+
+    /// Makes room for a buffer per thread of the team, which a num_threads
+    /// clause may make larger than the default. Must be called by every
+    /// thread of the region before at().
+    void start() {
+#pragma omp single
+      {
+        int nth = omp_get_num_threads();
+        if (nth > m_Threads) {
+          auto* buffers = new buffer[nth];
+          for (int i = 0; i < m_Threads; ++i)
+            buffers[i] = m_Buffers[i];
+          delete[] m_Buffers;
+          m_Buffers = buffers;
+          m_Threads = nth;
+        }
+      }
+      // The implicit barrier of single publishes the buffers to every thread.
+    }
+
+    /// \returns the element \p i of the buffer of the calling thread.
+    T& at(std::size_t i) {
+      int tid = omp_get_thread_num();
+      assert(tid < m_Threads && "start() was not called by the region");
+      buffer& b = m_Buffers[tid];
+      if (i >= b.size)
+        b.resize(i + 1);
+      return b.data[i];
+    }
+
+    /// Adds the buffers to \p target and clears them for the next region.
+    /// Must be called by every thread of the region once its updates are done.
+    void reduce(T* target) {
+      int nth = omp_get_num_threads();
+      int tid = omp_get_thread_num();
+#pragma omp barrier
+      for (int step = 1; step < nth; step *= 2) {
+        if (tid % (2 * step) == 0 && tid + step < nth)
+          m_Buffers[tid].add(m_Buffers[tid + step]);
+#pragma omp barrier
+      }
+      // Only the first buffer is read from here on.
+      if (tid)
+        m_Buffers[tid].clear(0, m_Buffers[tid].size);
+      buffer& b = m_Buffers[0];
+      std::size_t chunk = (b.size + nth - 1) / nth;
+      std::size_t lo = std::min(b.size, tid * chunk);
+      std::size_t hi = std::min(b.size, lo + chunk);
+      for (std::size_t i = lo; i < hi; ++i)
+        target[i] += b.data[i];
+      b.clear(lo, hi);
+    }
+
+  private:
+    struct buffer {
+      T* data = nullptr;
+      /// One past the largest index touched by the thread.
+      std::size_t size = 0;
+      std::size_t capacity = 0;
+
+      void resize(std::size_t n) {
+        if (n > capacity) {
+          capacity = std::max(n, 2 * capacity);
+          T* grown = new T[capacity]();
+          for (std::size_t i = 0; i < size; ++i)
+            grown[i] = data[i];
+          delete[] data;
+          data = grown;
+        }
+        size = n;
+      }
+      void clear(std::size_t lo, std::size_t hi) {
+        for (std::size_t i = lo; i < hi; ++i)
+          data[i] = 0;
+      }
+      void add(const buffer& other) {
+        if (size < other.size)
+          resize(other.size);
+        for (std::size_t i = 0; i < other.size; ++i)
+          data[i] += other.data[i];
+      }
+    };
+
+    int m_Threads;
+    buffer* m_Buffers;
+  };
 #endif
   } // namespace clad
 #endif // CLAD_DIFFERENTIATOR
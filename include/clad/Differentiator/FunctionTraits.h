@@ -718,6 +718,20 @@ namespace clad {
     using type = NoFunction*;
   };
 
+  template <class T, class = void> struct HvpDerivedFnTraits {};
+
+  // HvpDerivedFnTraits is used to deduce type of the derived functions
+  // derived using hvp mode: they take the direction and the product after the
+  // parameters of the function.
+  template <class T>
+  using HvpDerivedFnTraits_t = typename HvpDerivedFnTraits<T>::type;
+
+  // HvpDerivedFnTraits specializations for pure function pointer types
+  template <class ReturnType, class... Args>
+  struct HvpDerivedFnTraits<ReturnType (*)(Args...)> {
+    using type = void (*)(Args..., ReturnType*, ReturnType*);
+  };
+
   /// Compute type of derived function of function, method or functor when
   /// differentiated using forward differentiation mode
   /// (`clad::differentiate`). Computed type is provided as member typedef
@@ -47,6 +47,8 @@ public:
 
     if (m_cnt >= Max_Records || m_off + sizeof(T) > Max_Bytes) {
       // Clad restore_tracker GPU capacity exceeded. Try again with larger value
+      assert(false && "restore_tracker capacity exceeded, increase "
+                      "Max_Records or Max_Bytes");
       return;
     }
 
@@ -64,7 +66,10 @@ public:
 #else
   using RawMemory = std::vector<uint8_t>;
   using Address = char*;
-  std::map<const Address, RawMemory> m_data;
+  /// The stored values in the order they were stored.
+  std::vector<std::pair<Address, RawMemory>> m_data;
+  /// The position in m_data of the value stored at every address.
+  std::map<const Address, std::size_t> m_index;
 
 public:
   // Store the value and the address of `val`.
@@ -74,19 +79,32 @@ public:
     // _tracker.store(x); // stored
     // ...
     // _tracker.store(x); // ignored
-    if (m_data.find((char*)&val) != m_data.end())
-      return;
-    std::vector<uint8_t> buffer(sizeof(T));
-    std::memcpy(buffer.data(), &val, sizeof(T));
-    m_data.emplace((char*)&val, std::move(buffer));
+    // A larger object at the same address, e.g. an array after its first
+    // element, keeps the first value of the bytes stored before.
+    auto* addr = (char*)&val;
+    std::size_t size = sizeof(T);
+    while (size) {
+      auto it = m_index.find(addr);
+      if (it == m_index.end()) {
+        m_index.emplace(addr, m_data.size());
+        m_data.emplace_back(addr, RawMemory(addr, addr + size));
+        return;
+      }
+      std::size_t stored = m_data[it->second].second.size();
+      if (stored >= size)
+        return;
+      addr += stored;
+      size -= stored;
+    }
   }
-  // Set all stored addresses to the corresponsing values bitwise.
+  // Set all stored addresses to the corresponsing values bitwise. Values are
+  // restored in the reverse order so that where stored objects overlap, the
+  // value stored first wins.
   void restore() {
-    for (std::pair<const Address, RawMemory>& pair : m_data) {
-      std::vector<uint8_t>& buffer = pair.second;
-      std::memcpy(pair.first, buffer.data(), buffer.size());
-    }
+    for (auto it = m_data.rbegin(), e = m_data.rend(); it != e; ++it)
+      std::memcpy(it->first, it->second.data(), it->second.size());
     m_data.clear();
+    m_index.clear();
   }
 #endif
 };
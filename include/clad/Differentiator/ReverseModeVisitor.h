@@ -29,9 +29,11 @@
 #include "clang/Sema/Sema.h"
 #include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/MapVector.h"
 #include "llvm/ADT/SmallVector.h"
 
 #include <array>
+#include <cstdint>
 #include <functional>
 #include <limits>
 #include <memory>
@@ -91,12 +93,19 @@ namespace clad {
     /// that will be put immediately in the beginning of derivative function
     /// block.
     Stmts m_Globals;
+    /// The clad::tape_arena holding all tapes of the derivative, created on
+    /// first use if the request asks for it.
+    clang::VarDecl* m_TapeArena = nullptr;
     // Store the Tape-push operation that will be inserted at the end of the
     // OpenMP forward pass
     Stmts m_OMPBlocks;
     // Store the Tape-pop operations that will be inserted at the beginning of
     // the OpenMP reverse pass.
     Stmts m_OMPReverseBlocks;
+    /// Maps the adjoints of the arrays that the current OpenMP loop updates
+    /// through indices shared between iterations to the clad::omp_adjoint
+    /// accumulating them per thread.
+    llvm::MapVector<clang::VarDecl*, clang::VarDecl*> m_OMPAdjointBuffers;
     /// A flag indicating if the Stmt we are currently visiting is inside loop.
     bool isInsideLoop = false;
     /// A flag indicating if the Stmt we are currently visiting is inside an
@@ -385,6 +394,9 @@ namespace clad {
       clang::Expr* Push;
       clang::Expr* Pop;
       clang::Expr* Ref;
+      /// The iteration index passed to every access of a clad::fixed_tape,
+      /// null for other tapes.
+      clang::Expr* Index = nullptr;
       /// A request to get expr accessing last element in the tape
       /// (clad::back(Ref)). Since it is required only rarely, it is built on
       /// demand in the method.
@@ -400,11 +412,27 @@ namespace clad {
     ///
     /// \param[in] prefix The prefix value for the name of the tape.
     ///
+    /// \param[in] packed Whether E is a condition or a small unsigned number
+    /// that can be packed into a clad::bit_tape.
+    ///
     /// \returns A struct containg necessary call expressions for the built
     /// tape
     CladTapeResult MakeCladTapeFor(clang::Expr* E,
                                    llvm::StringRef prefix = "_t",
-                                   clang::QualType type = {});
+                                   clang::QualType type = {},
+                                   bool packed = false);
+
+    /// Builds a bulk store of a one-dimensional array of trivially copyable
+    /// elements to a tape of its elements, e.g.
+    /// \code
+    /// clad::push_n(_t0, arr, 3); // forward
+    /// clad::pop_n(_t0, arr, 3);  // reverse
+    /// \endcode
+    /// so that the whole array is saved and restored with one span copy.
+    ///
+    /// \returns the push and pop calls, or an empty StmtDiff if \p E cannot
+    /// be stored that way.
+    StmtDiff MakeCladBulkStoreFor(clang::Expr* E, llvm::StringRef prefix);
 
     /// A function to get the multi-argument "central_difference"
     /// call expression for the given arguments.
@@ -536,6 +564,8 @@ namespace clad {
     std::array<clang::OMPClause*, 3>
     VisitOMPSharedClause(const clang::OMPSharedClause* C);
     std::array<clang::OMPClause*, 3>
+    VisitOMPNumThreadsClause(const clang::OMPNumThreadsClause* C);
+    std::array<clang::OMPClause*, 3>
     VisitOMPReductionClause(const clang::OMPReductionClause* C);
     StmtDiff
     VisitOMPExecutableDirective(const clang::OMPExecutableDirective* D);
@@ -623,6 +653,29 @@ namespace clad {
                          llvm::SmallVectorImpl<clang::Stmt*>& PreCallStmts,
                          bool isNonDiff, bool isCUDAKernel = false);
 
+    class LoopCounter;
+
+    /// A loop whose trip count is known before it starts. Values saved in its
+    /// body go to clad::fixed_tape objects indexed by the iteration, which are
+    /// sized once before the loop.
+    struct FixedTapeLoop {
+      LoopCounter& Counter;
+      /// The trip count, evaluated right before the loop.
+      clang::Expr* TripCount;
+      /// The fixed tapes created for the loop body.
+      llvm::SmallVector<clang::VarDecl*, 4> Tapes;
+    };
+
+    /// A loop whose iterations save their values as the fields of one record
+    /// on a clad::record_tape, laid out as the values are found.
+    struct FusedTapeLoop {
+      /// The record tape, created for the first saved value.
+      clang::VarDecl* Tape = nullptr;
+      /// The end of the last field and the largest field alignment, in bytes.
+      std::uint64_t Size = 0;
+      std::uint64_t Align = 1;
+    };
+
     /// Allows to easily create and manage a counter for counting the number of
     /// executed iterations of a loop.
     ///
@@ -637,9 +690,21 @@ namespace clad {
       clang::Expr *m_Push = nullptr;
       ReverseModeVisitor& m_RMV;
       clang::VarDecl* m_numRevIterations = nullptr;
+      /// The fixed-tape loop enclosing this one. Only the counter itself is
+      /// stored to its tapes; the rest of the loop runs a variable number of
+      /// times per enclosing iteration and uses regular tapes.
+      FixedTapeLoop* m_EnclosingFixedTapeLoop;
+      /// The fused loop enclosing this one, whose record holds the counter.
+      FusedTapeLoop* m_EnclosingFusedTapeLoop;
 
     public:
       LoopCounter(ReverseModeVisitor& RMV);
+      ~LoopCounter() {
+        m_RMV.m_FixedTapeLoop = m_EnclosingFixedTapeLoop;
+        m_RMV.m_FusedTapeLoop = m_EnclosingFusedTapeLoop;
+      }
+      LoopCounter(const LoopCounter&) = delete;
+      LoopCounter& operator=(const LoopCounter&) = delete;
       /// Returns `clad::push(_t, 0UL)` expression if clad tape is used
       /// for counter; otherwise, returns nullptr.
       clang::Expr* getPush() const { return m_Push; }
@@ -693,15 +758,74 @@ namespace clad {
     /// increment statement, if any.
     ///\param[in] isForLoop should be true if we are differentiating a `for`
     /// loop body; otherwise false.
+    ///\param[in] loopLoc location of the loop, used to find its pragmas.
+    ///\param[in] loop the loop itself, if its iterations can be replayed by
+    /// `#pragma clad checkpoint loop snapshots(S)`.
     ///\returns {forward pass statements, reverse pass statements} for the loop
     /// body.
     StmtDiff DifferentiateLoopBody(
         const clang::Stmt* body, LoopCounter& loopCounter,
         clang::Stmt* condVarDifff = nullptr,
         clang::Stmt* forLoopIncDiff = nullptr, bool isForLoop = false,
-        clang::SourceLocation loopLoc = clang::SourceLocation());
+        clang::SourceLocation loopLoc = clang::SourceLocation(),
+        const clang::Stmt* loop = nullptr);
+
+    /// Differentiates the loop of an OpenMP loop directive. Without a
+    /// \p Schedule, or with `schedule(static)` or `schedule(auto)`, every
+    /// thread gets the chunk computed by clad::GetStaticSchedule in both
+    /// sweeps. Other schedules take their chunks from \p Chunks, a
+    /// clad::omp_schedule that logs them for the reverse sweep.
+    StmtDiff DifferentiateCanonicalLoop(
+        const clang::ForStmt* S,
+        const clang::OMPScheduleClause* Schedule = nullptr,
+        clang::VarDecl* Chunks = nullptr);
+
+    /// Privatises the adjoints of the shared arrays that the iterations of
+    /// \p D may update concurrently in the reverse pass, i.e. those read
+    /// through an index that is not the same injective function of the loop
+    /// variable everywhere, e.g. `w[bin[i]]` or `x[i - 1] + x[i + 1]`.
+    /// Each gets a clad::omp_adjoint, recorded in m_OMPAdjointBuffers.
+    void PrivatizeOMPAdjoints(const clang::OMPLoopDirective* D);
+
+    /// Builds an expression computing the number of iterations of \p FS
+    /// before the loop starts, e.g. `clad::trip_count(0, n, 1, false)` for
+    /// `for (int i = 0; i < n; i++)`.
+    ///
+    /// The loop must have the form `for (i = a; i op b; i += c)`: `i` is an
+    /// integer only changed by the increment, `op` is a relational operator
+    /// or `!=`, `c` is a constant, and `a` and `b` are free of side effects
+    /// and only read local variables that the loop does not change.
+    ///
+    /// \returns the trip count or nullptr if it is not known up front.
+    clang::Expr* BuildLoopTripCount(const clang::ForStmt* FS);
 
-    StmtDiff DifferentiateCanonicalLoop(const clang::ForStmt* S);
+    /// Rewrites the reverse sweep \p Reverse of the loop \p Forward over
+    /// \p IV, whose iterations scatter into neighbouring adjoint elements,
+    /// as a loop gathering the updates of each element, e.g.
+    /// ```
+    /// for (; _t0; _t0--) {
+    ///   i--;
+    ///   double _r_d0 = _d_y[i];
+    ///   _d_y[i] = 0.;
+    ///   _d_x[i - 1] += _r_d0;
+    ///   _d_x[i + 1] += _r_d0;
+    /// }
+    /// ```
+    /// becomes a loop over `_j` adding `_d_y[_j + 1]` and `_d_y[_j - 1]` to
+    /// `_d_x[_j]`, guarded by the bounds of `i`, followed by a loop clearing
+    /// `_d_y`. The iterations of the gather loop are independent.
+    ///
+    /// The loop must have the form `for (i = a; i < b; i++)` (or `<=`) with
+    /// `a` and `b` loop invariant, and the reverse body must only read seeds
+    /// `A[i]`, clear them and add expressions of them to `B[i + c]` for
+    /// constants `c`, with no array both read and updated. The cleared and
+    /// updated arrays must be local arrays or `__restrict` parameters, see
+    /// clad::opts::restrict_adjoints, so that nothing else aliases them.
+    ///
+    /// \returns the gather and clearing loops or nullptr if the reverse sweep
+    /// does not have this form.
+    clang::Stmt* BuildGatherLoop(clang::ForStmt* Forward,
+                                 clang::ForStmt* Reverse, clang::VarDecl* IV);
 
     /// Handles `break`/`continue` inside a differentiated loop. It owns a
     /// control-flow tape recording which one fired in which iteration, so the
@@ -734,7 +858,8 @@ namespace clad {
       llvm::SmallVector<clang::SwitchCase*, 4> m_SwitchCases;
 
       /// `m_ControlFlowTape` tape keeps track of which `break`/`continue`
-      /// statement was hit in which iteration.
+      /// statement was hit in which iteration. With the default tape, the
+      /// case numbers are packed into a clad::bit_tape.
       /// \note `m_ControlFlowTape` is only initialized if the body contains
       /// `continue` or `break` statement.
       std::unique_ptr<CladTapeResult> m_ControlFlowTape;
@@ -837,6 +962,35 @@ namespace clad {
 
     void MarkDeclThreadPrivate(clang::VarDecl* decl);
 
+    /// \returns true if the tapes of the derivative are declared
+    /// `static thread_local` and reused by later calls on the same thread.
+    bool shouldReuseTapes() const;
+
+    /// Makes a reentrant call of a gradient with reused tapes run the plain
+    /// gradient, so that it does not push onto the tapes of the call it is
+    /// nested in:
+    ///   static thread_local bool _active0 = false;
+    ///   if (_active0) {
+    ///     f_grad(x, _d_x);
+    ///     return;
+    ///   }
+    ///   ...
+    ///   static thread_local clad::tape<double> _t1 = {};
+    ///   clad::tape_reuse_guard<clad::tape<double>> _guard0 = {_active0, _t1};
+    /// The guard sets the flag and clears it when the gradient returns or
+    /// throws; a call that throws also has the values it left on the tapes
+    /// discarded, see clad::tape_reuse_guard.
+    /// \returns the declaration of the guard, which follows the tapes, or
+    /// nullptr if no tape is reused.
+    clang::Stmt* BuildTapeReentryGuard();
+
+    /// \returns the storage class of a tape declared in the current context.
+    clang::StorageClass getTapeStorageClass() const {
+      // Threadprivate and reused tapes must be static
+      return isInsideOMPBlock || shouldReuseTapes() ? clang::SC_Static
+                                                    : clang::SC_None;
+    }
+
     /// Stores data required for differentiating a switch statement.
     struct SwitchStmtInfo {
       /// The forward-pass case/default labels, in source order.
@@ -892,6 +1046,14 @@ namespace clad {
 
     /// A flag indicating if the Stmt is contained in a checkpointed loop.
     bool m_IsInsideCheckpointedLoop = false;
+
+    /// The loop whose body is being differentiated if its values go to fixed
+    /// tapes. Reset by every nested loop.
+    FixedTapeLoop* m_FixedTapeLoop = nullptr;
+
+    /// The loop whose body is being differentiated if its values go to one
+    /// record per iteration. Reset by every nested loop.
+    FusedTapeLoop* m_FusedTapeLoop = nullptr;
   };
 } // end namespace clad
 
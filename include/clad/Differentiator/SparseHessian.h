@@ -0,0 +1,205 @@
+#ifndef CLAD_DIFFERENTIATOR_SPARSE_HESSIAN_H
+#define CLAD_DIFFERENTIATOR_SPARSE_HESSIAN_H
+
+#include "clad/Differentiator/Matrix.h"
+#include "clad/Differentiator/SparseJacobian.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <utility>
+#include <vector>
+
+/// Computing sparse hessians with few evaluations of the hessian-vector
+/// product generated by clad::hvp. The hessian is symmetric, so columns can
+/// share a color as long as every nonzero can be read either from its row or
+/// from its transposed position, which needs fewer colors than the column
+/// coloring of jacobians.
+namespace clad {
+
+/// Returns the pattern of \p P with the transposed position of every nonzero
+/// added, i.e. the pattern of a symmetric matrix.
+inline sparsity_pattern symmetrize(const sparsity_pattern& P) {
+  assert(P.rows() == P.cols() && "the hessian must be square");
+  std::vector<std::pair<std::size_t, std::size_t>> entries;
+  entries.reserve(2 * P.nnz());
+  const std::vector<std::size_t>& rowPtr = P.row_ptr();
+  const std::vector<std::size_t>& colIdx = P.col_idx();
+  for (std::size_t i = 0; i < P.rows(); ++i)
+    for (std::size_t k = rowPtr[i]; k < rowPtr[i + 1]; ++k) {
+      entries.emplace_back(i, colIdx[k]);
+      entries.emplace_back(colIdx[k], i);
+    }
+  return sparsity_pattern(P.rows(), P.cols(), std::move(entries));
+}
+
+/// Star-colors the adjacency graph of the symmetric pattern \p P, greedily in
+/// column order: adjacent columns get different colors and every path on four
+/// columns uses at least three colors. Then every nonzero at row i and column
+/// j can be read either from row i of the compressed hessian, when j is the
+/// only column of its color in row i, or otherwise from row j.
+/// \returns the color of every column, and sets \p colors to the number of
+/// colors.
+inline std::vector<std::size_t> star_color(const sparsity_pattern& P,
+                                           std::size_t& colors) {
+  assert(P.rows() == P.cols() && "the hessian must be square");
+  const std::vector<std::size_t>& rowPtr = P.row_ptr();
+  const std::vector<std::size_t>& colIdx = P.col_idx();
+  const std::size_t uncolored = std::numeric_limits<std::size_t>::max();
+  std::vector<std::size_t> color(P.cols(), uncolored);
+  // forbidden[c] == v if color c cannot be given to column v.
+  std::vector<std::size_t> forbidden(P.cols(), uncolored);
+  colors = 0;
+  for (std::size_t v = 0; v < P.cols(); ++v) {
+    for (std::size_t k = rowPtr[v]; k < rowPtr[v + 1]; ++k) {
+      std::size_t w = colIdx[k];
+      if (w == v)
+        continue;
+      if (color[w] != uncolored)
+        forbidden[color[w]] = v;
+      for (std::size_t l = rowPtr[w]; l < rowPtr[w + 1]; ++l) {
+        std::size_t x = colIdx[l];
+        if (x == v || x == w || color[x] == uncolored)
+          continue;
+        // v - w - x with w uncolored: x and v are two leaves of the star that
+        // w will center, they cannot share a color.
+        if (color[w] == uncolored) {
+          forbidden[color[x]] = v;
+          continue;
+        }
+        // v - w - x - y with w and y of the same color would be a bicolored
+        // path on four columns if v took the color of x.
+        for (std::size_t m = rowPtr[x]; m < rowPtr[x + 1]; ++m) {
+          std::size_t y = colIdx[m];
+          if (y != w && y != x && color[y] == color[w]) {
+            forbidden[color[x]] = v;
+            break;
+          }
+        }
+      }
+    }
+    std::size_t c = 0;
+    while (forbidden[c] == v)
+      ++c;
+    color[v] = c;
+    colors = std::max(colors, c + 1);
+  }
+  return color;
+}
+
+/// Computes a hessian with the sparsity pattern given at construction with a
+/// hessian-vector product per color, e.g.
+///
+///   auto d_f = clad::hvp(f, "x[0:999]");
+///   auto hvp = [&](double* v, double* hv) { d_f.execute(x, v, hv); };
+///   clad::sparse_hessian<double> H(clad::detect_hessian_sparsity<double>(
+///       1000, hvp));
+///   clad::csr_matrix<double> hess = H.compute(hvp);
+///
+/// The pattern only depends on the function, so the same sparse_hessian can be
+/// used at every point.
+template <typename T> class sparse_hessian {
+  sparsity_pattern m_Pattern;
+  std::size_t m_NumColors;
+  std::vector<std::size_t> m_Colors;
+
+public:
+  explicit sparse_hessian(const sparsity_pattern& P)
+      : m_Pattern(symmetrize(P)), m_NumColors(0),
+        m_Colors(star_color(m_Pattern, m_NumColors)) {}
+
+  /// Returns the symmetric pattern of the hessian.
+  const sparsity_pattern& pattern() const { return m_Pattern; }
+  /// Returns the number of colors, i.e. the number of hessian-vector products
+  /// needed to compute the hessian.
+  std::size_t colors() const { return m_NumColors; }
+  /// Returns the color of every column of the hessian.
+  const std::vector<std::size_t>& column_colors() const { return m_Colors; }
+
+  /// Returns the direction of color \p c, with a one at every column of that
+  /// color.
+  std::vector<T> seed(std::size_t c) const {
+    assert(c < m_NumColors);
+    std::vector<T> res(m_Pattern.cols(), T());
+    for (std::size_t j = 0; j < m_Pattern.cols(); ++j)
+      if (m_Colors[j] == c)
+        res[j] = 1;
+    return res;
+  }
+
+  /// Recovers the hessian from its products with the seeds, column c of
+  /// \p compressed being the product with seed(c).
+  csr_matrix<T> decompress(const matrix<T>& compressed) const {
+    assert(compressed.rows() == m_Pattern.rows() &&
+           compressed.cols() == m_NumColors);
+    csr_matrix<T> res(m_Pattern);
+    const std::vector<std::size_t>& rowPtr = m_Pattern.row_ptr();
+    const std::vector<std::size_t>& colIdx = m_Pattern.col_idx();
+    // seen[c] == i if row i has a nonzero in a column of color c, and
+    // unique[c] tells whether it is the only one.
+    const std::size_t none = std::numeric_limits<std::size_t>::max();
+    std::vector<std::size_t> seen(m_NumColors, none);
+    std::vector<bool> unique(m_NumColors, false);
+    for (std::size_t i = 0; i < m_Pattern.rows(); ++i) {
+      for (std::size_t k = rowPtr[i]; k < rowPtr[i + 1]; ++k) {
+        std::size_t c = m_Colors[colIdx[k]];
+        unique[c] = seen[c] != i;
+        seen[c] = i;
+      }
+      for (std::size_t k = rowPtr[i]; k < rowPtr[i + 1]; ++k) {
+        std::size_t j = colIdx[k];
+        if (unique[m_Colors[j]])
+          res.values()[k] = compressed(i, m_Colors[j]);
+        else
+          // By symmetry, i is the only column of its color in row j.
+          res.values()[k] = compressed(j, m_Colors[i]);
+      }
+    }
+    return res;
+  }
+
+  /// Computes the hessian with one call `hvp(vector, product)` per color,
+  /// where `hvp` stores the product of the hessian with `vector` in
+  /// `product`, both arrays of pattern().cols() elements.
+  template <typename F> csr_matrix<T> compute(F&& hvp) const {
+    std::size_t n = m_Pattern.cols();
+    matrix<T> compressed(n, m_NumColors);
+    std::vector<T> product(n);
+    for (std::size_t c = 0; c < m_NumColors; ++c) {
+      std::vector<T> vector = seed(c);
+      std::fill(product.begin(), product.end(), T());
+      hvp(vector.data(), product.data());
+      for (std::size_t i = 0; i < n; ++i)
+        compressed(i, c) = product[i];
+    }
+    return decompress(compressed);
+  }
+}; // class sparse_hessian
+
+/// Finds the sparsity pattern of an n x n hessian, running `hvp` as in
+/// sparse_hessian::compute on the unit vectors with the one replaced by a NaN.
+/// As for detect_sparsity, the pattern is not thinned by second derivatives
+/// that vanish at the point, and branches are followed as they are taken
+/// there. This needs n hessian-vector products, but only once per function.
+template <typename T, typename F>
+sparsity_pattern detect_hessian_sparsity(std::size_t n, F&& hvp) {
+  std::vector<std::pair<std::size_t, std::size_t>> entries;
+  std::vector<T> vector(n, T());
+  std::vector<T> product(n);
+  for (std::size_t j = 0; j < n; ++j) {
+    vector[j] = std::numeric_limits<T>::quiet_NaN();
+    std::fill(product.begin(), product.end(), T());
+    hvp(vector.data(), product.data());
+    for (std::size_t i = 0; i < n; ++i)
+      if (std::isnan(product[i]))
+        entries.emplace_back(i, j);
+    vector[j] = T();
+  }
+  return sparsity_pattern(n, n, std::move(entries));
+}
+
+} // namespace clad
+
+#endif // CLAD_DIFFERENTIATOR_SPARSE_HESSIAN_H
@@ -0,0 +1,235 @@
+#ifndef CLAD_DIFFERENTIATOR_SPARSE_JACOBIAN_H
+#define CLAD_DIFFERENTIATOR_SPARSE_JACOBIAN_H
+
+#include "clad/Differentiator/Matrix.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+/// Computing sparse jacobians with few evaluations of the derivative generated
+/// by clad::jacobian<clad::opts::sparse>, which takes the seed matrices of its
+/// array parameters from the caller. Columns of the jacobian that have no
+/// nonzero in a common row are grouped under one color and seeded together,
+/// so that the cost grows with the number of colors instead of the number of
+/// columns.
+namespace clad {
+
+/// The positions of the nonzero entries of a rows x cols matrix in compressed
+/// sparse row (CSR) form: the columns of the nonzeros of row i are
+/// col_idx()[row_ptr()[i]] to col_idx()[row_ptr()[i + 1] - 1], in increasing
+/// order.
+class sparsity_pattern {
+  std::size_t m_Rows = 0;
+  std::size_t m_Cols = 0;
+  std::vector<std::size_t> m_RowPtr;
+  std::vector<std::size_t> m_ColIdx;
+
+public:
+  /// Construct the pattern of a rows x cols matrix with nonzeros at the given
+  /// (row, column) positions, in any order.
+  sparsity_pattern(std::size_t rows, std::size_t cols,
+                   std::vector<std::pair<std::size_t, std::size_t>> entries)
+      : m_Rows(rows), m_Cols(cols), m_RowPtr(rows + 1, 0) {
+    std::sort(entries.begin(), entries.end());
+    entries.erase(std::unique(entries.begin(), entries.end()), entries.end());
+    m_ColIdx.reserve(entries.size());
+    for (const auto& entry : entries) {
+      assert(entry.first < rows && entry.second < cols);
+      ++m_RowPtr[entry.first + 1];
+      m_ColIdx.push_back(entry.second);
+    }
+    for (std::size_t i = 0; i < rows; ++i)
+      m_RowPtr[i + 1] += m_RowPtr[i];
+  }
+
+  std::size_t rows() const { return m_Rows; }
+  std::size_t cols() const { return m_Cols; }
+  /// Returns the number of nonzero entries.
+  std::size_t nnz() const { return m_ColIdx.size(); }
+  const std::vector<std::size_t>& row_ptr() const { return m_RowPtr; }
+  const std::vector<std::size_t>& col_idx() const { return m_ColIdx; }
+}; // class sparsity_pattern
+
+/// Partitions the columns of a matrix with pattern \p P into groups of
+/// columns that have no nonzero in a common row, greedily in column order.
+/// \returns the group (color) of every column, and sets \p colors to the
+/// number of groups.
+inline std::vector<std::size_t> color_columns(const sparsity_pattern& P,
+                                              std::size_t& colors) {
+  const std::vector<std::size_t>& rowPtr = P.row_ptr();
+  const std::vector<std::size_t>& colIdx = P.col_idx();
+  // The rows of the nonzeros of every column.
+  std::vector<std::size_t> colPtr(P.cols() + 1, 0);
+  for (std::size_t col : colIdx)
+    ++colPtr[col + 1];
+  for (std::size_t j = 0; j < P.cols(); ++j)
+    colPtr[j + 1] += colPtr[j];
+  std::vector<std::size_t> rowIdx(P.nnz());
+  std::vector<std::size_t> next(colPtr.begin(), colPtr.end() - 1);
+  for (std::size_t i = 0; i < P.rows(); ++i)
+    for (std::size_t k = rowPtr[i]; k < rowPtr[i + 1]; ++k)
+      rowIdx[next[colIdx[k]]++] = i;
+
+  const std::size_t uncolored = std::numeric_limits<std::size_t>::max();
+  std::vector<std::size_t> color(P.cols(), uncolored);
+  // forbidden[c] == j if a column sharing a row with column j has color c.
+  std::vector<std::size_t> forbidden(P.cols(), uncolored);
+  colors = 0;
+  for (std::size_t j = 0; j < P.cols(); ++j) {
+    for (std::size_t k = colPtr[j]; k < colPtr[j + 1]; ++k) {
+      std::size_t i = rowIdx[k];
+      for (std::size_t l = rowPtr[i]; l < rowPtr[i + 1]; ++l)
+        if (color[colIdx[l]] != uncolored)
+          forbidden[color[colIdx[l]]] = j;
+    }
+    std::size_t c = 0;
+    while (forbidden[c] == j)
+      ++c;
+    color[j] = c;
+    colors = std::max(colors, c + 1);
+  }
+  return color;
+}
+
+/// A sparse matrix in compressed sparse row (CSR) form: values()[k] is the
+/// entry of the k-th nonzero of pattern().
+template <typename T> class csr_matrix {
+  sparsity_pattern m_Pattern;
+  std::vector<T> m_Values;
+
+public:
+  explicit csr_matrix(sparsity_pattern P)
+      : m_Pattern(std::move(P)), m_Values(m_Pattern.nnz()) {}
+
+  std::size_t rows() const { return m_Pattern.rows(); }
+  std::size_t cols() const { return m_Pattern.cols(); }
+  const sparsity_pattern& pattern() const { return m_Pattern; }
+  std::vector<T>& values() { return m_Values; }
+  const std::vector<T>& values() const { return m_Values; }
+
+  /// Returns the entry at the given row and column, zero if it is not a
+  /// nonzero of the pattern.
+  T operator()(std::size_t row, std::size_t col) const {
+    assert(row < rows() && col < cols());
+    const std::vector<std::size_t>& rowPtr = m_Pattern.row_ptr();
+    auto begin = m_Pattern.col_idx().begin() + rowPtr[row];
+    auto end = m_Pattern.col_idx().begin() + rowPtr[row + 1];
+    auto it = std::lower_bound(begin, end, col);
+    if (it == end || *it != col)
+      return T();
+    return m_Values[it - m_Pattern.col_idx().begin()];
+  }
+
+  /// Returns the nonzeros in coordinate (COO) form, as (row, column, value)
+  /// triplets in row-major order.
+  std::vector<std::tuple<std::size_t, std::size_t, T>> coo() const {
+    std::vector<std::tuple<std::size_t, std::size_t, T>> res;
+    res.reserve(m_Values.size());
+    const std::vector<std::size_t>& rowPtr = m_Pattern.row_ptr();
+    for (std::size_t i = 0; i < rows(); ++i)
+      for (std::size_t k = rowPtr[i]; k < rowPtr[i + 1]; ++k)
+        res.emplace_back(i, m_Pattern.col_idx()[k], m_Values[k]);
+    return res;
+  }
+}; // class csr_matrix
+
+/// Computes a jacobian with the sparsity pattern given at construction by
+/// seeding the columns of every color together, e.g.
+///
+///   auto d_f = clad::jacobian<clad::opts::sparse>(f, "x");
+///   auto eval = [&](clad::matrix<double>& seed,
+///                   clad::matrix<double>& compressed) {
+///     d_f.execute(x, _clad_out_y, &seed, &compressed);
+///   };
+///   clad::sparse_jacobian<double> J(clad::detect_sparsity<double>(m, n,
+///                                                                 eval));
+///   clad::csr_matrix<double> jac = J.compute(eval);
+template <typename T> class sparse_jacobian {
+  sparsity_pattern m_Pattern;
+  std::size_t m_NumColors;
+  std::vector<std::size_t> m_Colors;
+
+public:
+  explicit sparse_jacobian(sparsity_pattern P)
+      : m_Pattern(std::move(P)), m_NumColors(0),
+        m_Colors(color_columns(m_Pattern, m_NumColors)) {}
+
+  const sparsity_pattern& pattern() const { return m_Pattern; }
+  /// Returns the number of colors, i.e. the number of columns of the seed and
+  /// of the compressed jacobian.
+  std::size_t colors() const { return m_NumColors; }
+  /// Returns the color of every column of the jacobian.
+  const std::vector<std::size_t>& column_colors() const { return m_Colors; }
+
+  /// Returns the seed matrix of the \p count independent variables starting
+  /// at column \p first of the jacobian: row j has a one in the column of the
+  /// color of column first + j. A function with several array parameters
+  /// takes one such block per parameter.
+  matrix<T> seed(std::size_t first, std::size_t count) const {
+    assert(first + count <= m_Pattern.cols());
+    matrix<T> res(count, m_NumColors);
+    for (std::size_t j = 0; j < count; ++j)
+      res(j, m_Colors[first + j]) = 1;
+    return res;
+  }
+  matrix<T> seed() const { return seed(0, m_Pattern.cols()); }
+
+  /// Recovers the jacobian from its product with the seed: the entry at row i
+  /// and column j is the entry at row i and column color(j) of \p compressed.
+  csr_matrix<T> decompress(const matrix<T>& compressed) const {
+    assert(compressed.rows() == m_Pattern.rows() &&
+           compressed.cols() == m_NumColors);
+    csr_matrix<T> res(m_Pattern);
+    const std::vector<std::size_t>& rowPtr = m_Pattern.row_ptr();
+    const std::vector<std::size_t>& colIdx = m_Pattern.col_idx();
+    for (std::size_t i = 0; i < m_Pattern.rows(); ++i)
+      for (std::size_t k = rowPtr[i]; k < rowPtr[i + 1]; ++k)
+        res.values()[k] = compressed(i, m_Colors[colIdx[k]]);
+    return res;
+  }
+
+  /// Computes the jacobian with one call `eval(seed, compressed)` that runs
+  /// the derivative with the seed of its only array parameter and the
+  /// compressed jacobian as the matrix of its output.
+  template <typename F> csr_matrix<T> compute(F&& eval) const {
+    matrix<T> seed = this->seed();
+    matrix<T> compressed(m_Pattern.rows(), m_NumColors);
+    eval(seed, compressed);
+    return decompress(compressed);
+  }
+}; // class sparse_jacobian
+
+/// Finds the sparsity pattern of a rows x cols jacobian, running `eval` as in
+/// sparse_jacobian::compute on seeds that are NaN for \p block columns at a
+/// time. The NaN reaches exactly the entries of the rows that depend on its
+/// column, regardless of their value at the point, so the pattern is not
+/// thinned by derivatives that vanish there. Branches are followed as they are
+/// taken at the point.
+template <typename T, typename F>
+sparsity_pattern detect_sparsity(std::size_t rows, std::size_t cols, F&& eval,
+                                 std::size_t block = 64) {
+  std::vector<std::pair<std::size_t, std::size_t>> entries;
+  for (std::size_t first = 0; first < cols; first += block) {
+    std::size_t count = std::min(block, cols - first);
+    matrix<T> seed(cols, count);
+    for (std::size_t j = 0; j < count; ++j)
+      seed(first + j, j) = std::numeric_limits<T>::quiet_NaN();
+    matrix<T> compressed(rows, count);
+    eval(seed, compressed);
+    for (std::size_t i = 0; i < rows; ++i)
+      for (std::size_t j = 0; j < count; ++j)
+        if (std::isnan(compressed(i, j)))
+          entries.emplace_back(i, first + j);
+  }
+  return sparsity_pattern(rows, cols, std::move(entries));
+}
+
+} // namespace clad
+
+#endif // CLAD_DIFFERENTIATOR_SPARSE_JACOBIAN_H
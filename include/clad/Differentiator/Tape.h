@@ -2,12 +2,12 @@
 #define CLAD_TAPE_H
 
 #include "clad/Differentiator/CladConfig.h"
+#include "clad/Differentiator/TapeTelemetry.h"
 #include <cassert>
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib> // Added for mkstemp
-#include <future>
 #include <iterator>
 #include <memory>
 #include <new>
@@ -16,9 +16,13 @@
 #include <utility>
 
 #ifndef __CUDA_ARCH__
+#include <cerrno>
+#include <condition_variable>
 #include <cstring>
-#ifndef __CUDACC__
 #include <mutex>
+#include <thread>
+#ifndef __CUDACC__
+#include <atomic>
 #endif
 #ifdef _WIN32
 #include <windows.h>
@@ -30,18 +34,335 @@
 
 namespace clad {
 
+/// Counters describing how a slab pool served allocations.
+struct slab_pool_stats {
+  std::size_t hits = 0;      ///< Allocations served from the free list.
+  std::size_t misses = 0;    ///< Allocations forwarded to operator new.
+  std::size_t retained = 0;  ///< Blocks currently kept in the free list.
+  std::size_t discarded = 0; ///< Released blocks freed because of the cap.
+};
+
+/// Runtime settings of the tapes that offload slabs to disk or to the GPU.
+/// Tapes read them when they are created and keep them until they are
+/// destroyed, clear() included. A change made between two gradient calls
+/// applies to the tapes of the next call, except for the tapes a gradient
+/// generated with clad::opts::reuse_tapes keeps from its first call. The
+/// initial values can be overridden through the environment:
+///   CLAD_TAPE_RAM_BUDGET   bytes of host RAM for slabs (K, M and G suffixes)
+///   CLAD_TAPE_VRAM_BUDGET  bytes of GPU memory for slabs
+///   CLAD_TAPE_PREFETCH     slabs read back ahead of the reverse sweep
+///   CLAD_TAPE_OFFLOAD      `ram` for an anonymous mapping, `file` for a file
+///   CLAD_TAPE_OFFLOAD_DIR  directory of the offload files
+///   CLAD_TAPE_COMPRESS     non-zero to compress offloaded slabs
+struct tape_config {
+  enum class offload_target { ram_disk, file };
+
+  /// Host RAM the slabs of a tape may occupy before they are offloaded.
+  /// `std::size_t(-1)` keeps everything in RAM.
+  std::size_t ram_budget = 1024ULL * 1024 * 1024;
+  /// GPU memory the slabs of a tape may occupy before they move to the host.
+  std::size_t vram_budget = 3800ULL * 1024 * 1024;
+  /// Slabs read back ahead of the reverse sweep; 0 means half the budget.
+  std::size_t prefetch_depth = 0;
+  offload_target target = offload_target::ram_disk;
+  /// Directory of the offload files; empty means the temporary directory.
+  std::string offload_dir;
+  bool compress = false;
+};
+
+#ifndef __CUDA_ARCH__
+namespace detail {
+/// Parses a byte count with an optional K, M or G suffix.
+inline std::size_t parse_size(const char* str, std::size_t fallback) {
+  char* end = nullptr;
+  unsigned long long value = std::strtoull(str, &end, 10);
+  if (end == str)
+    return fallback;
+  switch (*end) {
+  case 'G':
+  case 'g':
+    value *= 1024;
+    // fallthrough
+  case 'M':
+  case 'm':
+    value *= 1024;
+    // fallthrough
+  case 'K':
+  case 'k':
+    value *= 1024;
+    break;
+  default:
+    break;
+  }
+  return static_cast<std::size_t>(value);
+}
+
+inline tape_config tape_config_from_env() {
+  tape_config config;
+  if (const char* env = std::getenv("CLAD_TAPE_RAM_BUDGET"))
+    config.ram_budget = parse_size(env, config.ram_budget);
+  if (const char* env = std::getenv("CLAD_TAPE_VRAM_BUDGET"))
+    config.vram_budget = parse_size(env, config.vram_budget);
+  if (const char* env = std::getenv("CLAD_TAPE_PREFETCH"))
+    config.prefetch_depth = parse_size(env, config.prefetch_depth);
+  if (const char* env = std::getenv("CLAD_TAPE_OFFLOAD")) {
+    if (std::strcmp(env, "file") == 0)
+      config.target = tape_config::offload_target::file;
+    else if (std::strcmp(env, "ram") == 0)
+      config.target = tape_config::offload_target::ram_disk;
+  }
+  if (const char* env = std::getenv("CLAD_TAPE_OFFLOAD_DIR"))
+    config.offload_dir = env;
+  if (const char* env = std::getenv("CLAD_TAPE_COMPRESS"))
+    config.compress = std::strtol(env, nullptr, 10) != 0;
+  return config;
+}
+
+struct tape_config_state {
+  std::mutex m_Mutex;
+  tape_config m_Config = tape_config_from_env();
+};
+
+inline tape_config_state& get_tape_config_state() {
+  static tape_config_state state;
+  return state;
+}
+} // namespace detail
+
+/// \returns the settings new tapes are going to use.
+inline tape_config get_tape_config() {
+  detail::tape_config_state& state = detail::get_tape_config_state();
+  std::lock_guard<std::mutex> lock(state.m_Mutex);
+  return state.m_Config;
+}
+
+/// Replaces the settings used by tapes created from now on. Existing tapes
+/// keep the settings they were created with.
+inline void set_tape_config(const tape_config& config) {
+  detail::tape_config_state& state = detail::get_tape_config_state();
+  std::lock_guard<std::mutex> lock(state.m_Mutex);
+  state.m_Config = config;
+}
+#endif
+
 namespace detail {
 
+#ifndef __CUDA_ARCH__
+/// A thread-local free list of memory blocks of \p BlockSize bytes. Tapes use
+/// it to recycle slabs instead of going through new/delete every time a slab
+/// boundary is crossed. All tapes whose slabs have the same size share a pool,
+/// which in particular means all tapes of the same element type and slab size.
+/// At most `max_retained_bytes()` bytes are kept per thread; blocks released
+/// beyond that are returned to the system.
+template <std::size_t BlockSize> class slab_pool {
+  static_assert(BlockSize >= sizeof(void*), "block cannot hold a link");
+
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  /// Trivially destructible so that it stays usable while other thread-local
+  /// and static objects (e.g. static tapes) are being destroyed.
+  struct State {
+    FreeBlock* m_Free = nullptr;
+    std::size_t m_MaxRetainedBytes = 64ULL * 1024 * 1024;
+    slab_pool_stats m_Stats;
+    bool m_ShutDown = false;
+  };
+
+  /// Drains the free list when the thread exits. Blocks released afterwards
+  /// are freed immediately.
+  struct Reaper {
+    ~Reaper() {
+      State& S = state();
+      release_all(S);
+      S.m_ShutDown = true;
+    }
+  };
+
+  static State& state() {
+    static thread_local State S;
+    return S;
+  }
+
+  static void release_all(State& S) {
+    while (S.m_Free) {
+      FreeBlock* B = S.m_Free;
+      S.m_Free = B->next;
+      ::operator delete(B);
+    }
+    S.m_Stats.retained = 0;
+  }
+
+public:
+  static void* allocate() {
+    State& S = state();
+    if (S.m_Free) {
+      FreeBlock* B = S.m_Free;
+      S.m_Free = B->next;
+      S.m_Stats.hits++;
+      S.m_Stats.retained--;
+      return B;
+    }
+    if (!S.m_ShutDown) {
+      static thread_local Reaper R;
+      (void)R;
+    }
+    S.m_Stats.misses++;
+    return ::operator new(BlockSize);
+  }
+
+  static void deallocate(void* P) {
+    State& S = state();
+    if (S.m_ShutDown ||
+        (S.m_Stats.retained + 1) * BlockSize > S.m_MaxRetainedBytes) {
+      S.m_Stats.discarded++;
+      ::operator delete(P);
+      return;
+    }
+    auto* B = static_cast<FreeBlock*>(P);
+    B->next = S.m_Free;
+    S.m_Free = B;
+    S.m_Stats.retained++;
+  }
+
+  /// \returns the counters of the calling thread's pool.
+  static slab_pool_stats stats() { return state().m_Stats; }
+
+  static std::size_t max_retained_bytes() {
+    return state().m_MaxRetainedBytes;
+  }
+
+  /// Changes the cap of the calling thread's pool, freeing blocks over it.
+  static void set_max_retained_bytes(std::size_t bytes) {
+    State& S = state();
+    S.m_MaxRetainedBytes = bytes;
+    while (S.m_Free && S.m_Stats.retained * BlockSize > bytes) {
+      FreeBlock* B = S.m_Free;
+      S.m_Free = B->next;
+      S.m_Stats.retained--;
+      S.m_Stats.discarded++;
+      ::operator delete(B);
+    }
+  }
+
+  /// Returns all retained blocks of the calling thread to the system.
+  static void trim() { release_all(state()); }
+};
+#endif
+
+/// Allocates and frees slab-sized blocks, going through `slab_pool` on the
+/// host when the alignment of the block allows it.
+template <std::size_t BlockSize, std::size_t Alignment> struct slab_allocator {
+  static constexpr bool kPooled = Alignment <= alignof(std::max_align_t);
+
+  CUDA_HOST_DEVICE static void* allocate() {
+#ifndef __CUDA_ARCH__
+    if (kPooled)
+      return slab_pool<BlockSize>::allocate();
+#endif
+    return ::operator new(BlockSize);
+  }
+
+  CUDA_HOST_DEVICE static void deallocate(void* P) {
+#ifndef __CUDA_ARCH__
+    if (kPooled) {
+      slab_pool<BlockSize>::deallocate(P);
+      return;
+    }
+#endif
+    ::operator delete(P);
+  }
+};
+
+/// A self-contained lossless codec for slabs of numeric data. Every 8-byte
+/// word is XOR-ed with its predecessor and only the bytes below the highest
+/// non-zero byte are kept, prefixed by a 4-bit length; two lengths share a
+/// header byte. Neighbouring values of smooth floating-point data share sign,
+/// exponent and leading mantissa bits, so their XOR has many zero high bytes.
+/// Trailing bytes that do not form a whole word are stored verbatim.
+struct xor_delta_codec {
+  /// \returns an upper bound of the encoded size of \p bytes bytes.
+  static constexpr std::size_t max_encoded_size(std::size_t bytes) {
+    return bytes + (bytes / 8 + 1) / 2;
+  }
+
+  /// Encodes \p bytes bytes of \p src to \p dst, which must be able to hold
+  /// `max_encoded_size(bytes)` bytes. \returns the encoded size.
+  static std::size_t encode(const unsigned char* src, std::size_t bytes,
+                            unsigned char* dst) {
+    const std::size_t words = bytes / 8;
+    unsigned char* out = dst;
+    std::uint64_t prev = 0;
+    for (std::size_t i = 0; i < words; i += 2) {
+      unsigned char* header = out++;
+      *header = 0;
+      for (std::size_t j = i; j < i + 2 && j < words; ++j) {
+        std::uint64_t w;
+        std::memcpy(&w, src + j * 8, 8);
+        std::uint64_t x = w ^ prev;
+        prev = w;
+        unsigned len = 0;
+        while (len < 8 && (x >> (8 * len)))
+          ++len;
+        *header |= static_cast<unsigned char>(len << (4 * (j - i)));
+        for (unsigned k = 0; k < len; ++k)
+          *out++ = static_cast<unsigned char>(x >> (8 * k));
+      }
+    }
+    std::memcpy(out, src + words * 8, bytes - words * 8);
+    out += bytes - words * 8;
+    return out - dst;
+  }
+
+  /// Decodes the encoding of \p bytes original bytes from \p src to \p dst.
+  static void decode(const unsigned char* src, std::size_t bytes,
+                     unsigned char* dst) {
+    const std::size_t words = bytes / 8;
+    const unsigned char* in = src;
+    std::uint64_t prev = 0;
+    for (std::size_t i = 0; i < words; i += 2) {
+      unsigned char header = *in++;
+      for (std::size_t j = i; j < i + 2 && j < words; ++j) {
+        unsigned len = (header >> (4 * (j - i))) & 0xF;
+        std::uint64_t x = 0;
+        for (unsigned k = 0; k < len; ++k)
+          x |= static_cast<std::uint64_t>(*in++) << (8 * k);
+        prev ^= x;
+        std::memcpy(dst + j * 8, &prev, 8);
+      }
+    }
+    std::memcpy(dst + words * 8, in, bytes - words * 8);
+  }
+};
+
 /// Manages offloading of data to disk when RAM capacity is exceeded.
 /// Operates in two modes:
 /// 1. RAM-DISK mode: Zero SSD wears.
 /// 2. Disk offload mode: For heavy tasks
+/// When compression is enabled, every slab is stored as a variable-length
+/// record: a `RecordHeader` followed by either the `xor_delta_codec` encoding
+/// or, if that does not pay off, the raw bytes. The offset returned by
+/// write_slab identifies the record, so the per-slab offsets kept by the tape
+/// form the index of the file.
 template <typename T, std::size_t SLAB_SIZE> struct DiskManager {
 #ifndef __CUDA_ARCH__
+  struct RecordHeader {
+    std::uint64_t size; ///< Number of payload bytes that follow.
+    std::uint64_t compressed;
+  };
+  static constexpr std::size_t kSlabBytes = SLAB_SIZE * sizeof(T);
+  static constexpr std::size_t kMaxRecordBytes =
+      sizeof(RecordHeader) + xor_delta_codec::max_encoded_size(kSlabBytes);
+
   std::size_t capacity;
   std::size_t current_offset;
   void* data;
   bool is_file_backed;
+  bool is_compressed;
+  /// Bytes handed to write_slab and bytes actually stored for them.
+  std::size_t raw_bytes = 0;
+  std::size_t stored_bytes = 0;
 
 #ifdef _WIN32
   HANDLE file_handle_ = INVALID_HANDLE_VALUE;
@@ -50,21 +371,27 @@ template <typename T, std::size_t SLAB_SIZE> struct DiskManager {
   int fd = -1;
 #endif
 
-  DiskManager(bool use_file_offload = false)
+  DiskManager(bool use_file_offload = false, bool use_compression = false,
+              const std::string& dir = std::string())
       : capacity((sizeof(std::size_t) >= 8) ? (64ULL * 1024 * 1024 * 1024)
                                             : (1024ULL * 1024 * 1024)),
-        current_offset(0), data(nullptr), is_file_backed(use_file_offload) {
+        current_offset(0), data(nullptr), is_file_backed(use_file_offload),
+        is_compressed(use_compression) {
+
+    if (is_compressed)
+      m_Scratch.reset(new unsigned char[kMaxRecordBytes]);
 
     // Fallback loop: If OS rejects massive virtual allocation then shrink the
     // capacity by half until the OS accepts it
-    while (!data && capacity >= SLAB_SIZE * sizeof(T)) {
+    while (!is_open() && capacity >= SLAB_SIZE * sizeof(T)) {
 #ifdef _WIN32
       if (is_file_backed) {
         // Mode B: Disk Offload
         char temp_path[MAX_PATH];
         GetTempPathA(MAX_PATH, temp_path);
         char temp_file[MAX_PATH];
-        GetTempFileNameA(temp_path, "clad", 0, temp_file);
+        GetTempFileNameA(dir.empty() ? temp_path : dir.c_str(), "clad", 0,
+                         temp_file);
         file_handle_ = CreateFileA(
             temp_file, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
             FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
@@ -99,16 +426,14 @@ template <typename T, std::size_t SLAB_SIZE> struct DiskManager {
 #endif
 
       if (is_file_backed) {
-        // Mode B: Disk Offload
-        char template_path[] = "/tmp/clad_tape_XXXXXX";
-        fd = mkstemp(template_path);
-        if (fd != -1) {
-          unlink(template_path); // Auto-deletes on close
-          if (ftruncate(fd, capacity) == 0) {
-            data =
-                mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-          }
-        }
+        // Mode B: Disk Offload. The file is accessed with pread/pwrite rather
+        // than mapped, so writing a slab never faults in pages of the file.
+        std::string template_path =
+            (dir.empty() ? std::string("/tmp") : dir) + "/clad_tape_XXXXXX";
+        fd = mkstemp(&template_path[0]);
+        if (fd != -1)
+          unlink(template_path.c_str()); // Auto-deletes on close
+        break;
       } else {
         // Mode A: RAM-Disk
         data = mmap(NULL, capacity, PROT_READ | PROT_WRITE,
@@ -123,13 +448,13 @@ template <typename T, std::size_t SLAB_SIZE> struct DiskManager {
         }
       }
 #endif
-      if (!data)
+      if (!is_open())
         capacity /= 2;
     }
   }
 
   ~DiskManager() {
-    if (!data)
+    if (!is_open())
       return;
 #ifdef _WIN32
     UnmapViewOfFile(data);
@@ -138,35 +463,160 @@ template <typename T, std::size_t SLAB_SIZE> struct DiskManager {
     if (file_handle_ != INVALID_HANDLE_VALUE)
       CloseHandle(file_handle_);
 #else
-    munmap(data, capacity);
+    if (data)
+      munmap(data, capacity);
     if (fd != -1)
       close(fd);
 #endif
   }
 
+  /// \returns true if the backing storage could be set up.
+  bool is_open() const {
+#ifdef _WIN32
+    return data;
+#else
+    return data || fd != -1;
+#endif
+  }
+
   std::size_t write_slab(const T* incoming_data) {
-    if (!this->data || current_offset + (SLAB_SIZE * sizeof(T)) > capacity) {
+    if (is_compressed)
+      return write_record(incoming_data);
+
+    if (!is_open() || current_offset + (SLAB_SIZE * sizeof(T)) > capacity) {
       assert(false && "Virtual memory capacity exceeded in DiskManager");
       return static_cast<std::size_t>(-1);
     }
 
     std::size_t write_pos = current_offset;
-    void* dest = static_cast<char*>(this->data) + write_pos;
-    std::memcpy(dest, incoming_data, SLAB_SIZE * sizeof(T));
+    store(write_pos,
+          const_cast<const void*>(
+              static_cast<const volatile void*>(incoming_data)),
+          kSlabBytes);
 
     current_offset += SLAB_SIZE * sizeof(T);
+    raw_bytes += kSlabBytes;
+    stored_bytes += kSlabBytes;
     return write_pos;
   }
 
   void read_slab(T* dest, std::size_t offset) {
-    if (!this->data)
+    if (!is_open())
+      return;
+    if (is_compressed) {
+      read_record(dest, offset);
       return;
-    void* src = static_cast<char*>(this->data) + offset;
-    std::memcpy(const_cast<void*>(static_cast<const volatile void*>(dest)), src,
-                SLAB_SIZE * sizeof(T));
+    }
+    load(const_cast<void*>(static_cast<const volatile void*>(dest)), offset,
+         kSlabBytes);
+  }
+
+  /// \returns the ratio between the bytes handed to write_slab and the bytes
+  /// stored for them.
+  double compression_ratio() const {
+    return stored_bytes ? static_cast<double>(raw_bytes) / stored_bytes : 1.0;
+  }
+
+private:
+  /// Staging buffer for compressed records.
+  std::unique_ptr<unsigned char[]> m_Scratch;
+
+  void store(std::size_t pos, const void* src, std::size_t bytes) {
+#ifndef _WIN32
+    if (!data) {
+      const char* p = static_cast<const char*>(src);
+      while (bytes) {
+        ssize_t n = pwrite(fd, p, bytes, static_cast<off_t>(pos));
+        if (n < 0 && errno == EINTR)
+          continue;
+        if (n <= 0) {
+          assert(false && "Failed to write the offload file");
+          return;
+        }
+        p += n;
+        pos += n;
+        bytes -= n;
+      }
+      return;
+    }
+#endif
+    std::memcpy(static_cast<char*>(data) + pos, src, bytes);
+  }
+
+  void load(void* dest, std::size_t pos, std::size_t bytes) {
+#ifndef _WIN32
+    if (!data) {
+      char* p = static_cast<char*>(dest);
+      while (bytes) {
+        ssize_t n = pread(fd, p, bytes, static_cast<off_t>(pos));
+        if (n < 0 && errno == EINTR)
+          continue;
+        if (n <= 0) {
+          assert(false && "Failed to read the offload file");
+          return;
+        }
+        p += n;
+        pos += n;
+        bytes -= n;
+      }
+      return;
+    }
+#endif
+    std::memcpy(dest, static_cast<const char*>(data) + pos, bytes);
+  }
+
+  std::size_t write_record(const T* incoming_data) {
+    if (!is_open() || current_offset + kMaxRecordBytes > capacity) {
+      assert(false && "Virtual memory capacity exceeded in DiskManager");
+      return static_cast<std::size_t>(-1);
+    }
+
+    std::size_t write_pos = current_offset;
+    unsigned char* payload = m_Scratch.get() + sizeof(RecordHeader);
+    const auto* raw = static_cast<const unsigned char*>(
+        const_cast<const void*>(static_cast<const volatile void*>(incoming_data)));
+    RecordHeader header;
+    header.size = xor_delta_codec::encode(raw, kSlabBytes, payload);
+    header.compressed = 1;
+    if (header.size >= kSlabBytes) {
+      header.size = kSlabBytes;
+      header.compressed = 0;
+    }
+    std::memcpy(m_Scratch.get(), &header, sizeof(header));
+    if (header.compressed) {
+      store(write_pos, m_Scratch.get(), sizeof(RecordHeader) + header.size);
+    } else {
+      store(write_pos, m_Scratch.get(), sizeof(RecordHeader));
+      store(write_pos + sizeof(RecordHeader), raw, kSlabBytes);
+    }
+
+    std::size_t record_bytes = sizeof(RecordHeader) + header.size;
+    // Keep the headers aligned.
+    record_bytes = (record_bytes + alignof(RecordHeader) - 1) &
+                   ~(alignof(RecordHeader) - 1);
+    current_offset += record_bytes;
+    raw_bytes += kSlabBytes;
+    stored_bytes += record_bytes;
+    return write_pos;
+  }
+
+  void read_record(T* dest, std::size_t offset) {
+    RecordHeader header;
+    load(&header, offset, sizeof(header));
+    auto* out = static_cast<unsigned char*>(
+        const_cast<void*>(static_cast<const volatile void*>(dest)));
+    if (header.compressed) {
+      load(m_Scratch.get(), offset + sizeof(RecordHeader), header.size);
+      xor_delta_codec::decode(m_Scratch.get(), kSlabBytes, out);
+    } else {
+      load(out, offset + sizeof(RecordHeader), kSlabBytes);
+    }
   }
 #else
-  CUDA_HOST_DEVICE DiskManager(bool use_file_offload = false) {}
+  CUDA_HOST_DEVICE DiskManager(bool use_file_offload = false,
+                               bool use_compression = false) {}
+  DiskManager(bool use_file_offload, bool use_compression,
+              const std::string& dir) {}
   CUDA_HOST_DEVICE ~DiskManager() {}
   CUDA_HOST_DEVICE std::size_t write_slab(const T* data) { return 0; }
   CUDA_HOST_DEVICE void read_slab(T* dest, std::size_t offset) {}
@@ -176,13 +626,120 @@ template <typename T, std::size_t SLAB_SIZE> struct DiskManager {
 template <typename T, std::size_t SLAB_SIZE>
 struct RamDiskManager : public DiskManager<T, SLAB_SIZE> {
 #ifndef __CUDA_ARCH__
-  RamDiskManager(bool use_file_offload = false)
-      : DiskManager<T, SLAB_SIZE>(use_file_offload) {}
+  RamDiskManager(bool use_file_offload = false, bool use_compression = false,
+                 const std::string& dir = std::string())
+      : DiskManager<T, SLAB_SIZE>(use_file_offload, use_compression, dir) {}
 #else
   CUDA_HOST_DEVICE RamDiskManager() {}
 #endif
 };
 
+#ifndef __CUDA_ARCH__
+/// A persistent background thread performing the slab I/O of an offloading
+/// tape. Requests go through a bounded ring buffer, so several slabs can be in
+/// flight at once and the owner only blocks when the queue is full or when it
+/// needs the outcome of a particular request. The thread is started by the
+/// first request.
+class io_worker {
+public:
+  using job_fn = void (*)(void* context, void* arg);
+  static constexpr std::size_t kQueueDepth = 16;
+
+  io_worker() = default;
+  io_worker(const io_worker&) = delete;
+  io_worker& operator=(const io_worker&) = delete;
+
+  ~io_worker() {
+    {
+      std::lock_guard<std::mutex> lock(m_Mutex);
+      m_Stop = true;
+    }
+    m_Submitted.notify_one();
+    if (m_Thread.joinable())
+      m_Thread.join();
+  }
+
+  /// Queues `fn(context, arg)` and sets \p pending until it has run. Blocks
+  /// while the queue is full.
+  void submit(job_fn fn, void* context, void* arg, bool* pending) {
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    m_Completed.wait(lock, [this] { return m_Queued < kQueueDepth; });
+    push(fn, context, arg, pending);
+  }
+
+  /// Like submit but gives up instead of blocking on a full queue.
+  /// \returns true if the request was queued.
+  bool try_submit(job_fn fn, void* context, void* arg, bool* pending) {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if (m_Queued == kQueueDepth)
+      return false;
+    push(fn, context, arg, pending);
+    return true;
+  }
+
+  /// Blocks until the request which set \p pending has run.
+  void wait(const bool* pending) {
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    m_Completed.wait(lock, [pending] { return !*pending; });
+  }
+
+  /// Blocks until all queued requests have run.
+  void wait_idle() {
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    m_Completed.wait(lock, [this] { return !m_InFlight; });
+  }
+
+private:
+  struct Job {
+    job_fn fn;
+    void* context;
+    void* arg;
+    bool* pending;
+  };
+
+  /// Requires m_Mutex to be held.
+  void push(job_fn fn, void* context, void* arg, bool* pending) {
+    if (!m_Thread.joinable())
+      m_Thread = std::thread([this] { run(); });
+    *pending = true;
+    m_Queue[(m_Head + m_Queued) % kQueueDepth] = Job{fn, context, arg, pending};
+    ++m_Queued;
+    ++m_InFlight;
+    m_Submitted.notify_one();
+  }
+
+  void run() {
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    while (true) {
+      m_Submitted.wait(lock, [this] { return m_Stop || m_Queued; });
+      // Drain the queue before honouring a stop request.
+      if (!m_Queued)
+        return;
+      Job job = m_Queue[m_Head];
+      m_Head = (m_Head + 1) % kQueueDepth;
+      --m_Queued;
+      lock.unlock();
+      job.fn(job.context, job.arg);
+      lock.lock();
+      *job.pending = false;
+      --m_InFlight;
+      m_Completed.notify_all();
+    }
+  }
+
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-member-init)
+  Job m_Queue[kQueueDepth];
+  std::size_t m_Head = 0;
+  std::size_t m_Queued = 0;   ///< Requests waiting in m_Queue.
+  std::size_t m_InFlight = 0; ///< Requests queued or running.
+  bool m_Stop = false;
+  std::mutex m_Mutex;
+  std::condition_variable m_Submitted;
+  std::condition_variable m_Completed;
+  std::thread m_Thread;
+};
+#endif
+
 struct NoOpMutex {
   void lock() {}
   void unlock() {}
@@ -272,10 +829,13 @@ class tape_impl {
       return reinterpret_cast<T*>(raw_data);
     }
     CUDA_HOST_DEVICE void allocate() {}
+    CUDA_HOST_DEVICE void allocate_ram() {}
     CUDA_HOST_DEVICE void deallocate() {}
   };
 
   struct DiskStorage {
+    using buffer_allocator =
+        detail::slab_allocator<SLAB_SIZE * sizeof(T), alignof(T)>;
     T* dataptr = nullptr;
     bool is_on_disk = false;
     bool is_in_ram = true; // Required to prevent compilation errors
@@ -289,13 +849,13 @@ class tape_impl {
 
     void allocate() {
       if (!dataptr)
-        dataptr = static_cast<T*>(::operator new(SLAB_SIZE * sizeof(T)));
+        dataptr = static_cast<T*>(buffer_allocator::allocate());
     }
     void allocate_ram() { allocate(); }
 
     void deallocate() {
       if (dataptr) {
-        ::operator delete(dataptr);
+        buffer_allocator::deallocate(dataptr);
         dataptr = nullptr;
       }
     }
@@ -366,9 +926,38 @@ public:
   struct Slab : public SlabBase {
     Slab* prev;
     Slab* next;
+    /// Offloading only: a write of the elements was queued, so the copy at
+    /// `disk_offset` is (or will be) valid. Cleared when elements are pushed
+    /// into the slab again.
+    bool is_written = false;
+    /// Offloading only: the queued write has not been counted as written yet.
+    bool write_uncounted = false;
+    /// Offloading only: a prefetch was queued; the elements are valid once
+    /// the I/O worker clears `io_pending`.
+    bool read_submitted = false;
+    /// Set while the I/O worker has a request for this slab. Guarded by the
+    /// worker.
+    bool io_pending = false;
     CUDA_HOST_DEVICE Slab() : prev(nullptr), next(nullptr) {}
   };
 
+  /// RAM slabs hold their elements inline and are recycled as a whole. Slabs
+  /// of the offload variants are small headers; their element buffers are
+  /// recycled by the storage itself.
+  using slab_allocator = detail::slab_allocator<sizeof(Slab), alignof(Slab)>;
+  static constexpr bool kPooledSlabs =
+      !DiskOffload && !GpuOffload && slab_allocator::kPooled;
+
+#ifndef __CUDA_ARCH__
+  /// \returns the counters of the calling thread's pool used by this tape
+  /// type. Offload tapes report the pool of their element buffers.
+  static slab_pool_stats get_slab_pool_stats() {
+    return (DiskOffload && !GpuOffload)
+               ? detail::slab_pool<SLAB_SIZE * sizeof(T)>::stats()
+               : detail::slab_pool<sizeof(Slab)>::stats();
+  }
+#endif
+
 protected:
   // std::aligned_storage_t<sizeof(T), alignof(T)> m_static_buffer[SBO_SIZE];
   // For now use the implementation below as above implementation is not
@@ -378,6 +967,10 @@ protected:
 
   Slab* m_head = nullptr;
   Slab* m_tail = nullptr;
+  /// Directory of all allocated slabs indexed by their position in the slab
+  /// list. Gives constant-time random access instead of walking `next`.
+  Slab** m_SlabDir = nullptr;
+  std::size_t m_SlabDirCapacity = 0;
   std::size_t m_size = 0;
   std::size_t m_capacity = SBO_SIZE;
 #ifndef __CUDACC__
@@ -387,9 +980,7 @@ protected:
   /// and also keep track of active/maximum RAM slabs.
 #ifndef __CUDA_ARCH__
   struct HostAsyncState {
-    std::future<void> m_AsyncWrite;
-    Slab* m_AsyncSlab = nullptr;
-    std::future<void> m_AsyncRead;
+    detail::io_worker m_Worker;
   };
 #endif
   struct DiskInfo {
@@ -401,27 +992,41 @@ protected:
     std::size_t m_ActiveVramSlabs = 0;
     std::size_t m_MaxVramSlabs;
     bool m_use_file_offload = false;
+    bool m_use_compression = false;
+    std::string m_offload_dir;
 
     void* m_AsyncState = nullptr;
 
     DiskInfo() {
+#ifndef __CUDA_ARCH__
+      configure(get_tape_config());
+      m_AsyncState = new HostAsyncState();
+#else
+      configure(tape_config());
+#endif
+    }
+
+    /// Derives the slab limits and the offload mode from \p config.
+    void configure(const tape_config& config) {
       std::size_t bytes_per_slab = SLAB_SIZE * sizeof(T);
       m_MaxVramSlabs =
-          (3800ULL * 1024 * 1024) / (bytes_per_slab > 0 ? bytes_per_slab : 1);
+          config.vram_budget / (bytes_per_slab > 0 ? bytes_per_slab : 1);
       if (m_MaxVramSlabs == 0)
         m_MaxVramSlabs = 1;
       m_MaxRamSlabs =
-          (1024ULL * 1024 * 1024) / (bytes_per_slab > 0 ? bytes_per_slab : 1);
+          config.ram_budget / (bytes_per_slab > 0 ? bytes_per_slab : 1);
       if (m_MaxRamSlabs == 0)
         m_MaxRamSlabs = 1;
-      m_RevPrefetch = m_MaxRamSlabs / 2;
-      m_RamPrefetch = (m_MaxRamSlabs * 8) / 10;
-      if (m_RamPrefetch == 0)
-        m_RamPrefetch = 1;
-
-#ifndef __CUDA_ARCH__
-      m_AsyncState = new HostAsyncState();
-#endif
+      // The reverse sweep prefetches once this few slabs are left in RAM.
+      std::size_t depth =
+          config.prefetch_depth ? config.prefetch_depth : m_MaxRamSlabs / 2;
+      m_RevPrefetch = depth < m_MaxRamSlabs ? m_MaxRamSlabs - depth : 0;
+      // Write-backs start ahead of time at 80% of the budget.
+      m_RamPrefetch = m_MaxRamSlabs - m_MaxRamSlabs / 5;
+      m_use_file_offload =
+          config.target == tape_config::offload_target::file;
+      m_use_compression = config.compress;
+      m_offload_dir = config.offload_dir;
     }
     ~DiskInfo() {
 #ifndef __CUDA_ARCH__
@@ -457,11 +1062,152 @@ protected:
 #endif
   }
 
+  CUDA_HOST_DEVICE static Slab* create_slab() {
+    if (kPooledSlabs)
+      return ::new (slab_allocator::allocate()) Slab();
+    // NOLINTNEXTLINE(cppcoreguidelines-owning-memory)
+    return new Slab();
+  }
+
+  CUDA_HOST_DEVICE static void destroy_slab(Slab* slab) {
+    if (kPooledSlabs) {
+      slab->~Slab();
+      slab_allocator::deallocate(slab);
+      return;
+    }
+    // NOLINTNEXTLINE(cppcoreguidelines-owning-memory)
+    delete slab;
+  }
+
+  /// \returns the number of slabs currently linked into the tape.
+  CUDA_HOST_DEVICE std::size_t num_slabs() const {
+    return (m_capacity - SBO_SIZE) / SLAB_SIZE;
+  }
+
+  /// Appends \p slab to the slab directory, growing it geometrically.
+  CUDA_HOST_DEVICE void register_slab(Slab* slab) {
+    std::size_t n = num_slabs();
+    if (n == m_SlabDirCapacity) {
+      std::size_t new_capacity = m_SlabDirCapacity ? 2 * m_SlabDirCapacity : 8;
+      // NOLINTNEXTLINE(cppcoreguidelines-owning-memory)
+      Slab** dir = new Slab*[new_capacity];
+      for (std::size_t i = 0; i < n; ++i)
+        dir[i] = m_SlabDir[i];
+      // NOLINTNEXTLINE(cppcoreguidelines-owning-memory)
+      delete[] m_SlabDir;
+      m_SlabDir = dir;
+      m_SlabDirCapacity = new_capacity;
+    }
+    m_SlabDir[n] = slab;
+  }
+
   CUDA_HOST_DEVICE DiskInfo& getDiskInfo() {
     // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
     return *reinterpret_cast<DiskInfo*>(&m_state);
   }
 
+  CUDA_HOST_DEVICE detail::DiskManager<T, SLAB_SIZE>* disk_manager() {
+    DiskInfo& info = getDiskInfo();
+    if (!info.m_DiskManager)
+      info.m_DiskManager.reset(new detail::DiskManager<T, SLAB_SIZE>(
+          info.m_use_file_offload, info.m_use_compression,
+          info.m_offload_dir));
+    return info.m_DiskManager.get();
+  }
+
+#ifndef __CUDA_ARCH__
+  detail::io_worker& io() {
+    return static_cast<HostAsyncState*>(getDiskInfo().m_AsyncState)->m_Worker;
+  }
+
+  static void write_job(void* dm, void* slab) {
+    auto* s = static_cast<Slab*>(slab);
+    s->disk_offset = static_cast<detail::DiskManager<T, SLAB_SIZE>*>(dm)
+                         ->write_slab(s->elements());
+  }
+
+  static void read_job(void* dm, void* slab) {
+    auto* s = static_cast<Slab*>(slab);
+    static_cast<detail::DiskManager<T, SLAB_SIZE>*>(dm)->read_slab(
+        s->elements(), s->disk_offset);
+  }
+
+  /// Queues the write-back of \p slab. Unless \p may_block is set, gives up
+  /// when the I/O queue is full. \returns true if the write was queued.
+  bool submit_write(Slab* slab, bool may_block) {
+    detail::DiskManager<T, SLAB_SIZE>* dm = disk_manager();
+    if (may_block)
+      io().submit(write_job, dm, slab, &slab->io_pending);
+    else if (!io().try_submit(write_job, dm, slab, &slab->io_pending))
+      return false;
+    slab->is_written = true;
+    slab->write_uncounted = true;
+    return true;
+  }
+
+  /// Counts the write of \p slab once it has completed. The telemetry scope
+  /// belongs to the thread owning the tape, so the count is taken when that
+  /// thread observes the completion rather than by the I/O worker.
+  static void count_write(Slab* slab) {
+    if (!slab->write_uncounted)
+      return;
+    slab->write_uncounted = false;
+    detail::tape_events::written(SLAB_SIZE * sizeof(T));
+  }
+
+  /// Waits until the I/O worker no longer touches the elements of \p slab.
+  void finish_io(Slab* slab) {
+    if (slab->is_written || slab->read_submitted) {
+      io().wait(&slab->io_pending);
+      slab->read_submitted = false;
+      count_write(slab);
+    }
+  }
+#endif
+
+  /// Called before elements are stored into \p slab: a copy written out
+  /// earlier no longer matches the slab, so the next eviction must write it
+  /// again.
+  CUDA_HOST_DEVICE void invalidate_written(Slab* slab) {
+#ifndef __CUDA_ARCH__
+    if (!slab->is_written)
+      return;
+    finish_io(slab);
+    slab->is_written = false;
+#endif
+  }
+
+  /// Moves \p slab to disk and releases its buffer. The write is skipped if
+  /// an earlier one already stored the same elements.
+  CUDA_HOST_DEVICE void evict_slab(Slab* slab) {
+    DiskInfo& info = getDiskInfo();
+#ifndef __CUDA_ARCH__
+    if (!slab->is_written)
+      submit_write(slab, /*may_block=*/true);
+    finish_io(slab);
+#else
+    slab->disk_offset = disk_manager()->write_slab(slab->elements());
+#endif
+    // The buffer goes back to the slab pool and is reused by the next slab
+    // that gets allocated or loaded back from disk.
+    slab->deallocate();
+    slab->is_on_disk = true;
+    slab->is_in_ram = false;
+    info.m_ActiveSlabs--;
+    detail::tape_events::eviction();
+    detail::tape_events::ram_slabs(-1);
+  }
+
+  /// Reads the elements of \p slab, whose buffer is allocated, from disk.
+  CUDA_HOST_DEVICE void load_slab(Slab* slab) {
+#ifndef __CUDA_ARCH__
+    io().submit(read_job, disk_manager(), slab, &slab->io_pending);
+    io().wait(&slab->io_pending);
+#else
+    disk_manager()->read_slab(slab->elements(), slab->disk_offset);
+#endif
+  }
+
   CUDA_HOST_DEVICE void check_and_evict_impl(std::true_type) {
     DiskInfo& info = getDiskInfo();
     if (GpuOffload && info.m_ActiveVramSlabs >= info.m_MaxVramSlabs) {
@@ -480,62 +1226,30 @@ protected:
 #endif
         info.m_ActiveVramSlabs--;
         info.m_ActiveSlabs++;
+        detail::tape_events::ram_slabs(1);
       }
     }
 
     if (DiskOffload && info.m_ActiveSlabs >= info.m_RamPrefetch) {
+#ifndef __CUDA_ARCH__
+      // Past the prefetch threshold, queue write-backs ahead of time so that
+      // the eviction below finds the data already on disk.
       Slab* candidate = m_head;
       while (candidate &&
-             (candidate->is_on_disk || (GpuOffload && !candidate->is_in_ram) ||
-              candidate == m_tail))
+             (candidate->is_on_disk || candidate->is_written ||
+              (GpuOffload && !candidate->is_in_ram) || candidate == m_tail))
         candidate = candidate->next;
-
-      if (candidate) {
-        if (info.m_ActiveSlabs >= info.m_MaxRamSlabs) {
-#ifndef __CUDA_ARCH__
-          auto* async_state = static_cast<HostAsyncState*>(info.m_AsyncState);
-          if (async_state->m_AsyncWrite.valid())
-            async_state->m_AsyncWrite
-                .wait(); // Guarantee background write is finished
-          if (candidate != async_state->m_AsyncSlab) {
-#endif
-            if (!info.m_DiskManager)
-              info.m_DiskManager.reset(new detail::DiskManager<T, SLAB_SIZE>(
-                  info.m_use_file_offload));
-            candidate->disk_offset =
-                info.m_DiskManager->write_slab(candidate->elements());
-#ifndef __CUDA_ARCH__
-          }
-          async_state->m_AsyncSlab = nullptr;
-#endif
-          // FIXME: We probably should not deallocate the slab but use a pool
-          // where old ones would be recycled.
-          candidate->deallocate();
-          candidate->is_on_disk = true;
-          candidate->is_in_ram = false;
-          info.m_ActiveSlabs--;
-        }
-#ifndef __CUDA_ARCH__
-        else {
-          auto* async_state = static_cast<HostAsyncState*>(info.m_AsyncState);
-          if (!async_state->m_AsyncWrite.valid() ||
-              async_state->m_AsyncWrite.wait_for(std::chrono::seconds(0)) ==
-                  std::future_status::ready) {
-            if (!info.m_DiskManager)
-              info.m_DiskManager.reset(new detail::DiskManager<T, SLAB_SIZE>(
-                  info.m_use_file_offload));
-
-            async_state->m_AsyncSlab = candidate;
-            auto* dm = info.m_DiskManager.get();
-            T* data = candidate->elements();
-
-            async_state->m_AsyncWrite =
-                std::async(std::launch::async, [dm, data, candidate]() {
-                  candidate->disk_offset = dm->write_slab(data);
-                });
-          }
-        }
+      if (candidate)
+        submit_write(candidate, /*may_block=*/false);
 #endif
+      if (info.m_ActiveSlabs >= info.m_MaxRamSlabs) {
+        Slab* victim = m_head;
+        while (victim &&
+               (victim->is_on_disk || (GpuOffload && !victim->is_in_ram) ||
+                victim == m_tail))
+          victim = victim->next;
+        if (victim)
+          evict_slab(victim);
       }
     }
   }
@@ -543,16 +1257,28 @@ protected:
 
   CUDA_HOST_DEVICE void ensure_loaded_impl(Slab* slab, std::true_type) {
     DiskInfo& info = getDiskInfo();
+#ifndef __CUDA_ARCH__
+    if (slab && slab->read_submitted) {
+      // Prefetched in the background; wait for the data to arrive.
+      detail::tape_events::prefetch(/*hit=*/true);
+      detail::tape_events::stall_timer timer;
+      io().wait(&slab->io_pending);
+      slab->read_submitted = false;
+    }
+#endif
     if (GpuOffload) {
       // Already in host RAM — return immediately
       if (slab->is_in_ram)
         return;
 
       if (slab->is_on_disk) {
+        detail::tape_events::prefetch(/*hit=*/false);
+        detail::tape_events::stall_timer timer;
         slab->allocate_ram();
-        info.m_DiskManager->read_slab(slab->elements(), slab->disk_offset);
+        load_slab(slab);
         slab->is_on_disk = false;
         info.m_ActiveSlabs++;
+        detail::tape_events::ram_slabs(1);
         return;
       }
 
@@ -567,40 +1293,26 @@ protected:
 #endif
       info.m_ActiveVramSlabs--;
       info.m_ActiveSlabs++;
+      detail::tape_events::ram_slabs(1);
       return;
     }
 
-    // DiskOffload-only path (unchanged)
+    // DiskOffload-only path
     if (slab && slab->is_on_disk) {
-#ifndef __CUDA_ARCH__
-      auto* async_state = static_cast<HostAsyncState*>(info.m_AsyncState);
-      if (async_state->m_AsyncRead.valid()) {
-        async_state->m_AsyncRead
-            .wait(); // Pause and let the background thread finish
-        if (!slab->is_on_disk)
-          return;
-      }
-#endif
+      detail::tape_events::prefetch(/*hit=*/false);
+      detail::tape_events::stall_timer timer;
       if (DiskOffload && info.m_ActiveSlabs >= info.m_MaxRamSlabs) {
         Slab* v = m_head;
-        while (v) {
-          if (!v->is_on_disk && v != slab) {
-            if (!info.m_DiskManager)
-              info.m_DiskManager.reset(new detail::DiskManager<T, SLAB_SIZE>(
-                  info.m_use_file_offload));
-            v->disk_offset = info.m_DiskManager->write_slab(v->elements());
-            v->deallocate();
-            v->is_on_disk = true;
-            info.m_ActiveSlabs--;
-            break;
-          }
+        while (v && (v->is_on_disk || v == slab))
           v = v->next;
-        }
+        if (v)
+          evict_slab(v);
       }
       slab->allocate();
-      info.m_DiskManager->read_slab(slab->elements(), slab->disk_offset);
+      load_slab(slab);
       slab->is_on_disk = false;
       info.m_ActiveSlabs++;
+      detail::tape_events::ram_slabs(1);
     }
   }
 
@@ -633,6 +1345,17 @@ public:
   std::mutex& mutex() const { return m_TapeMutex; }
 #endif
 
+  /// Selects how slabs evicted from RAM are stored: in a temporary file rather
+  /// than an anonymous mapping and/or compressed with `xor_delta_codec`. Must
+  /// be called before the first slab is evicted and overrides `tape_config`.
+  void set_offload_mode(bool use_file_offload, bool use_compression) {
+    static_assert(DiskOffload || GpuOffload, "tape does not offload");
+    DiskInfo& info = getDiskInfo();
+    assert(!info.m_DiskManager && "slabs were already offloaded");
+    info.m_use_file_offload = use_file_offload;
+    info.m_use_compression = use_compression;
+  }
+
   CUDA_HOST_DEVICE tape_impl() = default;
 
   CUDA_HOST_DEVICE ~tape_impl() { clear(); }
@@ -646,36 +1369,14 @@ public:
   /// Add new value of type T constructed from args to the end of the tape.
   template <typename... ArgsT>
   CUDA_HOST_DEVICE void emplace_back(ArgsT&&... args) {
+    detail::tape_events::elements(1);
     if (m_size < SBO_SIZE) {
       ::new (const_cast<void*>(static_cast<const volatile void*>(
           sbo_elements() + m_size))) T(std::forward<ArgsT>(args)...);
     } else {
       const auto offset = (m_size - SBO_SIZE) % SLAB_SIZE;
-      if (!offset) {
-        if (m_size == m_capacity) {
-          check_and_evict();
-
-          Slab* new_slab = new Slab();
-          if (DiskOffload || GpuOffload) {
-            if (GpuOffload && !new_slab->is_in_ram)
-              getDiskInfo().m_ActiveVramSlabs++;
-            else
-              getDiskInfo().m_ActiveSlabs++;
-          }
-
-          if (!m_head)
-            m_head = new_slab;
-          else {
-            m_tail->next = new_slab;
-            new_slab->prev = m_tail;
-          }
-          m_capacity += SLAB_SIZE;
-        }
-        if (m_size == SBO_SIZE)
-          m_tail = m_head;
-        else
-          m_tail = m_tail->next;
-      }
+      if (!offset)
+        advance_tail();
 #if defined(__CUDACC__) && !defined(__CUDA_ARCH__)
       // Only H2D transfer if the slab is actively in VRAM
       if (GpuOffload && !m_tail->is_in_ram) {
@@ -683,14 +1384,18 @@ public:
         cudaMemcpy(m_tail->elements() + offset, &temp_val, sizeof(T),
                    cudaMemcpyHostToDevice);
       } else {
-        if (DiskOffload || GpuOffload)
+        if (DiskOffload || GpuOffload) {
           ensure_loaded(m_tail);
+          invalidate_written(m_tail);
+        }
         ::new (const_cast<void*>(static_cast<const volatile void*>(
             m_tail->elements() + offset))) T(std::forward<ArgsT>(args)...);
       }
 #else
-      if (DiskOffload || GpuOffload)
+      if (DiskOffload || GpuOffload) {
         ensure_loaded(m_tail);
+        invalidate_written(m_tail);
+      }
       ::new (const_cast<void*>(static_cast<const volatile void*>(
           m_tail->elements() + offset))) T(std::forward<ArgsT>(args)...);
 #endif
@@ -749,35 +1454,37 @@ public:
   }
 
 #ifndef __CUDA_ARCH__
+  /// Queues reads of the slabs preceding the tail while the reverse sweep
+  /// works on the ones in RAM. Never blocks on a full I/O queue.
   void trigger_reverse_prefetch() {
-    DiskInfo& out_info = getDiskInfo();
-    auto* async_state = static_cast<HostAsyncState*>(out_info.m_AsyncState);
-
-    async_state->m_AsyncRead = std::async(std::launch::async, [this]() {
-      DiskInfo& info = getDiskInfo();
-
-      std::size_t slabs_to_fetch = info.m_MaxRamSlabs - info.m_ActiveSlabs;
-      Slab* current = m_tail;
-
-      while (current && slabs_to_fetch > 0) {
-        if (current->is_on_disk) {
-          current->allocate();
-          info.m_DiskManager->read_slab(current->elements(),
-                                        current->disk_offset);
-          current->is_on_disk = false;
-
-          info.m_ActiveSlabs++;
-          slabs_to_fetch--;
-        }
-        current = current->prev;
+    DiskInfo& info = getDiskInfo();
+    std::size_t slabs_to_fetch = info.m_MaxRamSlabs - info.m_ActiveSlabs;
+
+    for (Slab* current = m_tail; current && slabs_to_fetch > 0;
+         current = current->prev) {
+      if (!current->is_on_disk)
+        continue;
+      current->allocate_ram();
+      if (!io().try_submit(read_job, info.m_DiskManager.get(), current,
+                           &current->io_pending)) {
+        current->deallocate();
+        current->is_on_disk = true;
+        current->is_in_ram = false;
+        break;
       }
-    });
+      current->is_on_disk = false;
+      current->read_submitted = true;
+      info.m_ActiveSlabs++;
+      detail::tape_events::ram_slabs(1);
+      slabs_to_fetch--;
+    }
   }
 #endif
 
   /// Remove the last value from the tape.
   CUDA_HOST_DEVICE void pop_back() {
     assert(m_size);
+    detail::tape_events::elements(-1);
     m_size--;
     if (m_size < SBO_SIZE) {
 #if defined(__CUDACC__) && !defined(__CUDA_ARCH__)
@@ -794,41 +1501,189 @@ public:
 #endif
         destroy_element(m_tail->elements() + offset);
 
-      if (offset == 0) {
-        Slab* old_tail = nullptr;
-        if (m_tail != m_head) {
-          old_tail = m_tail;
-          m_tail = m_tail->prev;
-        }
-#ifndef __CUDA_ARCH__
-        if (DiskOffload && old_tail) {
-          DiskInfo& info = getDiskInfo();
-
-          old_tail->deallocate();
-          info.m_ActiveSlabs--;
-
-          if (info.m_ActiveSlabs == info.m_RevPrefetch && info.m_DiskManager)
-            trigger_reverse_prefetch();
+      if (offset == 0)
+        retreat_tail();
+    }
+  }
 
-          m_tail->next = nullptr;
-          delete old_tail;
-          m_capacity -= SLAB_SIZE;
+  /// Add \p n values starting at \p src to the end of the tape. Spans that
+  /// fall into the same SBO buffer or slab are copied at once.
+  CUDA_HOST_DEVICE void push_n(const T* src, std::size_t n) {
+    detail::tape_events::elements(n);
+    while (n) {
+      std::size_t chunk = 0;
+      T* dest = nullptr;
+      if (m_size < SBO_SIZE) {
+        chunk = SBO_SIZE - m_size;
+        dest = sbo_elements() + m_size;
+      } else {
+        const auto offset = (m_size - SBO_SIZE) % SLAB_SIZE;
+        if (!offset)
+          advance_tail();
+        chunk = SLAB_SIZE - offset;
+#if defined(__CUDACC__) && !defined(__CUDA_ARCH__)
+        if (GpuOffload && !m_tail->is_in_ram) {
+          chunk = chunk < n ? chunk : n;
+          cudaMemcpy(m_tail->elements() + offset, src, chunk * sizeof(T),
+                     cudaMemcpyHostToDevice);
+          src += chunk;
+          n -= chunk;
+          m_size += chunk;
+          continue;
         }
 #endif
+        if (DiskOffload || GpuOffload) {
+          ensure_loaded(m_tail);
+          invalidate_written(m_tail);
+        }
+        dest = m_tail->elements() + offset;
       }
+      chunk = chunk < n ? chunk : n;
+      copy_construct_n(dest, src, chunk);
+      src += chunk;
+      n -= chunk;
+      m_size += chunk;
+    }
+  }
+
+  /// Remove the last \p n values from the tape and move them to \p dest,
+  /// preserving their order, i.e. `dest[n - 1]` receives the last value.
+  CUDA_HOST_DEVICE void pop_n(T* dest, std::size_t n) {
+    assert(n <= m_size);
+    detail::tape_events::elements(-static_cast<std::ptrdiff_t>(n));
+    while (n) {
+      if (m_size <= SBO_SIZE) {
+        T* src = sbo_elements() + (m_size - n);
+        move_n(dest, src, n);
+        destroy_n(src, n);
+        m_size -= n;
+        return;
+      }
+      // Number of values stored in the tail slab.
+      std::size_t in_tail = (m_size - SBO_SIZE - 1) % SLAB_SIZE + 1;
+      std::size_t chunk = in_tail < n ? in_tail : n;
+      if (DiskOffload || GpuOffload)
+        ensure_loaded(m_tail);
+      T* src = m_tail->elements() + (in_tail - chunk);
+      move_n(dest + (n - chunk), src, chunk);
+      destroy_n(src, chunk);
+      m_size -= chunk;
+      n -= chunk;
+      if (chunk == in_tail)
+        retreat_tail();
     }
   }
 
 private:
+  /// Makes `m_tail` point to the slab that receives the element at `m_size`,
+  /// allocating a new slab if all existing ones are full.
+  CUDA_HOST_DEVICE void advance_tail() {
+    if (m_size == m_capacity) {
+      check_and_evict();
+
+      Slab* new_slab = create_slab();
+      if (DiskOffload || GpuOffload) {
+        if (GpuOffload && !new_slab->is_in_ram)
+          getDiskInfo().m_ActiveVramSlabs++;
+        else
+          getDiskInfo().m_ActiveSlabs++;
+      }
+      if (new_slab->is_in_ram)
+        detail::tape_events::ram_slabs(1);
+
+      if (!m_head)
+        m_head = new_slab;
+      else {
+        m_tail->next = new_slab;
+        new_slab->prev = m_tail;
+      }
+      register_slab(new_slab);
+      m_capacity += SLAB_SIZE;
+    }
+    if (m_size == SBO_SIZE)
+      m_tail = m_head;
+    else
+      m_tail = m_tail->next;
+  }
+
+  /// Steps `m_tail` back once its slab became empty. Offloading tapes release
+  /// the slab right away and may start prefetching earlier slabs.
+  CUDA_HOST_DEVICE void retreat_tail() {
+    Slab* old_tail = nullptr;
+    if (m_tail != m_head) {
+      old_tail = m_tail;
+      m_tail = m_tail->prev;
+    }
+#ifndef __CUDA_ARCH__
+    if (DiskOffload && old_tail) {
+      DiskInfo& info = getDiskInfo();
+
+      finish_io(old_tail);
+      old_tail->deallocate();
+      info.m_ActiveSlabs--;
+      detail::tape_events::ram_slabs(-1);
+
+      if (info.m_ActiveSlabs == info.m_RevPrefetch && info.m_DiskManager)
+        trigger_reverse_prefetch();
+
+      m_tail->next = nullptr;
+      destroy_slab(old_tail);
+      m_capacity -= SLAB_SIZE;
+    }
+#endif
+  }
+
+  template <typename U = T>
+  CUDA_HOST_DEVICE static
+      typename std::enable_if<std::is_trivially_copyable<U>::value>::type
+      copy_construct_n(U* dest, const U* src, std::size_t n) {
+#ifdef __CUDA_ARCH__
+    for (std::size_t i = 0; i < n; ++i)
+      dest[i] = src[i];
+#else
+    if (n)
+      std::memcpy(const_cast<void*>(static_cast<const volatile void*>(dest)),
+                  const_cast<const void*>(
+                      static_cast<const volatile void*>(src)),
+                  n * sizeof(U));
+#endif
+  }
+
+  template <typename U = T>
+  CUDA_HOST_DEVICE static
+      typename std::enable_if<!std::is_trivially_copyable<U>::value>::type
+      copy_construct_n(U* dest, const U* src, std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i)
+      ::new (const_cast<void*>(static_cast<const volatile void*>(dest + i)))
+          U(src[i]);
+  }
+
+  template <typename U = T>
+  CUDA_HOST_DEVICE static
+      typename std::enable_if<std::is_trivially_copyable<U>::value>::type
+      move_n(U* dest, U* src, std::size_t n) {
+    copy_construct_n(dest, src, n);
+  }
+
+  template <typename U = T>
+  CUDA_HOST_DEVICE static
+      typename std::enable_if<!std::is_trivially_copyable<U>::value>::type
+      move_n(U* dest, U* src, std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i)
+      dest[i] = std::move(src[i]);
+  }
+
+  CUDA_HOST_DEVICE void destroy_n(T* first, std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i)
+      destroy_element(first + i);
+  }
+
   /// Returns pointer to element at specified index, handling SBO or slab lookup
   CUDA_HOST_DEVICE T* at(std::size_t index) {
     if (index < SBO_SIZE)
       return sbo_elements() + index;
 
-    Slab* slab = m_head;
-    std::size_t idx = (index - SBO_SIZE) / SLAB_SIZE;
-    while (idx--)
-      slab = slab->next;
+    Slab* slab = m_SlabDir[(index - SBO_SIZE) / SLAB_SIZE];
 
     if (DiskOffload || GpuOffload)
       ensure_loaded(slab);
@@ -839,10 +1694,7 @@ private:
   CUDA_HOST_DEVICE const T* at(std::size_t index) const {
     if (index < SBO_SIZE)
       return sbo_elements() + index;
-    Slab* slab = m_head;
-    std::size_t idx = (index - SBO_SIZE) / SLAB_SIZE;
-    while (idx--)
-      slab = slab->next;
+    Slab* slab = m_SlabDir[(index - SBO_SIZE) / SLAB_SIZE];
 
     // Const version cannot ensure loaded if DiskOffload is true
     return slab->elements() + ((index - SBO_SIZE) % SLAB_SIZE);
@@ -871,13 +1723,8 @@ private:
   void clear_impl(std::true_type) {
 #ifndef __CUDA_ARCH__
     DiskInfo& info = getDiskInfo();
-    if (info.m_AsyncState) {
-      auto* async_state = static_cast<HostAsyncState*>(info.m_AsyncState);
-      if (async_state->m_AsyncWrite.valid())
-        async_state->m_AsyncWrite.wait();
-      if (async_state->m_AsyncRead.valid())
-        async_state->m_AsyncRead.wait();
-    }
+    if (info.m_AsyncState)
+      io().wait_idle();
 #endif
     std::size_t count = m_size;
     for (std::size_t i = 0; i < SBO_SIZE && count > 0; ++i, --count)
@@ -889,16 +1736,22 @@ private:
       count -= current_slab_count;
       Slab* tmp = slab;
       slab = slab->next;
+#ifndef __CUDA_ARCH__
+      // wait_idle above completed the writes still in flight.
+      count_write(tmp);
+#endif
       if (DiskOffload)
         tmp->deallocate();
-      // NOLINTNEXTLINE(cppcoreguidelines-owning-memory)
-      delete tmp;
+      destroy_slab(tmp);
     }
+    detail::tape_events::ram_slabs(
+        -static_cast<std::ptrdiff_t>(getDiskInfo().m_ActiveSlabs));
     getDiskInfo().m_ActiveSlabs = 0;
     getDiskInfo().m_ActiveVramSlabs = 0;
   }
 
   void clear_impl(std::false_type) {
+    detail::tape_events::ram_slabs(-static_cast<std::ptrdiff_t>(num_slabs()));
     std::size_t count = m_size;
     for (std::size_t i = 0; i < SBO_SIZE && count > 0; ++i, --count)
       destroy_element(&sbo_elements()[i]);
@@ -910,13 +1763,17 @@ private:
         destroy_element(elems + i);
       Slab* tmp = slab;
       slab = slab->next;
-      // NOLINTNEXTLINE(cppcoreguidelines-owning-memory)
-      delete tmp;
+      destroy_slab(tmp);
     }
   }
 
   void clear() {
+    detail::tape_events::elements(-static_cast<std::ptrdiff_t>(m_size));
     clear_impl(std::integral_constant < bool, DiskOffload || GpuOffload > {});
+    // NOLINTNEXTLINE(cppcoreguidelines-owning-memory)
+    delete[] m_SlabDir;
+    m_SlabDir = nullptr;
+    m_SlabDirCapacity = 0;
     m_head = nullptr;
     m_tail = nullptr;
     m_size = 0;
@@ -936,6 +1793,669 @@ template <typename T, std::size_t SBO_SIZE, std::size_t SLAB_SIZE,
           bool is_multithread, bool DiskOffload, bool GpuOffload>
 using tape =
     tape_impl<T, SBO_SIZE, SLAB_SIZE, is_multithread, DiskOffload, GpuOffload>;
+
+/// A byte arena holding the records of all `arena_tape`s of one derived
+/// function invocation. Records are appended in push order and the reverse
+/// sweep consumes them in the opposite order, so both passes walk the memory
+/// sequentially. Memory comes in blocks that never move; a record never spans
+/// two blocks.
+///
+/// The arena is a stack: records must be released in the reverse order of
+/// their allocation, across all the `arena_tape`s sharing it. The derivative
+/// pops its tapes in that order; any other use must do the same.
+class tape_arena {
+  struct alignas(alignof(std::max_align_t)) Block {
+    Block* prev;
+    Block* next;
+    std::size_t size; ///< Capacity in bytes of the data that follows.
+    std::size_t used; ///< Bytes in use when a later block became current.
+    /// Start of the record that opened the block, which lies past data() when
+    /// that record is aligned more strictly than the block.
+    char* first;
+    CUDA_HOST_DEVICE char* data() {
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+      return reinterpret_cast<char*>(this + 1);
+    }
+  };
+
+  Block* m_Block = nullptr;
+  char* m_Top = nullptr;
+  char* m_End = nullptr;
+
+public:
+  static constexpr std::size_t kBlockSize = 64 * 1024;
+
+  CUDA_HOST_DEVICE tape_arena() {}
+  tape_arena(const tape_arena&) = delete;
+  tape_arena& operator=(const tape_arena&) = delete;
+
+  CUDA_HOST_DEVICE ~tape_arena() {
+    if (!m_Block)
+      return;
+    while (m_Block->prev)
+      m_Block = m_Block->prev;
+    while (m_Block) {
+      Block* next = m_Block->next;
+      ::operator delete(m_Block);
+      m_Block = next;
+    }
+  }
+
+  /// \returns \p size bytes aligned to \p align at the end of the arena.
+  CUDA_HOST_DEVICE void* allocate(std::size_t size, std::size_t align) {
+    char* p = align_up(m_Top, align);
+    if (!m_Block || p + size > m_End) {
+      next_block(size + align);
+      p = align_up(m_Top, align);
+      m_Block->first = p;
+    }
+    m_Top = p + size;
+    return p;
+  }
+
+  /// Gives back the \p size bytes at \p p, which must be the most recent
+  /// allocation not released yet.
+  CUDA_HOST_DEVICE void release(void* p, std::size_t size) {
+    char* record = static_cast<char*>(p);
+    assert(record + size == m_Top &&
+           "tape_arena records must be released in LIFO order");
+    // Without assertions, a misplaced record is left to the destructor.
+    if (record + size != m_Top)
+      return;
+    m_Top = record;
+    // Step back once the current block is empty and keep it for reuse.
+    if (m_Top == m_Block->first && m_Block->prev) {
+      m_Block = m_Block->prev;
+      m_Top = m_Block->data() + m_Block->used;
+      m_End = m_Block->data() + m_Block->size;
+    }
+  }
+
+  /// Drops all records at once and keeps the blocks for reuse. The values of
+  /// the `arena_tape`s using the arena must have been destroyed before.
+  CUDA_HOST_DEVICE void clear() {
+    if (!m_Block)
+      return;
+    while (m_Block->prev)
+      m_Block = m_Block->prev;
+    m_Top = m_Block->data();
+    m_End = m_Top + m_Block->size;
+  }
+
+private:
+  CUDA_HOST_DEVICE static char* align_up(char* p, std::size_t align) {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    auto addr = reinterpret_cast<std::uintptr_t>(p);
+    // NOLINTNEXTLINE(performance-no-int-to-ptr)
+    return reinterpret_cast<char*>((addr + align - 1) & ~(align - 1));
+  }
+
+  /// Makes a block with room for at least \p min_size bytes current.
+  CUDA_HOST_DEVICE void next_block(std::size_t min_size) {
+    if (m_Block)
+      m_Block->used = m_Top - m_Block->data();
+    Block* next = m_Block ? m_Block->next : nullptr;
+    if (!next || next->size < min_size) {
+      std::size_t size = min_size;
+      if (size < kBlockSize)
+        size = kBlockSize;
+      Block* fresh =
+          static_cast<Block*>(::operator new(sizeof(Block) + size));
+      fresh->prev = m_Block;
+      fresh->size = size;
+      fresh->used = 0;
+      // A cached block that is too small is put after the new one.
+      fresh->next = next;
+      if (next)
+        next->prev = fresh;
+      if (m_Block)
+        m_Block->next = fresh;
+      next = fresh;
+    }
+    m_Block = next;
+    m_Top = m_Block->data();
+    m_End = m_Top + m_Block->size;
+  }
+};
+
+/// A lightweight handle storing values of type \p T in a `tape_arena`. Every
+/// record holds the value at offset 0 and, at `kLinkOffset`, a link to the
+/// previous record of the same handle; both offsets are compile-time
+/// constants, so a handle costs two pointers instead of a full tape.
+template <typename T> class arena_tape {
+  static constexpr std::size_t kLinkAlign = alignof(char*);
+  static constexpr std::size_t kAlign =
+      alignof(T) > kLinkAlign ? alignof(T) : kLinkAlign;
+
+public:
+  static constexpr std::size_t kLinkOffset =
+      (sizeof(T) + kLinkAlign - 1) / kLinkAlign * kLinkAlign;
+  static constexpr std::size_t kRecordSize = kLinkOffset + sizeof(char*);
+
+  CUDA_HOST_DEVICE arena_tape(tape_arena& arena) : m_Arena(&arena) {}
+  arena_tape(const arena_tape&) = delete;
+  arena_tape& operator=(const arena_tape&) = delete;
+
+  /// Destroys the values left on the tape, e.g. by an exception thrown from
+  /// the forward sweep. Their memory goes away with the arena, so it is not
+  /// released here, where other tapes may still hold later records.
+  CUDA_HOST_DEVICE ~arena_tape() { clear(); }
+
+  template <typename... ArgsT>
+  CUDA_HOST_DEVICE void emplace_back(ArgsT&&... args) {
+    char* record = static_cast<char*>(m_Arena->allocate(kRecordSize, kAlign));
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    construct(reinterpret_cast<T*>(record), std::forward<ArgsT>(args)...);
+    link(record) = m_Top;
+    m_Top = record;
+  }
+
+  CUDA_HOST_DEVICE T& back() {
+    assert(m_Top && "back() on an empty tape");
+#if __cplusplus >= 201703L
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    return *std::launder(reinterpret_cast<T*>(m_Top));
+#else
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    return *reinterpret_cast<T*>(m_Top);
+#endif
+  }
+
+  CUDA_HOST_DEVICE void pop_back() {
+    assert(m_Top && "pop_back() on an empty tape");
+    destroy(&back());
+    char* record = m_Top;
+    m_Top = link(record);
+    m_Arena->release(record, kRecordSize);
+  }
+
+  CUDA_HOST_DEVICE bool empty() const { return !m_Top; }
+
+  /// Destroys all the values without releasing their records, which are given
+  /// back by `tape_arena::clear` or the destructor of the arena.
+  CUDA_HOST_DEVICE void clear() {
+    if (!std::is_trivially_destructible<T>::value)
+      for (char* record = m_Top; record; record = link(record))
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+        destroy(reinterpret_cast<T*>(record));
+    m_Top = nullptr;
+  }
+
+private:
+  CUDA_HOST_DEVICE static char*& link(char* record) {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    return *reinterpret_cast<char**>(record + kLinkOffset);
+  }
+
+  template <typename U, typename... ArgsT>
+  CUDA_HOST_DEVICE static void construct(U* value, ArgsT&&... args) {
+    ::new (value) U(std::forward<ArgsT>(args)...);
+  }
+  template <typename U, std::size_t N>
+  CUDA_HOST_DEVICE static void construct(U (*value)[N]) {
+    for (std::size_t i = 0; i < N; ++i)
+      construct(&(*value)[i]);
+  }
+
+  template <typename U> CUDA_HOST_DEVICE static void destroy(U* value) {
+    value->~U();
+  }
+  template <typename U, std::size_t N>
+  CUDA_HOST_DEVICE static void destroy(U (*value)[N]) {
+    for (std::size_t i = 0; i < N; ++i)
+      destroy(&(*value)[i]);
+  }
+
+  tape_arena* m_Arena;
+  char* m_Top = nullptr;
+};
+
+/// Storage for the values saved by a loop whose trip count is known before the
+/// loop starts. The value saved by iteration `i` lives at index `i`, so both
+/// sweeps access it directly and the storage is allocated once, before the
+/// first iteration, instead of growing slab by slab.
+template <typename T> class fixed_tape {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "fixed_tape holds trivially copyable values only");
+
+public:
+  CUDA_HOST_DEVICE fixed_tape() {}
+  fixed_tape(const fixed_tape&) = delete;
+  fixed_tape& operator=(const fixed_tape&) = delete;
+  CUDA_HOST_DEVICE ~fixed_tape() { delete[] m_Data; }
+
+  /// Makes room for the values of \p n iterations. Larger existing storage is
+  /// kept, so a tape reused across calls only reallocates for a longer loop.
+  CUDA_HOST_DEVICE void reserve(std::size_t n) {
+    if (n <= m_Capacity)
+      return;
+    delete[] m_Data;
+    m_Data = new T[n];
+    m_Capacity = n;
+  }
+
+  /// Grows the storage if the loop runs more iterations than reserved, which
+  /// clad rules out for the loops it reserves the trip count of.
+  CUDA_HOST_DEVICE T& operator[](std::size_t i) {
+    if (i >= m_Capacity)
+      grow(i + 1);
+    return m_Data[i];
+  }
+
+  CUDA_HOST_DEVICE std::size_t capacity() const { return m_Capacity; }
+
+private:
+  CUDA_HOST_DEVICE void grow(std::size_t n) {
+    std::size_t capacity = 2 * m_Capacity > n ? 2 * m_Capacity : n;
+    T* data = new T[capacity];
+    for (std::size_t i = 0; i < m_Capacity; ++i)
+      data[i] = m_Data[i];
+    delete[] m_Data;
+    m_Data = data;
+    m_Capacity = capacity;
+  }
+
+  T* m_Data = nullptr;
+  std::size_t m_Capacity = 0;
+};
+
+/// \returns the number of iterations of `for (i = first; i < last; i += step)`
+/// or, with \p inclusive, of `for (i = first; i <= last; i += step)`. A
+/// negative \p step counts down, comparing with `>` and `>=` respectively.
+template <typename T, typename U>
+CUDA_HOST_DEVICE std::size_t trip_count(T first, U last, long step,
+                                        bool inclusive) {
+  using C = typename std::common_type<T, U>::type;
+  C a = first;
+  C b = last;
+  if (step < 0) {
+    C tmp = a;
+    a = b;
+    b = tmp;
+    step = -step;
+  }
+  if (a > b || (a == b && !inclusive))
+    return 0;
+  std::size_t distance = static_cast<std::size_t>(b - a) + (inclusive ? 1 : 0);
+  return (distance + step - 1) / step;
+}
+
+/// A stack of small unsigned values, such as branch conditions and the case
+/// taken by a `break` or `continue`, packed into 64-bit words. Each value takes
+/// `bits` bits, so a word holds 64 conditions instead of one. The first
+/// `kInlineWords` words are stored in the tape itself, so short loops do not
+/// allocate; later words go to chunks taken from the slab pool, which are kept
+/// until the tape is destroyed.
+class bit_tape {
+  struct Chunk;
+
+public:
+  static constexpr std::size_t kInlineWords = 4;
+
+  CUDA_HOST_DEVICE bit_tape(unsigned bits = 1) : m_Bits(bits ? bits : 1) {
+    assert(m_Bits <= 32 && "bit_tape holds small values only");
+  }
+  bit_tape(const bit_tape&) = delete;
+  bit_tape& operator=(const bit_tape&) = delete;
+  CUDA_HOST_DEVICE ~bit_tape() {
+    while (m_Head) {
+      Chunk* next = m_Head->next;
+      chunk_allocator::deallocate(m_Head);
+      m_Head = next;
+    }
+  }
+
+  CUDA_HOST_DEVICE void push(std::uint64_t value) {
+    assert(value <= mask() && "value does not fit the bit width");
+    if (m_Offset + m_Bits > 64) {
+      if (++m_Word == capacity())
+        next_chunk();
+      m_Offset = 0;
+    }
+    if (!m_Offset)
+      m_Words[m_Word] = 0;
+    m_Words[m_Word] |= (value & mask()) << m_Offset;
+    m_Offset += m_Bits;
+  }
+
+  CUDA_HOST_DEVICE std::uint64_t back() const {
+    assert(!empty() && "bit_tape is empty");
+    return (m_Words[m_Word] >> (m_Offset - m_Bits)) & mask();
+  }
+
+  CUDA_HOST_DEVICE void pop_back() {
+    assert(!empty() && "bit_tape is empty");
+    m_Offset -= m_Bits;
+    m_Words[m_Word] &= ~(mask() << m_Offset);
+    if (m_Offset)
+      return;
+    if (m_Word) {
+      --m_Word;
+    } else if (m_Chunk) {
+      m_Chunk = m_Chunk->prev;
+      m_Words = m_Chunk ? m_Chunk->words : m_Inline;
+      m_Word = capacity() - 1;
+    } else {
+      return;
+    }
+    m_Offset = 64 / m_Bits * m_Bits;
+  }
+
+  CUDA_HOST_DEVICE bool empty() const {
+    return !m_Chunk && !m_Word && !m_Offset;
+  }
+  CUDA_HOST_DEVICE unsigned bits() const { return m_Bits; }
+  /// Drops all values and keeps the storage.
+  CUDA_HOST_DEVICE void clear() {
+    m_Chunk = nullptr;
+    m_Words = m_Inline;
+    m_Word = 0;
+    m_Offset = 0;
+  }
+
+private:
+  /// A chunk takes a 1 KiB block of the slab pool.
+  static constexpr std::size_t kChunkWords = 126;
+  struct Chunk {
+    Chunk* prev;
+    Chunk* next;
+    // NOLINTNEXTLINE(cppcoreguidelines-avoid-c-arrays)
+    std::uint64_t words[kChunkWords];
+  };
+  using chunk_allocator = detail::slab_allocator<sizeof(Chunk), alignof(Chunk)>;
+
+  CUDA_HOST_DEVICE std::uint64_t mask() const {
+    return (std::uint64_t(1) << m_Bits) - 1;
+  }
+
+  CUDA_HOST_DEVICE std::size_t capacity() const {
+    return m_Chunk ? kChunkWords : kInlineWords;
+  }
+
+  /// Moves to the chunk after the current storage, allocating it if needed.
+  CUDA_HOST_DEVICE void next_chunk() {
+    Chunk* next = m_Chunk ? m_Chunk->next : m_Head;
+    if (!next) {
+      next = static_cast<Chunk*>(chunk_allocator::allocate());
+      next->prev = m_Chunk;
+      next->next = nullptr;
+      if (m_Chunk)
+        m_Chunk->next = next;
+      else
+        m_Head = next;
+    }
+    m_Chunk = next;
+    m_Words = next->words;
+    m_Word = 0;
+  }
+
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-c-arrays)
+  std::uint64_t m_Inline[kInlineWords];
+  /// The words of the current storage: `m_Inline` or those of `m_Chunk`.
+  std::uint64_t* m_Words = m_Inline;
+  Chunk* m_Chunk = nullptr;
+  Chunk* m_Head = nullptr;
+  /// The word holding the last value and the number of its bits in use.
+  std::size_t m_Word = 0;
+  unsigned m_Offset = 0;
+  unsigned m_Bits;
+};
+
+/// Addresses a value of type T at a fixed byte offset in a record_tape record.
+template <typename T> struct record_field {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "record_tape holds trivially copyable values only");
+  CUDA_HOST_DEVICE constexpr explicit record_field(std::size_t offset)
+      : offset(offset) {}
+  std::size_t offset;
+};
+
+/// A stack of records, one per loop iteration, holding all the values the
+/// iteration saves. The derivative lays out the record: every saved value has
+/// its own field, and an iteration pushes and pops its record only once.
+///
+///   clad::record_tape _t1 = {16};
+///   for (...) {
+///     _t1.emplace_back();
+///     clad::push(_t1, clad::record_field<double>(0), x);
+///     clad::push(_t1, clad::record_field<int>(8), i);
+///     ...
+class record_tape {
+public:
+  CUDA_HOST_DEVICE record_tape(std::size_t size = 0) : m_Size(size) {}
+  record_tape(const record_tape&) = delete;
+  record_tape& operator=(const record_tape&) = delete;
+  CUDA_HOST_DEVICE ~record_tape() { delete[] m_Data; }
+
+  /// Starts the record of a new iteration. Its fields are uninitialized.
+  CUDA_HOST_DEVICE void emplace_back() {
+    if (m_End + m_Size > m_Capacity * sizeof(std::max_align_t))
+      grow();
+    m_End += m_Size;
+  }
+
+  CUDA_HOST_DEVICE void pop_back() {
+    assert(m_End >= m_Size && "record_tape is empty");
+    m_End -= m_Size;
+  }
+
+  /// \returns the field of the last record at byte \p offset.
+  template <typename T> CUDA_HOST_DEVICE T* field(std::size_t offset) {
+    assert(!empty() && "record_tape is empty");
+    assert(offset + sizeof(T) <= m_Size && "field is outside of the record");
+    return reinterpret_cast<T*>(reinterpret_cast<char*>(m_Data) + m_End -
+                                m_Size + offset);
+  }
+
+  CUDA_HOST_DEVICE bool empty() const { return !m_End; }
+  /// Drops all records and keeps the storage.
+  CUDA_HOST_DEVICE void clear() { m_End = 0; }
+  /// The size of a record in bytes.
+  CUDA_HOST_DEVICE std::size_t record_size() const { return m_Size; }
+
+private:
+  CUDA_HOST_DEVICE void grow() {
+    // Records are laid out back to back; the derivative pads their size to a
+    // multiple of the alignment of their fields.
+    std::size_t capacity = 2 * m_Capacity;
+    while (capacity * sizeof(std::max_align_t) < m_End + 4 * m_Size)
+      capacity = capacity ? 2 * capacity : 1;
+    auto* data = new std::max_align_t[capacity];
+    for (std::size_t i = 0; i < m_Capacity; ++i)
+      data[i] = m_Data[i];
+    delete[] m_Data;
+    m_Data = data;
+    m_Capacity = capacity;
+  }
+
+  std::max_align_t* m_Data = nullptr;
+  /// The allocated storage in units of std::max_align_t.
+  std::size_t m_Capacity = 0;
+  /// The end of the last record in bytes.
+  std::size_t m_End = 0;
+  std::size_t m_Size;
+};
+
+namespace detail {
+/// Drops the values an aborted derivative left on a reused tape, keeping its
+/// storage for the next call. Tapes clad does not know are left alone.
+template <typename TapeT> void discard_tape(TapeT&) {}
+template <typename T, std::size_t SBO_SIZE, std::size_t SLAB_SIZE,
+          bool is_multithread, bool DiskOffload, bool GpuOffload>
+void discard_tape(tape_impl<T, SBO_SIZE, SLAB_SIZE, is_multithread,
+                            DiskOffload, GpuOffload>& t) {
+  // Popping keeps the slabs, which clear() would free.
+  while (t.size())
+    t.pop_back();
+}
+template <typename T> void discard_tape(arena_tape<T>& t) { t.clear(); }
+inline void discard_tape(tape_arena& a) { a.clear(); }
+inline void discard_tape(bit_tape& t) { t.clear(); }
+inline void discard_tape(record_tape& t) { t.clear(); }
+} // namespace detail
+
+/// Marks a derivative with `clad::opts::reuse_tapes` as running on the calling
+/// thread, so that a reentrant call takes the plain derivative instead of
+/// sharing the thread-local tapes. The mark is dropped when the derivative
+/// returns or throws. A derivative that throws also leaves values on its
+/// tapes, which are discarded then, in the reverse order of their
+/// declaration, so that the arena tapes are cleared before their arena.
+///
+///   static thread_local bool _active0 = false;
+///   ...
+///   static thread_local clad::tape<double> _t1 = {};
+///   clad::tape_reuse_guard<clad::tape<double>> _guard0 = {_active0, _t1};
+template <typename... TapeTs> class tape_reuse_guard {
+  struct Entry {
+    void* m_Tape;
+    void (*m_Discard)(void*);
+  };
+
+  template <typename TapeT> static void discard(void* tape) {
+    detail::discard_tape(*static_cast<TapeT*>(tape));
+  }
+
+  bool& m_Active;
+  // One extra entry keeps the array valid without tapes.
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-c-arrays)
+  Entry m_Tapes[sizeof...(TapeTs) + 1];
+
+public:
+  tape_reuse_guard(bool& active, TapeTs&... tapes)
+      : m_Active(active), m_Tapes{{&tapes, &discard<TapeTs>}...,
+                                  {nullptr, nullptr}} {
+    m_Active = true;
+  }
+  tape_reuse_guard(const tape_reuse_guard&) = delete;
+  tape_reuse_guard& operator=(const tape_reuse_guard&) = delete;
+
+  ~tape_reuse_guard() {
+    // After a normal return the tapes are empty and discarding them is cheap.
+    for (std::size_t i = sizeof...(TapeTs); i-- > 0;)
+      m_Tapes[i].m_Discard(m_Tapes[i].m_Tape);
+    m_Active = false;
+  }
+};
+
+#ifndef __CUDACC__
+/// A tape for multithreaded forward sweeps in which every thread appends to
+/// its own shard. The shard of a thread is found through a small thread-local
+/// cache and registered with a lock-free list on first use, so pushes and pops
+/// never take a lock. Values are kept in LIFO order per thread, which is what
+/// the reverse sweep executed by the same thread expects.
+///
+/// Shards are owned by a per-thread token that is never reused, unlike
+/// `std::thread::id`, so a thread started after another one was joined gets a
+/// fresh shard instead of inheriting the values left in the old one.
+template <typename T, std::size_t SBO_SIZE = 64, std::size_t SLAB_SIZE = 1024>
+class sharded_tape {
+public:
+  using shard_type = tape_impl<T, SBO_SIZE, SLAB_SIZE, /*is_multithread=*/false,
+                               /*DiskOffload=*/false, /*GpuOffload=*/false>;
+  using value_type = T;
+  using reference = T&;
+  using size_type = std::size_t;
+
+private:
+  struct Shard {
+    std::uint64_t m_Owner;
+    shard_type m_Data;
+    Shard* m_Next = nullptr;
+  };
+
+  struct CacheEntry {
+    std::uint64_t m_Id = 0;
+    Shard* m_Shard = nullptr;
+  };
+  static constexpr std::size_t kCacheSize = 8;
+
+  /// Head of the list of shards. Shards are only ever prepended, each by the
+  /// thread that owns it, so readers can walk the list without locking.
+  std::atomic<Shard*> m_Shards{nullptr};
+  /// Unique, never reused identifier of this tape. Keys the thread-local
+  /// cache so that a destroyed tape can never alias a new one.
+  std::uint64_t m_Id = next_id();
+
+  static std::uint64_t next_id() {
+    static std::atomic<std::uint64_t> counter{0};
+    return ++counter;
+  }
+
+  /// \returns the token of the calling thread, unique for the whole process.
+  static std::uint64_t thread_token() {
+    static thread_local std::uint64_t token = next_id();
+    return token;
+  }
+
+  Shard* find_or_create_shard() {
+    std::uint64_t self = thread_token();
+    for (Shard* S = m_Shards.load(std::memory_order_acquire); S; S = S->m_Next)
+      if (S->m_Owner == self)
+        return S;
+    // NOLINTNEXTLINE(cppcoreguidelines-owning-memory)
+    auto* S = new Shard();
+    S->m_Owner = self;
+    S->m_Next = m_Shards.load(std::memory_order_relaxed);
+    while (!m_Shards.compare_exchange_weak(S->m_Next, S,
+                                           std::memory_order_release,
+                                           std::memory_order_relaxed))
+      ;
+    return S;
+  }
+
+public:
+  sharded_tape() = default;
+  ~sharded_tape() {
+    Shard* S = m_Shards.load(std::memory_order_acquire);
+    while (S) {
+      Shard* next = S->m_Next;
+      // NOLINTNEXTLINE(cppcoreguidelines-owning-memory)
+      delete S;
+      S = next;
+    }
+  }
+
+  sharded_tape(const sharded_tape&) = delete;
+  sharded_tape& operator=(const sharded_tape&) = delete;
+  sharded_tape(sharded_tape&&) = delete;
+  sharded_tape& operator=(sharded_tape&&) = delete;
+
+  /// \returns the shard owned by the calling thread, creating it on first use.
+  shard_type& local() {
+    // NOLINTNEXTLINE(cppcoreguidelines-avoid-c-arrays)
+    static thread_local CacheEntry cache[kCacheSize];
+    CacheEntry& entry = cache[m_Id % kCacheSize];
+    if (entry.m_Id != m_Id) {
+      entry.m_Shard = find_or_create_shard();
+      entry.m_Id = m_Id;
+    }
+    return entry.m_Shard->m_Data;
+  }
+
+  template <typename... ArgsT> void emplace_back(ArgsT&&... args) {
+    local().emplace_back(std::forward<ArgsT>(args)...);
+  }
+  reference back() { return local().back(); }
+  void pop_back() { local().pop_back(); }
+
+  /// \returns the number of shards, i.e. threads that have used this tape.
+  std::size_t num_shards() const {
+    std::size_t n = 0;
+    for (Shard* S = m_Shards.load(std::memory_order_acquire); S; S = S->m_Next)
+      ++n;
+    return n;
+  }
+
+  /// \returns the total number of elements over all shards. Must not be
+  /// called while other threads are pushing or popping.
+  std::size_t size() const {
+    std::size_t n = 0;
+    for (Shard* S = m_Shards.load(std::memory_order_acquire); S; S = S->m_Next)
+      n += S->m_Data.size();
+    return n;
+  }
+};
+#endif
 } // namespace clad
 
 #endif // CLAD_TAPE_H
\ No newline at end of file
@@ -0,0 +1,176 @@
+#ifndef CLAD_DIFFERENTIATOR_TAPETELEMETRY_H
+#define CLAD_DIFFERENTIATOR_TAPETELEMETRY_H
+
+#include "clad/Differentiator/CladConfig.h"
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(CLAD_TAPE_TELEMETRY) && !defined(__CUDA_ARCH__)
+#include <chrono>
+#include <mutex>
+#include <unordered_map>
+#endif
+
+namespace clad {
+
+/// Memory and offload counters of the tapes used by a derived function,
+/// accumulated over all of its invocations. Collected only when the program is
+/// compiled with `CLAD_TAPE_TELEMETRY` defined; otherwise the instrumentation
+/// compiles to nothing and all counters stay zero.
+struct tape_stats {
+  std::size_t invocations = 0;
+  /// Largest number of elements held by all tapes at once.
+  std::size_t peak_elements = 0;
+  /// Largest number of slabs resident in host RAM at once.
+  std::size_t peak_ram_slabs = 0;
+  /// Slabs moved from RAM to disk.
+  std::size_t evictions = 0;
+  /// Slabs already queued by the reverse prefetch when they were needed.
+  std::size_t prefetch_hits = 0;
+  /// Slabs that had to be loaded from disk on demand.
+  std::size_t prefetch_misses = 0;
+  /// Time spent waiting for slab I/O in ensure_loaded.
+  std::uint64_t blocked_ns = 0;
+  /// Bytes of slabs written back to disk, before compression.
+  std::size_t bytes_written = 0;
+};
+
+#if defined(CLAD_TAPE_TELEMETRY) && !defined(__CUDA_ARCH__)
+namespace detail {
+/// Collects the tape events of the calling thread while it is alive and adds
+/// them to the totals of \p key when it goes out of scope. Scopes nest; the
+/// innermost one receives the events.
+class tape_telemetry {
+public:
+  explicit tape_telemetry(const void* key) : m_Key(key), m_Outer(current()) {
+    current() = this;
+  }
+  tape_telemetry(const tape_telemetry&) = delete;
+  tape_telemetry& operator=(const tape_telemetry&) = delete;
+
+  ~tape_telemetry() {
+    current() = m_Outer;
+    registry& r = get_registry();
+    std::lock_guard<std::mutex> lock(r.m_Mutex);
+    tape_stats& total = r.m_Stats[m_Key];
+    total.invocations++;
+    if (m_Stats.peak_elements > total.peak_elements)
+      total.peak_elements = m_Stats.peak_elements;
+    if (m_Stats.peak_ram_slabs > total.peak_ram_slabs)
+      total.peak_ram_slabs = m_Stats.peak_ram_slabs;
+    total.evictions += m_Stats.evictions;
+    total.prefetch_hits += m_Stats.prefetch_hits;
+    total.prefetch_misses += m_Stats.prefetch_misses;
+    total.blocked_ns += m_Stats.blocked_ns;
+    total.bytes_written += m_Stats.bytes_written;
+  }
+
+  static tape_telemetry*& current() {
+    static thread_local tape_telemetry* scope = nullptr;
+    return scope;
+  }
+
+  static tape_stats get(const void* key) {
+    registry& r = get_registry();
+    std::lock_guard<std::mutex> lock(r.m_Mutex);
+    auto it = r.m_Stats.find(key);
+    return it == r.m_Stats.end() ? tape_stats() : it->second;
+  }
+
+  static void reset(const void* key) {
+    registry& r = get_registry();
+    std::lock_guard<std::mutex> lock(r.m_Mutex);
+    r.m_Stats.erase(key);
+  }
+
+  void elements(std::ptrdiff_t delta) {
+    m_Elements += delta;
+    if (m_Elements > 0 &&
+        static_cast<std::size_t>(m_Elements) > m_Stats.peak_elements)
+      m_Stats.peak_elements = m_Elements;
+  }
+  void ram_slabs(std::ptrdiff_t delta) {
+    m_RamSlabs += delta;
+    if (m_RamSlabs > 0 &&
+        static_cast<std::size_t>(m_RamSlabs) > m_Stats.peak_ram_slabs)
+      m_Stats.peak_ram_slabs = m_RamSlabs;
+  }
+  tape_stats& stats() { return m_Stats; }
+
+private:
+  struct registry {
+    std::mutex m_Mutex;
+    std::unordered_map<const void*, tape_stats> m_Stats;
+  };
+  static registry& get_registry() {
+    static registry r;
+    return r;
+  }
+
+  const void* m_Key;
+  tape_telemetry* m_Outer;
+  /// Elements and slabs can be released by tapes created before the scope,
+  /// so the live counts may become negative.
+  std::ptrdiff_t m_Elements = 0;
+  std::ptrdiff_t m_RamSlabs = 0;
+  tape_stats m_Stats;
+};
+} // namespace detail
+#endif
+
+namespace detail {
+/// The hooks the tapes call on every event of interest. Without
+/// `CLAD_TAPE_TELEMETRY` they are empty and vanish after inlining.
+struct tape_events {
+#if defined(CLAD_TAPE_TELEMETRY) && !defined(__CUDA_ARCH__)
+  static void elements(std::ptrdiff_t delta) {
+    if (tape_telemetry* t = tape_telemetry::current())
+      t->elements(delta);
+  }
+  static void ram_slabs(std::ptrdiff_t delta) {
+    if (tape_telemetry* t = tape_telemetry::current())
+      t->ram_slabs(delta);
+  }
+  static void eviction() {
+    if (tape_telemetry* t = tape_telemetry::current())
+      t->stats().evictions++;
+  }
+  static void prefetch(bool hit) {
+    if (tape_telemetry* t = tape_telemetry::current())
+      ++(hit ? t->stats().prefetch_hits : t->stats().prefetch_misses);
+  }
+  static void written(std::size_t bytes) {
+    if (tape_telemetry* t = tape_telemetry::current())
+      t->stats().bytes_written += bytes;
+  }
+
+  /// Measures the time until it goes out of scope as time blocked on I/O.
+  class stall_timer {
+    std::chrono::steady_clock::time_point m_Start =
+        std::chrono::steady_clock::now();
+
+  public:
+    ~stall_timer() {
+      if (tape_telemetry* t = tape_telemetry::current())
+        t->stats().blocked_ns += std::chrono::duration_cast<
+                                     std::chrono::nanoseconds>(
+                                     std::chrono::steady_clock::now() - m_Start)
+                                     .count();
+    }
+  };
+#else
+  CUDA_HOST_DEVICE static void elements(std::ptrdiff_t) {}
+  CUDA_HOST_DEVICE static void ram_slabs(std::ptrdiff_t) {}
+  CUDA_HOST_DEVICE static void eviction() {}
+  CUDA_HOST_DEVICE static void prefetch(bool) {}
+  CUDA_HOST_DEVICE static void written(std::size_t) {}
+  struct stall_timer {
+    CUDA_HOST_DEVICE stall_timer() {}
+  };
+#endif
+};
+} // namespace detail
+} // namespace clad
+
+#endif // CLAD_DIFFERENTIATOR_TAPETELEMETRY_H
@@ -24,6 +24,7 @@
 #include "clang/Sema/Sema.h"
 #include "clang/Sema/TemplateDeduction.h"
 
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/Support/Casting.h"
 
@@ -696,6 +697,13 @@ namespace clad {
       return false;
     }
 
+    bool hasCheckpointAttribute(const clang::Decl* D) {
+      for (auto* Attr : D->specific_attrs<clang::AnnotateAttr>())
+        if (Attr->getAnnotation() == "checkpoint")
+          return true;
+      return false;
+    }
+
     bool hasNonDifferentiableAttribute(const clang::Expr* E) {
       // Check MemberExpr
       if (const clang::MemberExpr* ME = clang::dyn_cast<clang::MemberExpr>(E)) {
@@ -972,6 +980,45 @@ namespace clad {
       return T;
     }
 
+    /// Returns the type of the non-template class clad::\p Name.
+    static clang::QualType GetCladClassType(clang::Sema& S,
+                                            llvm::StringRef Name) {
+      NamespaceDecl* CladNS = GetCladNamespace(S);
+      CXXScopeSpec CSS;
+      CSS.Extend(S.getASTContext(), CladNS, noLoc, noLoc);
+      DeclarationName ClassName = &S.getASTContext().Idents.get(Name);
+      LookupResult R(S, ClassName, noLoc, Sema::LookupUsingDeclName,
+                     CLAD_COMPAT_Sema_ForVisibleRedeclaration);
+      S.LookupQualifiedName(R, CladNS, CSS);
+      assert(!R.empty() && "cannot find the clad class");
+
+      auto* RD = cast<RecordDecl>(R.getFoundDecl());
+      ASTContext& C = S.getASTContext();
+      QualType T = clad_compat::getRecordType(C, RD);
+      return clad_compat::getElaboratedType(
+          C, clad_compat::ElaboratedTypeKeyword_None, CSS.getScopeRep(), T);
+    }
+
+    clang::QualType GetTapeArenaType(clang::Sema& S) {
+      return GetCladClassType(S, "tape_arena");
+    }
+
+    clang::QualType GetRevolveType(clang::Sema& S) {
+      return GetCladClassType(S, "revolve");
+    }
+
+    clang::QualType GetBitTapeType(clang::Sema& S) {
+      return GetCladClassType(S, "bit_tape");
+    }
+
+    clang::QualType GetRecordTapeType(clang::Sema& S) {
+      return GetCladClassType(S, "record_tape");
+    }
+
+    clang::QualType GetOMPScheduleType(clang::Sema& S) {
+      return GetCladClassType(S, "omp_schedule");
+    }
+
     TemplateDecl* LookupTemplateDeclInCladNamespace(Sema& S,
                                                     llvm::StringRef ClassName) {
       NamespaceDecl* CladNS = GetCladNamespace(S);
@@ -1303,6 +1350,12 @@ namespace clad {
         QualType argTy = C.getPointerType(oRetTy);
         FnTypes.push_back(argTy);
         return C.getFunctionType(dRetTy, FnTypes, EPI);
+      } else if (mode == DiffMode::hvp) {
+        // The direction and the product.
+        QualType argTy = C.getPointerType(oRetTy);
+        FnTypes.push_back(argTy);
+        FnTypes.push_back(argTy);
+        return C.getFunctionType(dRetTy, FnTypes, EPI);
       } else if (!returnVoid && !oRetTy->isVoidType()) {
         // Handle pushforwards
         TemplateDecl* valueAndPushforward =
@@ -1709,6 +1762,55 @@ namespace clad {
       return checker.isInjectiveIdx(E);
     }
 
+    /// \returns true if \p E has the same value in every iteration of a loop
+    /// over \p LoopVar whose body modifies \p Modified.
+    static bool
+    isLoopInvariant(const Expr* E, const VarDecl* LoopVar,
+                    const llvm::SmallPtrSetImpl<const VarDecl*>& Modified,
+                    const ASTContext& C) {
+      E = E->IgnoreParenImpCasts();
+      if (E->isIntegerConstantExpr(C))
+        return true;
+      if (const auto* DRE = dyn_cast<DeclRefExpr>(E))
+        if (const auto* VD = dyn_cast<VarDecl>(DRE->getDecl()))
+          return VD != LoopVar && !Modified.count(VD);
+      return false;
+    }
+
+    bool isInjective(const Expr* E, const VarDecl* LoopVar,
+                     const llvm::SmallPtrSetImpl<const VarDecl*>& Modified,
+                     const ASTContext& C) {
+      E = E->IgnoreParenImpCasts();
+      if (const auto* DRE = dyn_cast<DeclRefExpr>(E))
+        return DRE->getDecl() == LoopVar;
+      const auto* BO = dyn_cast<BinaryOperator>(E);
+      if (!BO)
+        return false;
+      const Expr* L = BO->getLHS();
+      const Expr* R = BO->getRHS();
+      auto isInjectiveE = [&](const Expr* E) {
+        return isInjective(E, LoopVar, Modified, C);
+      };
+      auto isInvariant = [&](const Expr* E) {
+        return isLoopInvariant(E, LoopVar, Modified, C);
+      };
+      auto isNonZero = [&](const Expr* E) {
+        Expr::EvalResult Res;
+        return E->EvaluateAsInt(Res, C) && Res.Val.getInt().getBoolValue();
+      };
+      switch (BO->getOpcode()) {
+      case BO_Add:
+      case BO_Sub:
+        return (isInjectiveE(L) && isInvariant(R)) ||
+               (isInvariant(L) && isInjectiveE(R));
+      case BO_Mul:
+        return (isInjectiveE(L) && isNonZero(R)) ||
+               (isNonZero(L) && isInjectiveE(R));
+      default:
+        return false;
+      }
+    }
+
     bool hasUnusedReturnValue(ASTContext& C, const clang::CallExpr* CE) {
       const Expr* E = CE;
       do {
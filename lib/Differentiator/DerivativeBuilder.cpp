@@ -7,6 +7,7 @@
 #include "clad/Differentiator/DerivativeBuilder.h"
 
 #include "ASTIntegrity.h"
+#include "HvpModeVisitor.h"
 #include "JacobianModeVisitor.h"
 
 #include "clad/Differentiator/BaseForwardModeVisitor.h"
@@ -625,6 +626,9 @@ static void registerDerivative(Decl* D, Sema& S, const DiffRequest& R) {
                request.Mode == DiffMode::hessian_diagonal) {
       HessianModeVisitor H(*this, request);
       result = H.Derive();
+    } else if (request.Mode == DiffMode::hvp) {
+      HvpModeVisitor V(*this, request);
+      result = V.Derive();
     } else if (request.Mode == DiffMode::jacobian) {
       JacobianModeVisitor J(*this, request);
       result = J.Derive();
@@ -12,12 +12,26 @@ DerivedFnInfo::DerivedFnInfo(const DiffRequest& request,
       m_DiffVarsInfo(request.DVI),
       m_CUDAGlobalArgsIndexes(request.CUDAGlobalArgsIndexes),
       m_UsesEnzyme(request.use_enzyme),
-      m_DeclarationOnly(request.DeclarationOnly) {}
+      m_DeclarationOnly(request.DeclarationOnly),
+      m_SparseJacobian(request.SparseJacobian),
+      m_ReverseJacobian(request.ReverseJacobian),
+      m_UseTapeArena(request.UseTapeArena),
+      m_ReuseTapes(request.ReuseTapes),
+      m_UseFixedTapes(request.UseFixedTapes),
+      m_FuseTapes(request.FuseTapes),
+      m_RestrictAdjoints(request.RestrictAdjoints) {}
 
 bool DerivedFnInfo::SatisfiesRequest(const DiffRequest& request) const {
   return (request.Function == m_OriginalFn && request.Mode == m_Mode &&
           request.DVI == m_DiffVarsInfo && request.use_enzyme == m_UsesEnzyme &&
           request.DeclarationOnly == m_DeclarationOnly &&
+          request.SparseJacobian == m_SparseJacobian &&
+          request.ReverseJacobian == m_ReverseJacobian &&
+          request.UseTapeArena == m_UseTapeArena &&
+          request.ReuseTapes == m_ReuseTapes &&
+          request.UseFixedTapes == m_UseFixedTapes &&
+          request.FuseTapes == m_FuseTapes &&
+          request.RestrictAdjoints == m_RestrictAdjoints &&
           request.CUDAGlobalArgsIndexes == m_CUDAGlobalArgsIndexes);
 }
 
@@ -29,6 +43,13 @@ bool DerivedFnInfo::RepresentsSameDerivative(const DerivedFnInfo& lhs,
          lhs.m_DiffVarsInfo == rhs.m_DiffVarsInfo &&
          lhs.m_UsesEnzyme == rhs.m_UsesEnzyme &&
          lhs.m_DeclarationOnly == rhs.m_DeclarationOnly &&
+         lhs.m_SparseJacobian == rhs.m_SparseJacobian &&
+         lhs.m_ReverseJacobian == rhs.m_ReverseJacobian &&
+         lhs.m_UseTapeArena == rhs.m_UseTapeArena &&
+         lhs.m_ReuseTapes == rhs.m_ReuseTapes &&
+         lhs.m_UseFixedTapes == rhs.m_UseFixedTapes &&
+         lhs.m_FuseTapes == rhs.m_FuseTapes &&
+         lhs.m_RestrictAdjoints == rhs.m_RestrictAdjoints &&
          lhs.m_CUDAGlobalArgsIndexes == rhs.m_CUDAGlobalArgsIndexes;
 }
 } // namespace clad
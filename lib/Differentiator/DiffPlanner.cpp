@@ -671,6 +671,20 @@ static QualType GetDerivedFunctionType(const CallExpr* CE) {
     Out << "'";
     if (EnableTBRAnalysis)
       Out << ", tbr";
+    if (UseTapeArena)
+      Out << ", tape arena";
+    if (ReuseTapes)
+      Out << ", reuse tapes";
+    if (UseFixedTapes)
+      Out << ", fixed tapes";
+    if (FuseTapes)
+      Out << ", fused tapes";
+    if (SparseJacobian)
+      Out << ", sparse";
+    if (ReverseJacobian)
+      Out << ", reverse";
+    if (RestrictAdjoints)
+      Out << ", restrict";
     Out << ']';
     Out.flush();
   }
@@ -794,11 +808,24 @@ static QualType GetDerivedFunctionType(const CallExpr* CE) {
     }
 
     if (Mode == DiffMode::reverse) {
+      std::string name = BaseFunctionName + "_grad";
       if (DVI.size() != Function->getNumParams())
-        return BaseFunctionName + "_grad" + argInfo;
-      if (use_enzyme)
-        return BaseFunctionName + "_grad" + "_enzyme";
-      return BaseFunctionName + "_grad";
+        name += argInfo;
+      else if (use_enzyme)
+        name += "_enzyme";
+      // These options change the body of the gradient but not its type, so
+      // they must show up in the name for the variants to coexist.
+      if (UseTapeArena)
+        name += "_arena";
+      if (ReuseTapes)
+        name += "_reuse";
+      if (UseFixedTapes)
+        name += "_fixed";
+      if (FuseTapes)
+        name += "_fused";
+      if (RestrictAdjoints)
+        name += "_restrict";
+      return name;
     }
 
     std::string s;
@@ -824,6 +851,60 @@ static QualType GetDerivedFunctionType(const CallExpr* CE) {
     return false;
   }
 
+  /// \returns the options passed to the clad::differentiate, clad::gradient,
+  /// etc. specialization \p FD as template arguments.
+  static unsigned GetBitmaskedOpts(const FunctionDecl* FD) {
+    const TemplateArgumentList* TAL = FD->getTemplateSpecializationArgs();
+    assert(TAL && "Call must have specialization args!");
+
+    // bitmask_opts is a template pack of unsigned integers, so we need to
+    // do bitwise or of all the values to get the final value.
+    unsigned bitmasked_opts_value = 0;
+    const auto template_arg = TAL->get(0);
+    if (template_arg.getKind() == TemplateArgument::Pack)
+      for (const auto& arg : TAL->get(0).pack_elements())
+        bitmasked_opts_value |= arg.getAsIntegral().getExtValue();
+    return bitmasked_opts_value;
+  }
+
+  /// Decides whether the jacobian of \p request is cheaper in reverse mode,
+  /// from the numbers of inputs and outputs known at compile time. The vector
+  /// forward mode carries a derivative per input through every statement,
+  /// while the reverse mode runs a pullback, a few times the cost of the
+  /// function, per output.
+  static bool PreferReverseJacobian(const DiffRequest& request,
+                                    ASTContext& C) {
+    // The cost of a pullback relative to the cost of propagating one
+    // derivative in vector forward mode.
+    constexpr std::size_t pullbackCost = 4;
+    const FunctionDecl* FD = request.Function;
+    if (!FD->getReturnType()->isVoidType())
+      return false;
+    if (const auto* MD = dyn_cast<CXXMethodDecl>(FD))
+      if (MD->isInstance())
+        return false;
+    std::size_t inputs = 0;
+    std::size_t outputs = 0;
+    for (const ParmVarDecl* PVD : FD->parameters()) {
+      QualType T = PVD->getOriginalType();
+      if (!utils::IsDifferentiableType(T))
+        continue;
+      if (T->isReferenceType())
+        return false;
+      bool isOutput = PVD->getName().contains("_clad_out_");
+      if (!isOutput && !request.HasIndependentParameter(PVD))
+        continue;
+      std::size_t size = 1;
+      if (const ConstantArrayType* CAT = C.getAsConstantArrayType(T))
+        size = CAT->getSize().getZExtValue();
+      // The size of the array is only known at run time.
+      else if (utils::isArrayOrPointerType(T))
+        return false;
+      (isOutput ? outputs : inputs) += size;
+    }
+    return outputs && pullbackCost * outputs < inputs;
+  }
+
   ///\returns true on error.
   static bool ProcessInvocationArgs(Sema& S, SourceLocation BeginLoc,
                                     const RequestOptions& ReqOpts,
@@ -844,6 +925,8 @@ static QualType GetDerivedFunctionType(const CallExpr* CE) {
       request.Mode = DiffMode::hessian;
     else if (Annotation == "J")
       request.Mode = DiffMode::jacobian;
+    else if (Annotation == "V")
+      request.Mode = DiffMode::hvp;
     else if (Annotation == "G")
       request.Mode = DiffMode::reverse;
     else
@@ -853,16 +936,7 @@ static QualType GetDerivedFunctionType(const CallExpr* CE) {
     request.EnableVariedAnalysis = ReqOpts.EnableVariedAnalysis;
     request.EnableUsefulAnalysis = ReqOpts.EnableUsefulAnalysis;
 
-    const TemplateArgumentList* TAL = FD->getTemplateSpecializationArgs();
-    assert(TAL && "Call must have specialization args!");
-
-    // bitmask_opts is a template pack of unsigned integers, so we need to
-    // do bitwise or of all the values to get the final value.
-    unsigned bitmasked_opts_value = 0;
-    const auto template_arg = TAL->get(0);
-    if (template_arg.getKind() == TemplateArgument::Pack)
-      for (const auto& arg : TAL->get(0).pack_elements())
-        bitmasked_opts_value |= arg.getAsIntegral().getExtValue();
+    unsigned bitmasked_opts_value = GetBitmaskedOpts(FD);
 
     bool enable_tbr_in_req =
         clad::HasOption(bitmasked_opts_value, clad::opts::enable_tbr);
@@ -937,6 +1011,93 @@ static QualType GetDerivedFunctionType(const CallExpr* CE) {
     if (clad::HasOption(bitmasked_opts_value, clad::opts::use_enzyme))
       request.use_enzyme = true;
 
+    if (clad::HasOption(bitmasked_opts_value, clad::opts::use_tape_arena)) {
+      if (request.Mode != DiffMode::reverse) {
+        utils::diag(S, DiagnosticsEngine::Error, BeginLoc,
+                    "tape arena option is only valid for reverse mode")
+            << BeginLoc;
+        return true;
+      }
+      request.UseTapeArena = true;
+    }
+
+    if (clad::HasOption(bitmasked_opts_value, clad::opts::reuse_tapes)) {
+      if (request.Mode != DiffMode::reverse) {
+        utils::diag(S, DiagnosticsEngine::Error, BeginLoc,
+                    "tape reuse option is only valid for reverse mode")
+            << BeginLoc;
+        return true;
+      }
+      request.ReuseTapes = true;
+    }
+
+    if (clad::HasOption(bitmasked_opts_value, clad::opts::fixed_tapes)) {
+      if (request.Mode != DiffMode::reverse) {
+        utils::diag(S, DiagnosticsEngine::Error, BeginLoc,
+                    "fixed tapes option is only valid for reverse mode")
+            << BeginLoc;
+        return true;
+      }
+      request.UseFixedTapes = true;
+    }
+
+    if (clad::HasOption(bitmasked_opts_value, clad::opts::fuse_tapes)) {
+      if (request.Mode != DiffMode::reverse) {
+        utils::diag(S, DiagnosticsEngine::Error, BeginLoc,
+                    "fuse tapes option is only valid for reverse mode")
+            << BeginLoc;
+        return true;
+      }
+      request.FuseTapes = true;
+    }
+
+    if (clad::HasOption(bitmasked_opts_value, clad::opts::restrict_adjoints)) {
+      if (request.Mode != DiffMode::reverse) {
+        utils::diag(S, DiagnosticsEngine::Error, BeginLoc,
+                    "restrict adjoints option is only valid for reverse mode")
+            << BeginLoc;
+        return true;
+      }
+      request.RestrictAdjoints = true;
+    }
+
+    if (clad::HasOption(bitmasked_opts_value, clad::opts::sparse)) {
+      if (request.Mode != DiffMode::jacobian) {
+        utils::diag(S, DiagnosticsEngine::Error, BeginLoc,
+                    "sparse option is only valid for jacobian mode")
+            << BeginLoc;
+        return true;
+      }
+      request.SparseJacobian = true;
+    }
+
+    bool forward_mode_in_req =
+        clad::HasOption(bitmasked_opts_value, clad::opts::forward_mode);
+    bool reverse_mode_in_req =
+        clad::HasOption(bitmasked_opts_value, clad::opts::reverse_mode);
+    if (forward_mode_in_req || reverse_mode_in_req) {
+      if (request.Mode != DiffMode::jacobian) {
+        utils::diag(S, DiagnosticsEngine::Error, BeginLoc,
+                    "forward and reverse mode options are only valid for "
+                    "jacobian mode")
+            << BeginLoc;
+        return true;
+      }
+      if (forward_mode_in_req && reverse_mode_in_req) {
+        utils::diag(S, DiagnosticsEngine::Error, BeginLoc,
+                    "both forward and reverse mode options are specified")
+            << BeginLoc;
+        return true;
+      }
+      if (reverse_mode_in_req && request.SparseJacobian) {
+        utils::diag(S, DiagnosticsEngine::Error, BeginLoc,
+                    "sparse jacobians are only supported in forward mode")
+            << BeginLoc;
+        return true;
+      }
+      request.ReverseJacobian = reverse_mode_in_req;
+    }
+
     if (request.Mode == DiffMode::forward) {
       // Check for clad::differentiate<N>.
       if (unsigned order = clad::GetDerivativeOrder(bitmasked_opts_value))
@@ -1161,7 +1322,7 @@ static QualType GetDerivedFunctionType(const CallExpr* CE) {
 
       std::string Annotation = A->getAnnotation().str();
       if (Annotation != "D" && Annotation != "G" && Annotation != "H" &&
-          Annotation != "J" && Annotation != "E")
+          Annotation != "J" && Annotation != "E" && Annotation != "V")
         return true;
 
       // A call to clad::differentiate or clad::gradient was not found.
@@ -1179,6 +1340,14 @@ static QualType GetDerivedFunctionType(const CallExpr* CE) {
 
       request.Args = E->getArg(1);
       request.UpdateDiffParamsInfo(m_Sema);
+      // Pick the mode of the jacobian unless the user did.
+      if (request.Mode == DiffMode::jacobian && !request.SparseJacobian) {
+        unsigned opts = GetBitmaskedOpts(FD);
+        if (!clad::HasOption(opts, clad::opts::forward_mode) &&
+            !clad::HasOption(opts, clad::opts::reverse_mode))
+          request.ReverseJacobian =
+              PreferReverseJacobian(request, m_Sema.getASTContext());
+      }
       if (request.Mode == DiffMode::reverse && request.EnableVariedAnalysis) {
         if (request.Args)
           for (const auto& dParam : request.DVI)
@@ -1249,8 +1418,11 @@ static QualType GetDerivedFunctionType(const CallExpr* CE) {
 
       request.Function = FD;
       request.CallContext = E;
+      // The reverse mode jacobian calls the pullback of the function.
+      bool topMostIsReverse = m_TopMostReq->Mode == DiffMode::reverse ||
+                              m_TopMostReq->ReverseJacobian;
       bool canUsePushforwardInRevMode =
-          m_TopMostReq->Mode == DiffMode::reverse &&
+          topMostIsReverse &&
           !request.EnableErrorEstimation &&
           utils::canUsePushforwardInRevMode(FD);
 
@@ -1267,9 +1439,10 @@ static QualType GetDerivedFunctionType(const CallExpr* CE) {
         request.Mode = DiffMode::unknown;
       else if (m_TopMostReq->Mode == DiffMode::forward ||
                m_TopMostReq->Mode == DiffMode::hessian ||
+               m_TopMostReq->Mode == DiffMode::hvp ||
                canUsePushforwardInRevMode)
         request.Mode = DiffMode::pushforward;
-      else if (m_TopMostReq->Mode == DiffMode::reverse)
+      else if (topMostIsReverse)
         request.Mode = DiffMode::pullback;
       else if (m_TopMostReq->Mode == DiffMode::vector_forward_mode ||
                m_TopMostReq->Mode == DiffMode::jacobian ||
@@ -1444,6 +1617,18 @@ static QualType GetDerivedFunctionType(const CallExpr* CE) {
         Saved.get()->addFunctionUsedParams(FD, usedParams[FD]);
       }
 
+      if (request.Mode == DiffMode::hvp) {
+        // The hessian-vector product differentiates the pushforward in reverse
+        // mode, which needs the definition of the pushforward first.
+        DiffRequest forwRequest = request;
+        forwRequest.Mode = DiffMode::pushforward;
+        forwRequest.Args = nullptr;
+        forwRequest.CallUpdateRequired = false;
+        forwRequest.UpdateDiffParamsInfo(m_Sema);
+        LookupCustomDerivativeDecl(forwRequest);
+        m_DiffRequestGraph.addNode(forwRequest, /*isSource=*/true);
+      }
+
       if (request.Mode == DiffMode::hessian ||
           request.Mode == DiffMode::hessian_diagonal) {
         DiffRequest forwRequest = request;
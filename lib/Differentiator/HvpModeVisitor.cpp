@@ -0,0 +1,352 @@
+#include "HvpModeVisitor.h"
+
+#include "ConstantFolder.h"
+#include "clad/Differentiator/CladUtils.h"
+#include "clad/Differentiator/Compatibility.h"
+#include "clad/Differentiator/DiffPlanner.h"
+
+#include "clang/AST/Decl.h"
+#include "clang/AST/DeclCXX.h"
+#include "clang/AST/Expr.h"
+#include "clang/AST/OperationKinds.h"
+#include "clang/AST/Stmt.h"
+#include "clang/Basic/OperatorKinds.h"
+#include "clang/Sema/Scope.h"
+
+#include "llvm/Support/SaveAndRestore.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <string>
+
+using namespace clang;
+
+namespace clad {
+HvpModeVisitor::HvpModeVisitor(DerivativeBuilder& builder,
+                               const DiffRequest& request)
+    : VisitorBase(builder, request) {}
+
+DerivativeAndOverload HvpModeVisitor::Derive() {
+  const FunctionDecl* FD = m_DiffReq.Function;
+  assert(m_DiffReq.Mode == DiffMode::hvp);
+
+  DiffParams args{};
+  IndexIntervalTable indexIntervalTable{};
+  for (const DiffInputVarInfo& dParam : m_DiffReq.DVI) {
+    args.push_back(dParam.param);
+    indexIntervalTable.push_back(dParam.paramIndexInterval);
+  }
+  if (args.empty()) {
+    std::copy(FD->param_begin(), FD->param_end(), std::back_inserter(args));
+    indexIntervalTable.resize(args.size());
+  }
+
+  SourceLocation L = FD->getBeginLoc();
+  if (m_DiffReq.Args)
+    L = m_DiffReq.Args->getExprLoc();
+  QualType retTy = FD->getReturnType();
+  if (!retTy->isRealType()) {
+    diag(DiagnosticsEngine::Error, L,
+         "hvp mode differentiation needs a function returning a real number");
+    return {};
+  }
+  if (const auto* MD = dyn_cast<CXXMethodDecl>(FD)) {
+    if (MD->isInstance()) {
+      diag(DiagnosticsEngine::Error, L,
+           "hvp mode differentiation of member functions and functors is not "
+           "supported");
+      return {};
+    }
+  }
+
+  // The direction has an element per independent scalar and per requested
+  // index of an independent array. We have to size the tangents and adjoints
+  // of every array, so all of them must be independent.
+  for (const ParmVarDecl* PVD : FD->parameters()) {
+    QualType T = PVD->getType();
+    if (!utils::IsDifferentiableType(T))
+      continue;
+    auto it = std::find(args.begin(), args.end(), PVD);
+    if (utils::isArrayOrPointerType(T)) {
+      if (it == args.end() || !indexIntervalTable[it - args.begin()].isValid()) {
+        std::string helperMsg(PVD->getNameAsString() + "[0:<last index of " +
+                              PVD->getNameAsString() + ">]");
+        diag(DiagnosticsEngine::Error, L,
+             "hvp mode differentiation needs the indices of the array or "
+             "pointer parameter '%0' to size its direction; did you mean to "
+             "add '%1' to the args")
+            << PVD->getName() << helperMsg;
+        return {};
+      }
+      if (!T->getPointeeOrArrayElementType()->isRealType()) {
+        diag(DiagnosticsEngine::Error, L,
+             "attempted differentiation w.r.t. parameter '%0' which is not "
+             "array or pointer of real type")
+            << PVD->getName();
+        return {};
+      }
+    } else if (!T.getNonReferenceType()->isRealType()) {
+      diag(DiagnosticsEngine::Error, L,
+           "hvp mode differentiation w.r.t. parameter '%0' of non-real type "
+           "is not supported")
+          << PVD->getName();
+      return {};
+    }
+  }
+
+  // H * v is the gradient of the derivative in the direction v, that is the
+  // adjoint of the inputs of the pushforward seeded with the direction when
+  // its result is seeded with {0, 1}. The planner has scheduled the
+  // pushforward; its pullback is requested here.
+  DiffRequest pushforwardRequest = m_DiffReq;
+  pushforwardRequest.Mode = DiffMode::pushforward;
+  pushforwardRequest.Args = nullptr;
+  pushforwardRequest.CallUpdateRequired = false;
+  pushforwardRequest.UpdateDiffParamsInfo(m_Sema);
+  FunctionDecl* pushforwardFD =
+      m_Builder.FindDerivedFunction(pushforwardRequest);
+  if (!pushforwardFD)
+    return {};
+
+  DiffRequest pullbackRequest{};
+  pullbackRequest.Mode = DiffMode::pullback;
+  pullbackRequest.Function = pushforwardFD;
+  pullbackRequest.BaseFunctionName = pushforwardFD->getNameAsString();
+  for (const ParmVarDecl* PVD : pushforwardFD->parameters())
+    pullbackRequest.DVI.push_back(PVD);
+  FunctionDecl* pullbackFD = m_Builder.HandleNestedDiffRequest(pullbackRequest);
+  if (!pullbackFD)
+    return {};
+  // The pullback takes the parameters of the pushforward, the adjoint of its
+  // result and an adjoint per parameter.
+  unsigned numPushforwardParams = pushforwardFD->getNumParams();
+  assert(pullbackFD->getNumParams() == 2 * numPushforwardParams + 1 &&
+         "unexpected signature of the pullback of the pushforward");
+
+  std::string hvpFuncName = m_DiffReq.BaseFunctionName + "_hvp";
+  if (args.size() != FD->getNumParams() ||
+      !std::equal(FD->param_begin(), FD->param_end(), args.begin())) {
+    for (const ValueDecl* arg : args) {
+      const auto* it = std::find(FD->param_begin(), FD->param_end(), arg);
+      auto idx = std::distance(FD->param_begin(), it);
+      hvpFuncName += ('_' + std::to_string(idx));
+    }
+  }
+  IdentifierInfo* II = &m_Context.Idents.get(hvpFuncName);
+  SourceLocation loc{m_DiffReq->getLocation()};
+  DeclarationNameInfo name(II, loc);
+
+  QualType hvpFunctionType = GetDerivativeType();
+
+  llvm::SaveAndRestore<DeclContext*> SaveContext(m_Sema.CurContext);
+  llvm::SaveAndRestore<Scope*> SaveScope(getCurrentScope(),
+                                         getEnclosingNamespaceOrTUScope());
+  // FIXME: We should not use const_cast to get the decl context here.
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-const-cast)
+  auto* DC = const_cast<DeclContext*>(m_DiffReq->getDeclContext());
+  m_Sema.CurContext = DC;
+  // `result` owns the namespace Scopes cloneFunction opens; its
+  // destructor pops them before SaveScope restores.
+  ClonedFunction result =
+      m_Builder.cloneFunction(FD, *this, DC, loc, name, hvpFunctionType);
+  FunctionDecl* hvpFD = result.fd;
+  m_Derivative = hvpFD;
+
+  // Function declaration scope
+  beginScope(Scope::FunctionPrototypeScope | Scope::FunctionDeclarationScope |
+             Scope::DeclScope);
+  m_Sema.PushFunctionScope();
+  m_Sema.PushDeclContext(getCurrentScope(), m_Derivative);
+
+  llvm::SmallVector<ParmVarDecl*, 16> params;
+  for (const ParmVarDecl* PVD : FD->parameters()) {
+    IdentifierInfo* PVDII = PVD->getIdentifier();
+    // Unnamed parameters are still passed on to the pullback.
+    if (!PVD->getDeclName())
+      PVDII = CreateUniqueIdentifier("param");
+    params.push_back(CloneParmVarDecl(PVD, PVDII, /*pushOnScopeChains=*/true,
+                                      /*cloneDefaultArg=*/false));
+  }
+  llvm::ArrayRef<QualType> paramTypes =
+      cast<FunctionProtoType>(hvpFunctionType)->getParamTypes();
+  for (llvm::StringRef outName : {"vector", "hessianVectorProduct"}) {
+    QualType outTy = paramTypes[params.size()];
+    ParmVarDecl* outPVD = utils::BuildParmVarDecl(
+        m_Sema, m_Derivative, &m_Context.Idents.get(outName), outTy);
+    m_Sema.PushOnScopeChains(outPVD, getCurrentScope(),
+                             /*AddToContext=*/false);
+    params.push_back(outPVD);
+  }
+  ParmVarDecl* hvpPVD = params.back();
+  ParmVarDecl* vectorPVD = params[params.size() - 2];
+  m_Derivative->setParams(
+      clad_compat::makeArrayRef(params.data(), params.size()));
+  m_Derivative->setBody(nullptr);
+
+  // Function body scope
+  beginScope(Scope::FnScope | Scope::DeclScope);
+  m_DerivativeFnScope = getCurrentScope();
+  beginBlock();
+
+  auto literal = [this](std::size_t val) {
+    return ConstantFolder::synthesizeLiteral(m_Context.IntTy, m_Context, val);
+  };
+  auto offsetBy = [&](Expr* E, std::size_t offset) {
+    return offset ? BuildOp(BO_Add, E, literal(offset)) : E;
+  };
+  // Builds `for (int i = 0; i < size; ++i) dst[dstOffset + i] =
+  // src[srcOffset + i];`, where clad::array operands are subscripted through
+  // their operator[].
+  auto buildCopy = [&](VarDecl* dst, std::size_t dstOffset, VarDecl* src,
+                       std::size_t srcOffset, std::size_t size) -> Stmt* {
+    auto subscript = [&](VarDecl* VD, Expr* idx) -> Expr* {
+      if (VD->getType()->isPointerType())
+        return BuildArraySubscript(BuildDeclRef(VD), idx);
+      llvm::SmallVector<Expr*, 2> subscriptArgs = {BuildDeclRef(VD), idx};
+      return BuildOperatorCall(OO_Subscript, subscriptArgs);
+    };
+    VarDecl* i = BuildVarDecl(m_Context.IntTy, "_i", literal(0));
+    Expr* assign = BuildOp(
+        BO_Assign, subscript(dst, offsetBy(BuildDeclRef(i), dstOffset)),
+        subscript(src, offsetBy(BuildDeclRef(i), srcOffset)));
+    return new (m_Context)
+        ForStmt(m_Context, BuildDeclStmt(i),
+                BuildOp(BO_LT, BuildDeclRef(i), literal(size)), nullptr,
+                BuildOp(UO_PreInc, BuildDeclRef(i)), assign, noLoc, noLoc,
+                noLoc);
+  };
+
+  // Seed the tangents with the direction, e.g.
+  //   double _d_x = vector[0];
+  //   clad::array<double> _d_p(finish);
+  //   for (int _i = 0; _i < size; ++_i)
+  //     _d_p[start + _i] = vector[offset + _i];
+  // The tangents of the parameters that are not independent are zero.
+  llvm::SmallVector<Expr*, 16> pullbackArgs;
+  llvm::SmallVector<Expr*, 16> tangentArgs;
+  // The number of elements of the adjoint of every parameter and tangent, or
+  // zero for scalars.
+  llvm::SmallVector<std::size_t, 16> adjointSizes;
+  llvm::SmallVector<std::size_t, 16> tangentAdjointSizes;
+  // The offset in the direction of every independent parameter.
+  llvm::SmallVector<std::size_t, 16> offsets;
+  std::size_t offset = 0;
+  for (std::size_t i = 0, e = FD->getNumParams(); i < e; ++i) {
+    const ParmVarDecl* PVD = FD->getParamDecl(i);
+    ParmVarDecl* param = params[i];
+    pullbackArgs.push_back(BuildDeclRef(param));
+    offsets.push_back(offset);
+    if (!utils::IsDifferentiableType(PVD->getType())) {
+      adjointSizes.push_back(0);
+      continue;
+    }
+    auto it = std::find(args.begin(), args.end(), PVD);
+    if (utils::isArrayOrPointerType(PVD->getType())) {
+      const IndexInterval& interval = indexIntervalTable[it - args.begin()];
+      std::size_t size = interval.Finish - interval.Start;
+      QualType arrayTy = utils::GetCladArrayOfType(
+          m_Sema, utils::GetNonConstValueType(PVD->getType()));
+      VarDecl* tangentVD =
+          BuildVarDecl(arrayTy, "_d_" + param->getNameAsString(),
+                       literal(interval.Finish), /*DirectInit=*/true);
+      addToCurrentBlock(BuildDeclStmt(tangentVD));
+      addToCurrentBlock(
+          buildCopy(tangentVD, interval.Start, vectorPVD, offset, size));
+      tangentArgs.push_back(BuildDeclRef(tangentVD));
+      adjointSizes.push_back(interval.Finish);
+      tangentAdjointSizes.push_back(interval.Finish);
+      offset += size;
+      continue;
+    }
+    QualType tangentTy =
+        utils::getNonConstType(PVD->getType().getNonReferenceType(), m_Sema);
+    Expr* tangentInit = nullptr;
+    if (it != args.end()) {
+      Expr* idx = literal(offset++);
+      tangentInit = BuildArraySubscript(BuildDeclRef(vectorPVD), idx);
+    } else {
+      tangentInit = getZeroInit(tangentTy);
+    }
+    VarDecl* tangentVD = BuildVarDecl(
+        tangentTy, "_d_" + param->getNameAsString(), tangentInit);
+    addToCurrentBlock(BuildDeclStmt(tangentVD));
+    tangentArgs.push_back(BuildDeclRef(tangentVD));
+    adjointSizes.push_back(0);
+    tangentAdjointSizes.push_back(0);
+  }
+  pullbackArgs.append(tangentArgs.begin(), tangentArgs.end());
+
+  // Declares the adjoint passed as the pullback parameter `adjointIdx` and
+  // returns the argument for it.
+  auto buildAdjoint = [&](unsigned adjointIdx, std::size_t size,
+                          VarDecl*& adjointVD) -> Expr* {
+    QualType adjointTy =
+        pullbackFD->getParamDecl(adjointIdx)->getType()->getPointeeType();
+    if (size) {
+      QualType arrayTy = utils::GetCladArrayOfType(m_Sema, adjointTy);
+      adjointVD =
+          BuildVarDecl(arrayTy, "_r", literal(size), /*DirectInit=*/true);
+      addToCurrentBlock(BuildDeclStmt(adjointVD));
+      return BuildDeclRef(adjointVD);
+    }
+    adjointVD = BuildVarDecl(adjointTy, "_r", getZeroInit(adjointTy));
+    addToCurrentBlock(BuildDeclStmt(adjointVD));
+    return BuildOp(UO_AddrOf, BuildDeclRef(adjointVD));
+  };
+  llvm::SmallVector<Expr*, 16> adjointArgs;
+  llvm::SmallVector<Stmt*, 16> stores;
+  for (std::size_t i = 0, e = FD->getNumParams(); i < e; ++i) {
+    VarDecl* adjointVD = nullptr;
+    adjointArgs.push_back(
+        buildAdjoint(numPushforwardParams + 1 + i, adjointSizes[i], adjointVD));
+    const ParmVarDecl* PVD = FD->getParamDecl(i);
+    auto it = std::find(args.begin(), args.end(), PVD);
+    if (it == args.end() || !utils::IsDifferentiableType(PVD->getType()))
+      continue;
+    // hessianVectorProduct[offset] = _r0;
+    if (adjointSizes[i]) {
+      const IndexInterval& interval = indexIntervalTable[it - args.begin()];
+      stores.push_back(buildCopy(hvpPVD, offsets[i], adjointVD,
+                                 interval.Start,
+                                 interval.Finish - interval.Start));
+    } else {
+      Expr* idx = literal(offsets[i]);
+      stores.push_back(
+          BuildOp(BO_Assign, BuildArraySubscript(BuildDeclRef(hvpPVD), idx),
+                  BuildDeclRef(adjointVD)));
+    }
+  }
+  // The adjoints of the tangents are not needed.
+  for (std::size_t t = 0, e = tangentAdjointSizes.size(); t < e; ++t) {
+    VarDecl* adjointVD = nullptr;
+    adjointArgs.push_back(
+        buildAdjoint(numPushforwardParams + 1 + FD->getNumParams() + t,
+                     tangentAdjointSizes[t], adjointVD));
+  }
+
+  // clad::ValueAndPushforward<T, T> _seed = {0., 1.};
+  QualType seedTy =
+      pullbackFD->getParamDecl(numPushforwardParams)->getType();
+  QualType valueTy = utils::getNonConstType(retTy.getNonReferenceType(), m_Sema);
+  llvm::SmallVector<Expr*, 2> seedInits = {
+      getZeroInit(valueTy),
+      ConstantFolder::synthesizeLiteral(valueTy, m_Context, /*val=*/1)};
+  Expr* seedInit = m_Sema.ActOnInitList(noLoc, seedInits, noLoc).get();
+  VarDecl* seedVD = BuildVarDecl(seedTy, "_seed", seedInit);
+  addToCurrentBlock(BuildDeclStmt(seedVD));
+
+  pullbackArgs.push_back(BuildDeclRef(seedVD));
+  pullbackArgs.append(adjointArgs.begin(), adjointArgs.end());
+  addToCurrentBlock(BuildCallExprToFunction(pullbackFD, pullbackArgs));
+  for (Stmt* S : stores)
+    addToCurrentBlock(S);
+
+  m_Derivative->setBody(endBlock());
+  endScope(); // Function body scope
+  m_Sema.PopFunctionScopeInfo();
+  m_Sema.PopDeclContext();
+  endScope(); // Function decl scope
+
+  return DerivativeAndOverload{result.fd, /*OverloadFunctionDecl=*/nullptr};
+}
+} // end namespace clad
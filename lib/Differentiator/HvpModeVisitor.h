@@ -0,0 +1,24 @@
+#ifndef CLAD_DIFFERENTIATOR_HVPMODEVISITOR_H
+#define CLAD_DIFFERENTIATOR_HVPMODEVISITOR_H
+
+#include "clad/Differentiator/DerivativeBuilder.h"
+#include "clad/Differentiator/VisitorBase.h"
+
+namespace clad {
+/// Generates the hessian-vector products requested by clad::hvp. The product
+/// with a direction v is the gradient of the directional derivative along v,
+/// which we get with a single call to the pullback of the pushforward of the
+/// function, i.e. at a small constant times the cost of one gradient.
+class HvpModeVisitor : public VisitorBase {
+public:
+  HvpModeVisitor(DerivativeBuilder& builder, const DiffRequest& request);
+
+  /// Produces `void f_hvp(<params of f>, T* vector, T* hessianVectorProduct)`
+  /// where `vector` and `hessianVectorProduct` hold one element per
+  /// independent scalar and per requested index of an independent array, in
+  /// the order of the parameters, like a row of the matrix of clad::hessian.
+  DerivativeAndOverload Derive() override;
+};
+} // end namespace clad
+
+#endif // CLAD_DIFFERENTIATOR_HVPMODEVISITOR_H
@@ -5,10 +5,16 @@
 #include "clad/Differentiator/DerivativeBuilder.h"
 
 #include "clang/AST/Decl.h"
+#include "clang/AST/DeclCXX.h"
 #include "clang/AST/OperationKinds.h"
+#include "clang/AST/Stmt.h"
+#include "clang/Basic/OperatorKinds.h"
 
 #include "llvm/Support/SaveAndRestore.h"
 
+#include <algorithm>
+#include <string>
+
 using namespace clang;
 
 namespace clad {
@@ -20,12 +26,40 @@ DerivativeAndOverload JacobianModeVisitor::Derive() {
   const FunctionDecl* FD = m_DiffReq.Function;
   assert(m_DiffReq.Mode == DiffMode::jacobian);
 
+  if (m_DiffReq.ReverseJacobian)
+    return DeriveUsingReverseMode();
+
   DiffParams args{};
   for (const DiffInputVarInfo& dParam : m_DiffReq.DVI)
     args.push_back(dParam.param);
 
+  // The sparse jacobian takes the seeds of the independent arrays from the
+  // caller, the columns of which are the independent variables.
+  const ValueDecl* seedParam = nullptr;
+  if (m_DiffReq.SparseJacobian) {
+    for (const ValueDecl* arg : args) {
+      if (!utils::isArrayOrPointerType(arg->getType())) {
+        diag(DiagnosticsEngine::Error, arg->getBeginLoc(),
+             "sparse jacobian mode supports only array or pointer "
+             "independent parameters; '%0' is not one")
+            << arg->getName();
+        return {};
+      }
+      if (!seedParam && !arg->getName().contains("_clad_out_"))
+        seedParam = arg;
+    }
+    if (!seedParam) {
+      diag(DiagnosticsEngine::Error, FD->getBeginLoc(),
+           "sparse jacobian mode needs an independent array or pointer "
+           "parameter that is not an output");
+      return {};
+    }
+  }
+
   // Generate name for the derivative function.
   std::string derivedFnName = m_DiffReq.BaseFunctionName + "_jac";
+  if (m_DiffReq.SparseJacobian)
+    derivedFnName += "_sparse";
   if (args.size() != FD->getNumParams()) {
     for (const ValueDecl* arg : args) {
       const auto* it = std::find(FD->param_begin(), FD->param_end(), arg);
@@ -106,7 +140,12 @@ DerivativeAndOverload JacobianModeVisitor::Derive() {
       Expr* getSize = BuildCallExprToMemFn(BuildDeclRef(derivedPVD),
                                            /*MemberFunctionName=*/"rows", {});
       llvm::StringRef PVDName = PVD->getName();
-      if (!PVDName.contains("_clad_out_")) {
+      if (m_DiffReq.SparseJacobian) {
+        // All seeds have a column per color.
+        if (PVD == seedParam)
+          indVarCountExpr = BuildCallExprToMemFn(
+              BuildDeclRef(derivedPVD), /*MemberFunctionName=*/"cols", {});
+      } else if (!PVDName.contains("_clad_out_")) {
         if (!indVarCountExpr)
           indVarCountExpr = getSize;
         else
@@ -145,7 +184,7 @@ DerivativeAndOverload JacobianModeVisitor::Derive() {
       m_Context.UnsignedLongTy, m_Context, nonArrayIndVarCount);
   if (!indVarCountExpr) {
     indVarCountExpr = nonArrayIndVarCountExpr;
-  } else if (nonArrayIndVarCount != 0) {
+  } else if (nonArrayIndVarCount != 0 && !m_DiffReq.SparseJacobian) {
     indVarCountExpr = BuildOp(BinaryOperatorKind::BO_Add, indVarCountExpr,
                               nonArrayIndVarCountExpr);
   }
@@ -199,6 +238,11 @@ DerivativeAndOverload JacobianModeVisitor::Derive() {
         offsetExpr = BuildOp(BinaryOperatorKind::BO_Add, offsetExpr,
                              nonArrayIndVarCountExpr);
 
+      if (is_array && m_DiffReq.SparseJacobian) {
+        // The caller has seeded the array.
+        ++independentVarIndex;
+        continue;
+      }
       if (is_array) {
         // The adjoint is `(*_d_p)`; the array whose size we need is the bare
         // `_d_p` reference (m_Variables stores its decl).
@@ -277,6 +321,270 @@ DerivativeAndOverload JacobianModeVisitor::Derive() {
   return DerivativeAndOverload{vectorDiffFD, overloadFD};
 }
 
+DerivativeAndOverload JacobianModeVisitor::DeriveUsingReverseMode() {
+  const FunctionDecl* FD = m_DiffReq.Function;
+  SourceLocation loc{m_DiffReq->getLocation()};
+
+  if (!FD->getReturnType()->isVoidType()) {
+    diag(DiagnosticsEngine::Error, FD->getBeginLoc(),
+         "reverse mode jacobian needs a function returning void that writes "
+         "its outputs to '_clad_out_' parameters");
+    return {};
+  }
+  if (const auto* MD = dyn_cast<CXXMethodDecl>(FD)) {
+    if (MD->isInstance()) {
+      diag(DiagnosticsEngine::Error, FD->getBeginLoc(),
+           "reverse mode jacobian of member functions and functors is not "
+           "supported");
+      return {};
+    }
+  }
+  for (const ParmVarDecl* PVD : FD->parameters()) {
+    if (utils::IsDifferentiableType(PVD->getType()) &&
+        PVD->getType()->isReferenceType()) {
+      diag(DiagnosticsEngine::Error, PVD->getBeginLoc(),
+           "reverse mode jacobian does not support the reference parameter "
+           "'%0'")
+          << PVD->getName();
+      return {};
+    }
+  }
+
+  // Every row of the jacobian is the adjoint of the inputs when the adjoint of
+  // its output is the unit vector.
+  DiffRequest pullbackRequest{};
+  pullbackRequest.Mode = DiffMode::pullback;
+  pullbackRequest.Function = FD;
+  pullbackRequest.BaseFunctionName = m_DiffReq.BaseFunctionName;
+  for (const ParmVarDecl* PVD : FD->parameters())
+    pullbackRequest.DVI.push_back(PVD);
+  FunctionDecl* pullbackFD = m_Builder.HandleNestedDiffRequest(pullbackRequest);
+  if (!pullbackFD)
+    return {};
+  // The pullback takes the original parameters, then the adjoints of those
+  // without the non_differentiable attribute.
+  llvm::SmallVector<ParmVarDecl*, 16> pullbackAdjoints(FD->getNumParams(),
+                                                       nullptr);
+  unsigned adjointIdx = FD->getNumParams();
+  for (size_t p = 0, e = FD->getNumParams(); p < e; ++p)
+    if (!utils::hasNonDifferentiableAttribute(FD->getParamDecl(p)))
+      pullbackAdjoints[p] = pullbackFD->getParamDecl(adjointIdx++);
+  if (adjointIdx != pullbackFD->getNumParams()) {
+    diag(DiagnosticsEngine::Error, FD->getBeginLoc(),
+         "reverse mode jacobian cannot match the parameters of the pullback "
+         "of '%0'")
+        << FD->getName();
+    return {};
+  }
+
+  std::string derivedFnName = m_DiffReq.BaseFunctionName + "_jac_reverse";
+  if (m_DiffReq.DVI.size() != FD->getNumParams()) {
+    for (const DiffInputVarInfo& dParam : m_DiffReq.DVI) {
+      const auto* it =
+          std::find(FD->param_begin(), FD->param_end(), dParam.param);
+      auto idx = std::distance(FD->param_begin(), it);
+      derivedFnName += ('_' + std::to_string(idx));
+    }
+  }
+  IdentifierInfo* II = &m_Context.Idents.get(derivedFnName);
+  DeclarationNameInfo name(II, loc);
+
+  QualType jacobianFunctionType = GetDerivativeType();
+
+  llvm::SaveAndRestore<DeclContext*> SaveContext(m_Sema.CurContext);
+  llvm::SaveAndRestore<Scope*> SaveScope(getCurrentScope());
+  // FIXME: We should not use const_cast to get the decl context here.
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-const-cast)
+  auto* DC = const_cast<DeclContext*>(m_DiffReq->getDeclContext());
+  m_Sema.CurContext = DC;
+  // `result` owns the namespace Scopes cloneFunction opens; its
+  // destructor pops them before SaveScope restores.
+  ClonedFunction result = m_Builder.cloneFunction(
+      m_DiffReq.Function, *this, DC, loc, name, jacobianFunctionType);
+  FunctionDecl* jacobianFD = result.fd;
+  m_Derivative = jacobianFD;
+
+  // Function declaration scope
+  beginScope(Scope::FunctionPrototypeScope | Scope::FunctionDeclarationScope |
+             Scope::DeclScope);
+  m_Sema.PushFunctionScope();
+  m_Sema.PushDeclContext(getCurrentScope(), m_Derivative);
+
+  // The parameters are the same as in vector forward mode: the original ones,
+  // then a matrix per array parameter.
+  llvm::SmallVector<ParmVarDecl*, 16> params;
+  llvm::SmallVector<ParmVarDecl*, 16> matrixParams(FD->getNumParams(), nullptr);
+  for (const ParmVarDecl* PVD : FD->parameters())
+    params.push_back(CloneParmVarDecl(PVD, PVD->getIdentifier(),
+                                      /*pushOnScopeChains=*/true,
+                                      /*cloneDefaultArg=*/false));
+  for (size_t i = 0, e = FD->getNumParams(); i < e; ++i) {
+    const ParmVarDecl* PVD = FD->getParamDecl(i);
+    if (!utils::IsDifferentiableType(PVD->getType()) ||
+        !utils::isArrayOrPointerType(PVD->getType()))
+      continue;
+    IdentifierInfo* matrixII =
+        CreateUniqueIdentifier("_d_vector_" + PVD->getNameAsString());
+    matrixParams[i] = utils::BuildParmVarDecl(
+        m_Sema, m_Derivative, matrixII,
+        utils::GetParameterDerivativeType(m_Sema, m_DiffReq.Mode,
+                                          PVD->getType()),
+        PVD->getStorageClass());
+    m_Sema.PushOnScopeChains(matrixParams[i], getCurrentScope(),
+                             /*AddToContext=*/false);
+  }
+  llvm::SmallVector<ParmVarDecl*, 16> allParams(params.begin(), params.end());
+  for (ParmVarDecl* matrixPVD : matrixParams)
+    if (matrixPVD)
+      allParams.push_back(matrixPVD);
+  jacobianFD->setParams(
+      clad_compat::makeArrayRef(allParams.data(), allParams.size()));
+  jacobianFD->setBody(nullptr);
+
+  // Function body scope
+  beginScope(Scope::FnScope | Scope::DeclScope);
+  m_DerivativeFnScope = getCurrentScope();
+  beginBlock();
+
+  QualType sizeTy = m_Context.UnsignedLongTy;
+  auto literal = [&](size_t val) {
+    return ConstantFolder::synthesizeLiteral(sizeTy, m_Context, val);
+  };
+  auto getRows = [&](size_t i) {
+    return BuildCallExprToMemFn(BuildDeclRef(matrixParams[i]),
+                                /*MemberFunctionName=*/"rows", {});
+  };
+  auto isOutput = [&](size_t i) {
+    return FD->getParamDecl(i)->getName().contains("_clad_out_");
+  };
+  auto isIndependent = [&](size_t i) {
+    return std::any_of(m_DiffReq.DVI.begin(), m_DiffReq.DVI.end(),
+                       [&](const DiffInputVarInfo& dParam) {
+                         return dParam.param == FD->getParamDecl(i);
+                       });
+  };
+
+  // The first column of every independent input, as in vector forward mode.
+  llvm::SmallVector<Expr*, 16> offsets(FD->getNumParams(), nullptr);
+  Expr* offset = nullptr;
+  size_t nonArrayOffset = 0;
+  for (size_t i = 0, e = FD->getNumParams(); i < e; ++i) {
+    if (!isIndependent(i) || isOutput(i) ||
+        !utils::IsDifferentiableType(FD->getParamDecl(i)->getType()))
+      continue;
+    Expr* nonArrayOffsetExpr = literal(nonArrayOffset);
+    if (!offset)
+      offsets[i] = nonArrayOffsetExpr;
+    else if (nonArrayOffset)
+      offsets[i] = BuildOp(BO_Add, CloneNode(offset), nonArrayOffsetExpr);
+    else
+      offsets[i] = CloneNode(offset);
+    if (!matrixParams[i]) {
+      ++nonArrayOffset;
+      continue;
+    }
+    offset = offset ? BuildOp(BO_Add, offset, getRows(i)) : getRows(i);
+  }
+
+  // for (unsigned long _i = 0; _i < _d_vector__clad_out_y->rows(); ++_i) {
+  //   double _d_x = 0.;
+  //   clad::array<double> _d_p(_d_vector_p->rows());
+  //   clad::array<double> _d__clad_out_y(_d_vector__clad_out_y->rows());
+  //   _d__clad_out_y[_i] = 1;
+  //   f_pullback(x, p, _clad_out_y, &_d_x, _d_p, _d__clad_out_y);
+  //   (*_d_vector__clad_out_y)(_i, 0UL) = _d_x;
+  //   for (unsigned long _j = 0; _j < _d_vector_p->rows(); ++_j)
+  //     (*_d_vector__clad_out_y)(_i, 1UL + _j) = _d_p[_j];
+  // }
+  for (size_t o = 0, e = FD->getNumParams(); o < e; ++o) {
+    if (!matrixParams[o] || !isOutput(o) || !pullbackAdjoints[o])
+      continue;
+    VarDecl* i = BuildVarDecl(sizeTy, "_i", literal(0));
+    auto jacobianAt = [&](Expr* col) {
+      Expr* jacobian = BuildParens(
+          BuildOp(UO_Deref, BuildDeclRef(matrixParams[o])));
+      llvm::SmallVector<Expr*, 3> callArgs = {jacobian, BuildDeclRef(i), col};
+      return BuildOperatorCall(OO_Call, callArgs);
+    };
+    auto subscript = [&](VarDecl* VD, VarDecl* idx) {
+      llvm::SmallVector<Expr*, 2> subscriptArgs = {BuildDeclRef(VD),
+                                                   BuildDeclRef(idx)};
+      return BuildOperatorCall(OO_Subscript, subscriptArgs);
+    };
+    beginBlock();
+    llvm::SmallVector<Expr*, 16> pullbackArgs;
+    for (ParmVarDecl* PVD : params)
+      pullbackArgs.push_back(BuildDeclRef(PVD));
+    llvm::SmallVector<VarDecl*, 16> adjoints;
+    for (size_t p = 0; p < e; ++p) {
+      if (!pullbackAdjoints[p]) {
+        adjoints.push_back(nullptr);
+        continue;
+      }
+      QualType adjointTy = pullbackAdjoints[p]->getType();
+      std::string adjointName = "_d_" + FD->getParamDecl(p)->getNameAsString();
+      VarDecl* adjointVD = nullptr;
+      if (matrixParams[p]) {
+        QualType arrayTy =
+            utils::GetCladArrayOfType(m_Sema, adjointTy->getPointeeType());
+        adjointVD = BuildVarDecl(arrayTy, adjointName, getRows(p),
+                                 /*DirectInit=*/true);
+        pullbackArgs.push_back(BuildDeclRef(adjointVD));
+      } else {
+        adjointTy = adjointTy->getPointeeType();
+        adjointVD = BuildVarDecl(adjointTy, adjointName, getZeroInit(adjointTy));
+        pullbackArgs.push_back(BuildOp(UO_AddrOf, BuildDeclRef(adjointVD)));
+      }
+      addToCurrentBlock(BuildDeclStmt(adjointVD));
+      adjoints.push_back(adjointVD);
+    }
+    QualType outTy =
+        utils::GetValueType(FD->getParamDecl(o)->getType()).getUnqualifiedType();
+    addToCurrentBlock(
+        BuildOp(BO_Assign, subscript(adjoints[o], i),
+                ConstantFolder::synthesizeLiteral(outTy, m_Context, 1)));
+    addToCurrentBlock(BuildCallExprToFunction(pullbackFD, pullbackArgs));
+    for (size_t p = 0; p < e; ++p) {
+      // Non-differentiable inputs keep their zero columns.
+      if (!offsets[p] || !adjoints[p])
+        continue;
+      if (!matrixParams[p]) {
+        addToCurrentBlock(BuildOp(BO_Assign, jacobianAt(CloneNode(offsets[p])),
+                                  BuildDeclRef(adjoints[p])));
+        continue;
+      }
+      VarDecl* j = BuildVarDecl(sizeTy, "_j", literal(0));
+      Expr* col = BuildOp(BO_Add, CloneNode(offsets[p]), BuildDeclRef(j));
+      Expr* store =
+          BuildOp(BO_Assign, jacobianAt(col), subscript(adjoints[p], j));
+      addToCurrentBlock(new (m_Context) ForStmt(
+          m_Context, BuildDeclStmt(j),
+          BuildOp(BO_LT, BuildDeclRef(j), getRows(p)), /*condVar=*/nullptr,
+          BuildOp(UO_PreInc, BuildDeclRef(j)), store, noLoc, noLoc, noLoc));
+    }
+    CompoundStmt* rowBody = endBlock();
+    addToCurrentBlock(new (m_Context) ForStmt(
+        m_Context, BuildDeclStmt(i),
+        BuildOp(BO_LT, BuildDeclRef(i), getRows(o)), /*condVar=*/nullptr,
+        BuildOp(UO_PreInc, BuildDeclRef(i)), rowBody, noLoc, noLoc, noLoc));
+  }
+
+  // The pullbacks restore the outputs; compute them as the vector forward
+  // mode jacobian does.
+  llvm::SmallVector<Expr*, 16> callArgs;
+  for (ParmVarDecl* PVD : params)
+    callArgs.push_back(BuildDeclRef(PVD));
+  addToCurrentBlock(BuildCallExprToFunction(FD, callArgs));
+
+  m_Derivative->setBody(endBlock());
+  endScope(); // Function body scope
+  m_Sema.PopFunctionScopeInfo();
+  m_Sema.PopDeclContext();
+  endScope(); // Function decl scope
+  FunctionDecl* overloadFD = CreateDerivativeOverload();
+  return DerivativeAndOverload{jacobianFD, overloadFD};
+}
+
 StmtDiff JacobianModeVisitor::VisitReturnStmt(const clang::ReturnStmt* RS) {
   // If there is no return value, we must not attempt to differentiate
   if (!RS->getRetValue())
@@ -8,6 +8,10 @@
 
 namespace clad {
 class JacobianModeVisitor : public VectorPushForwardModeVisitor {
+  /// Builds the jacobian of clad::jacobian<clad::opts::reverse_mode>, which
+  /// has the signature of the vector forward mode jacobian but fills every
+  /// row with a call to the pullback of the function.
+  DerivativeAndOverload DeriveUsingReverseMode();
 
 public:
   JacobianModeVisitor(DerivativeBuilder& builder, const DiffRequest& request);
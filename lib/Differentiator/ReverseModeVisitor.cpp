@@ -54,10 +54,14 @@
 #include "clang/Sema/Template.h"
 
 #include "llvm/ADT/APSInt.h"
+#include "llvm/ADT/FoldingSet.h"
+#include "llvm/ADT/MapVector.h"
 #include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/SmallString.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/Support/Casting.h"
+#include "llvm/Support/MathExtras.h"
 #include "llvm/Support/SaveAndRestore.h"
 #include "llvm/Support/raw_ostream.h"
 
@@ -100,35 +104,125 @@ Expr* ReverseModeVisitor::getStdInitListSizeExpr(const Expr* E) {
                                                   /*AcceptInvalidDecl=*/false)
                         .get();
     // Ref is reused by every push and back call on this tape; clone so each
-    // call owns its tape reference. A local lvalue is required: the single
-    // element is passed as a MultiExprArg, which stores a pointer to it.
-    Expr* RefClone = V.CloneNode(Ref);
+    // call owns its tape reference.
+    llvm::SmallVector<Expr*, 2> Args = {V.CloneNode(Ref)};
+    if (Index)
+      Args.push_back(V.CloneNode(Index));
     Expr* Call =
         V.m_Sema
-            .ActOnCallExpr(V.getCurrentScope(), BackDRE, noLoc, RefClone, noLoc)
+            .ActOnCallExpr(V.getCurrentScope(), BackDRE, noLoc, Args, noLoc)
             .get();
     return Call;
   }
 
   ReverseModeVisitor::CladTapeResult
   ReverseModeVisitor::MakeCladTapeFor(Expr* E, llvm::StringRef prefix,
-                                      clang::QualType type) {
+                                      clang::QualType type, bool packed) {
     assert(E && "must be provided");
     E = E->IgnoreImplicit();
     if (type.isNull())
       type = E->getType();
     type.removeLocalConst();
     QualType TapeType = GetCladTapeOfType(type);
+    Expr* TapeInit = nullptr;
+    Expr* Index = nullptr;
+    VarDecl* VD = nullptr;
     LookupResult& Push = GetCladTapePush();
     LookupResult& Pop = GetCladTapePop();
 
-    // Threadprivate tapes must be static
-    StorageClass SC = isInsideOMPBlock ? SC_Static : SC_None;
-    Expr* TapeRef = BuildDeclRef(
-        GlobalStoreImpl(TapeType, prefix, getZeroInit(TapeType), SC));
-    auto* VD = cast<VarDecl>(cast<DeclRefExpr>(TapeRef)->getDecl());
+    // Values saved directly in the body of a loop with a known trip count go
+    // to the slot of the current iteration in a buffer sized before the loop:
+    //   clad::fixed_tape<double> _t1 = {};
+    //   _t1.reserve(clad::trip_count(0, n, 1, false));
+    //   for (i = 0; i < n; i++) {
+    //     _t0++;
+    //     clad::push(_t1, _t0 - 1, x);
+    // Both sweeps increment the counter before the body of an iteration.
+    if (m_FixedTapeLoop && type->isScalarType()) {
+      TapeType = utils::InstantiateTemplate(
+          m_Sema,
+          utils::LookupTemplateDeclInCladNamespace(m_Sema, "fixed_tape"),
+          {type});
+      TapeInit = getZeroInit(TapeType);
+      Index = BuildOp(
+          BO_Sub, m_FixedTapeLoop->Counter.cloneRef(),
+          ConstantFolder::synthesizeLiteral(m_Context.IntTy, m_Context, 1));
+    } else if (m_FusedTapeLoop && type->isScalarType()) {
+      // Values saved in the body of a fused loop are fields of the record of
+      // the current iteration:
+      //   clad::record_tape _t1 = {16};
+      //   for (...) {
+      //     _t1.emplace_back();
+      //     clad::push(_t1, clad::record_field<double>(0), x);
+      //     clad::push(_t1, clad::record_field<int>(8), i);
+      // The size of the record is set once the whole body is visited.
+      if (!m_FusedTapeLoop->Tape) {
+        QualType RecordTapeType = utils::GetRecordTapeType(m_Sema);
+        m_FusedTapeLoop->Tape =
+            GlobalStoreImpl(RecordTapeType, "_t",
+                            getZeroInit(RecordTapeType), getTapeStorageClass());
+      }
+      VD = m_FusedTapeLoop->Tape;
+      uint64_t size = m_Context.getTypeSizeInChars(type).getQuantity();
+      uint64_t align = m_Context.getTypeAlignInChars(type).getQuantity();
+      uint64_t offset = llvm::alignTo(m_FusedTapeLoop->Size, align);
+      m_FusedTapeLoop->Size = offset + size;
+      m_FusedTapeLoop->Align = std::max(m_FusedTapeLoop->Align, align);
+      QualType FieldType = utils::InstantiateTemplate(
+          m_Sema,
+          utils::LookupTemplateDeclInCladNamespace(m_Sema, "record_field"),
+          {type});
+      Expr* OffsetLiteral =
+          ConstantFolder::synthesizeLiteral(m_Context.IntTy, m_Context, offset);
+      Index = m_Sema
+                  .BuildCXXTypeConstructExpr(
+                      m_Context.getTrivialTypeSourceInfo(FieldType, noLoc),
+                      noLoc, OffsetLiteral, noLoc,
+                      /*ListInitialization=*/false)
+                  .get();
+    } else if (packed && !m_DiffReq.UseTapeArena && !isInsideOMPBlock &&
+               GetCladTapeDecl() ==
+                   utils::LookupTemplateDeclInCladNamespace(m_Sema, "tape")) {
+      // Conditions and small numbers take a few bits each:
+      //   clad::bit_tape _cond0 = {};
+      //   clad::push(_cond0, x > 0);
+      // Custom, arena and threadprivate tapes store them as they are.
+      TapeType = utils::GetBitTapeType(m_Sema);
+      TapeInit = getZeroInit(TapeType);
+    } else if (m_DiffReq.UseTapeArena && !isInsideOMPBlock &&
+               GetCladTapeDecl() ==
+                   utils::LookupTemplateDeclInCladNamespace(m_Sema, "tape")) {
+      // With clad::opts::use_tape_arena all tapes of the derivative share a
+      // single arena, declared before the first of them:
+      //   clad::tape_arena _arena0 = {};
+      //   clad::arena_tape<double> _t0 = {_arena0};
+      // Custom tapes and threadprivate tapes keep their own storage.
+      if (!m_TapeArena) {
+        QualType ArenaType = utils::GetTapeArenaType(m_Sema);
+        m_TapeArena = GlobalStoreImpl(ArenaType, "_arena",
+                                      getZeroInit(ArenaType),
+                                      getTapeStorageClass());
+        m_TapeArena->setLocation(m_DiffReq->getLocation());
+        if (shouldReuseTapes())
+          m_TapeArena->setTSCSpec(TSCS_thread_local);
+      }
+      TapeType = utils::InstantiateTemplate(
+          m_Sema,
+          utils::LookupTemplateDeclInCladNamespace(m_Sema, "arena_tape"),
+          {type});
+      Expr* ArenaRef = BuildDeclRef(m_TapeArena);
+      TapeInit = m_Sema.ActOnInitList(noLoc, ArenaRef, noLoc).get();
+    } else {
+      TapeInit = getZeroInit(TapeType);
+    }
+
+    if (!VD)
+      VD = GlobalStoreImpl(TapeType, prefix, TapeInit, getTapeStorageClass());
+    Expr* TapeRef = BuildDeclRef(VD);
     // Add fake location, since Clang AST does assert(Loc.isValid()) somewhere.
     VD->setLocation(m_DiffReq->getLocation());
+    if (shouldReuseTapes())
+      VD->setTSCSpec(TSCS_thread_local);
 
     CXXScopeSpec CSS;
     CSS.Extend(m_Context, utils::GetCladNamespace(m_Sema), noLoc, noLoc);
@@ -140,19 +234,69 @@ Expr* ReverseModeVisitor::getStdInitListSizeExpr(const Expr* E) {
                         .BuildDeclarationNameExpr(CSS, Push,
                                                   /*AcceptInvalidDecl=*/false)
                         .get();
-    Expr* PopExpr =
-        m_Sema.ActOnCallExpr(getCurrentScope(), PopDRE, noLoc, TapeRef, noLoc)
-            .get();
     // pop, push and the returned last-ref each get their own tape DeclRef so
     // the same node is not parented by both the push and pop CallExprs.
-    Expr* CallArgs[] = {CloneNode(TapeRef), E};
+    llvm::SmallVector<Expr*, 2> PopArgs = {TapeRef};
+    llvm::SmallVector<Expr*, 3> PushArgs = {CloneNode(TapeRef)};
+    if (Index) {
+      PopArgs.push_back(Index);
+      PushArgs.push_back(CloneNode(Index));
+      if (m_FixedTapeLoop)
+        m_FixedTapeLoop->Tapes.push_back(VD);
+    }
+    // The stored value must stay the last argument of push, see
+    // DelayedStoreResult::Finalize.
+    PushArgs.push_back(E);
+    Expr* PopExpr =
+        m_Sema.ActOnCallExpr(getCurrentScope(), PopDRE, noLoc, PopArgs, noLoc)
+            .get();
     Expr* PushExpr =
-        m_Sema.ActOnCallExpr(getCurrentScope(), PushDRE, noLoc, CallArgs, noLoc)
+        m_Sema.ActOnCallExpr(getCurrentScope(), PushDRE, noLoc, PushArgs, noLoc)
             .get();
 
     if (isInsideOMPBlock)
       MarkDeclThreadPrivate(VD);
-    return CladTapeResult{*this, PushExpr, PopExpr, CloneNode(TapeRef)};
+    return CladTapeResult{*this, PushExpr, PopExpr, CloneNode(TapeRef),
+                          Index ? CloneNode(Index) : nullptr};
+  }
+
+  StmtDiff ReverseModeVisitor::MakeCladBulkStoreFor(Expr* E,
+                                                    llvm::StringRef prefix) {
+    const ConstantArrayType* CAT = m_Context.getAsConstantArrayType(
+        clad_compat::stripPredefinedSugar(E->getType()));
+    if (!CAT || CAT->getElementType()->isArrayType())
+      return {};
+    QualType ElemTy = CAT->getElementType();
+    if (!ElemTy.isTriviallyCopyableType(m_Context))
+      return {};
+    // User-provided tapes are not required to implement the bulk operations.
+    if (GetCladTapeDecl() !=
+        utils::LookupTemplateDeclInCladNamespace(m_Sema, "tape"))
+      return {};
+    // Arena tapes store arrays as single records instead.
+    if (m_DiffReq.UseTapeArena)
+      return {};
+
+    QualType TapeType = GetCladTapeOfType(ElemTy.getUnqualifiedType());
+    VarDecl* VD = GlobalStoreImpl(TapeType, prefix, getZeroInit(TapeType),
+                                  getTapeStorageClass());
+    // Add fake location, since Clang AST does assert(Loc.isValid()) somewhere.
+    VD->setLocation(m_DiffReq->getLocation());
+    if (isInsideOMPBlock)
+      MarkDeclThreadPrivate(VD);
+    else if (shouldReuseTapes())
+      VD->setTSCSpec(TSCS_thread_local);
+
+    uint64_t N = CAT->getSize().getZExtValue();
+    llvm::SmallVector<Expr*, 3> pushArgs = {
+        BuildDeclRef(VD), Clone(E),
+        ConstantFolder::synthesizeLiteral(m_Context.IntTy, m_Context, N)};
+    Expr* Push = GetFunctionCall("push_n", "clad", pushArgs);
+    llvm::SmallVector<Expr*, 3> popArgs = {
+        BuildDeclRef(VD), Clone(E),
+        ConstantFolder::synthesizeLiteral(m_Context.IntTy, m_Context, N)};
+    Expr* Pop = GetFunctionCall("pop_n", "clad", popArgs);
+    return {Push, Pop};
   }
 
   bool ReverseModeVisitor::shouldUseCudaAtomicOps(const Expr* E) {
@@ -357,7 +501,6 @@ Expr* ReverseModeVisitor::getStdInitListSizeExpr(const Expr* E) {
       } else {
         DifferentiateWithClad();
       }
-
       Stmt* fnBody = endBlock();
       m_Derivative->setBody(fnBody);
       // FIXME: Enable this when we vgvassilev/clad#367 (removing goto stmts).
@@ -500,9 +643,16 @@ Expr* ReverseModeVisitor::getStdInitListSizeExpr(const Expr* E) {
     Stmt* Forward = BodyDiff.getStmt();
     Stmt* Reverse = BodyDiff.getStmt_dx();
     // Create the body of the function.
+    // A reentrant call must not share the reused tapes, see
+    // BuildTapeReentryGuard.
+    Stmt* reuseGuard = nullptr;
+    if (m_DiffReq.Mode == DiffMode::reverse && shouldReuseTapes())
+      reuseGuard = BuildTapeReentryGuard();
     // Firstly, all "global" Stmts are put into fn's body.
     for (Stmt* S : m_Globals)
       addToCurrentBlock(S, direction::forward);
+    if (reuseGuard)
+      addToCurrentBlock(reuseGuard, direction::forward);
     // Forward pass.
     if (auto* CS = dyn_cast_or_null<CompoundStmt>(Forward))
       for (Stmt* S : CS->body())
@@ -1192,8 +1342,20 @@ Expr* ReverseModeVisitor::getStdInitListSizeExpr(const Expr* E) {
             utils::unwrapIfSingleStmt(Reverse)};
   }
 
+  static bool isVectorizableReverseLoop(ASTContext& C, const Stmt* body,
+                                        const VarDecl* IV);
+
   StmtDiff ReverseModeVisitor::VisitForStmt(const ForStmt* FS) {
     beginBlock(direction::reverse);
+    // Only outermost loops run once per call, so only their trip count bounds
+    // the values saved in their body.
+    Expr* tripCount = nullptr;
+    if (m_DiffReq.UseFixedTapes && !isInsideLoop &&
+        !m_IsInsideCheckpointedLoop && !isInsideOMPBlock &&
+        !m_DiffReq.UseTapeArena &&
+        GetCladTapeDecl() ==
+            utils::LookupTemplateDeclInCladNamespace(m_Sema, "tape"))
+      tripCount = BuildLoopTripCount(FS);
     LoopCounter loopCounter(*this);
     ScopeRAII forScope(*this, Scope::DeclScope | Scope::ControlScope |
                                   Scope::BreakScope | Scope::ContinueScope);
@@ -1206,6 +1368,7 @@ Expr* ReverseModeVisitor::getStdInitListSizeExpr(const Expr* E) {
     StmtDiff initResult = init ? DifferentiateSingleStmt(init) : StmtDiff{};
 
     // Save the isInsideLoop value (we may be inside another loop).
+    bool isOutermostLoop = !isInsideLoop;
     llvm::SaveAndRestore<bool> SaveIsInsideLoop(isInsideLoop);
     isInsideLoop = true;
     StmtDiff condVarRes;
@@ -1245,9 +1408,20 @@ Expr* ReverseModeVisitor::getStdInitListSizeExpr(const Expr* E) {
     }
 
     const Stmt* body = FS->getBody();
+    FixedTapeLoop fixedTapeLoop{loopCounter, tripCount, {}};
+    if (tripCount)
+      m_FixedTapeLoop = &fixedTapeLoop;
     StmtDiff BodyDiff = DifferentiateLoopBody(
         body, loopCounter, condVarRes.getStmt_dx(), incDiff.getStmt_dx(),
-        /*isForLoop=*/true, FS->getForLoc());
+        /*isForLoop=*/true, FS->getForLoc(), FS);
+    m_FixedTapeLoop = nullptr;
+    // Size the fixed tapes once, before the loop starts.
+    for (VarDecl* tape : fixedTapeLoop.Tapes) {
+      llvm::SmallVector<Expr*, 1> args = {CloneNode(tripCount)};
+      addToCurrentBlock(
+          BuildCallExprToMemFn(BuildDeclRef(tape), "reserve", args),
+          direction::forward);
+    }
 
     /// FIXME: This part in necessary to replace local variables inside loops
     /// with function globals and replace initializations with assignments.
@@ -1343,6 +1517,38 @@ Expr* ReverseModeVisitor::getStdInitListSizeExpr(const Expr* E) {
           ForStmt(m_Context, revInit, CounterCondition, nullptr,
                   CounterDecrement, BodyDiff.getStmt_dx(), noLoc, noLoc, noLoc);
 
+    VarDecl* IV = nullptr;
+    if (auto* DS = dyn_cast_or_null<DeclStmt>(initResult.getStmt())) {
+      if (DS->isSingleDecl())
+        IV = dyn_cast<VarDecl>(DS->getSingleDecl());
+    } else if (auto* BO = dyn_cast_or_null<BinaryOperator>(
+                   initResult.getStmt())) {
+      if (BO->getOpcode() == BO_Assign)
+        if (auto* DRE =
+                dyn_cast<DeclRefExpr>(BO->getLHS()->IgnoreParenImpCasts()))
+          IV = dyn_cast<VarDecl>(DRE->getDecl());
+    }
+    // Turn the scatters of stencil-like reverse loops into gathers.
+    Stmt* Gather = nullptr;
+    if (Reverse && IV && isOutermostLoop && !isInsideOMPBlock &&
+        !m_IsInsideCheckpointedLoop)
+      Gather = BuildGatherLoop(cast<ForStmt>(Forward), cast<ForStmt>(Reverse),
+                               IV);
+    if (Gather) {
+      Reverse = Gather;
+    } else if (Reverse && IV && IV->getType()->isIntegerType() &&
+               !m_Context.getLangOpts().CUDA &&
+               isVectorizableReverseLoop(m_Context, BodyDiff.getStmt_dx(),
+                                         IV)) {
+      // Tell the compiler that the iterations of elementwise reverse loops do
+      // not depend on each other, since it cannot prove that the adjoint
+      // arrays do not overlap.
+      const Attr* hint = LoopHintAttr::CreateImplicit(
+          m_Context, LoopHintAttr::Vectorize, LoopHintAttr::AssumeSafety,
+          /*Value=*/nullptr);
+      Reverse = AttributedStmt::Create(m_Context, noLoc, {hint}, Reverse);
+    }
+
     addToCurrentBlock(initResult.getStmt_dx(), direction::reverse);
     addToCurrentBlock(Reverse, direction::reverse);
     Reverse = endBlock(direction::reverse);
@@ -1511,6 +1717,20 @@ Expr* ReverseModeVisitor::getStdInitListSizeExpr(const Expr* E) {
     // increment owns its subtree without orphaning an eager clone of the seed.
     if (shouldUseCudaAtomicOps(base))
       return BuildCallToCudaAtomicAdd(E, dfdx());
+    // Inside an OpenMP loop, `_d_x[idx] += dfdx` becomes
+    // `_d_x_priv.at(idx) += dfdx` if other threads may update `_d_x[idx]`.
+    if (!m_OMPAdjointBuffers.empty())
+      if (auto* ASE = dyn_cast<ArraySubscriptExpr>(E))
+        if (auto* DRE =
+                dyn_cast<DeclRefExpr>(ASE->getBase()->IgnoreImpCasts())) {
+          auto it = m_OMPAdjointBuffers.find(dyn_cast<VarDecl>(DRE->getDecl()));
+          if (it != m_OMPAdjointBuffers.end()) {
+            llvm::SmallVector<Expr*, 1> args = {ASE->getIdx()};
+            Expr* elem =
+                BuildCallExprToMemFn(BuildDeclRef(it->second), "at", args);
+            return BuildOp(BO_AddAssign, elem, dfdx());
+          }
+        }
     return BuildOp(BO_AddAssign, E, dfdx());
   }
 
@@ -2013,6 +2233,113 @@ Expr* ReverseModeVisitor::getStdInitListSizeExpr(const Expr* E) {
     return {buildClonedLambda(LE), lambdaE};
   }
 #endif // CLANG_VERSION_MAJOR
+
+  /// \returns true if objects of type \p T may refer to other memory, which
+  /// a bitwise copy of the object does not save.
+  static bool containsIndirection(QualType T) {
+    T = T.getCanonicalType();
+    if (T->isPointerType() || T->isReferenceType() ||
+        T->isMemberPointerType() || T->isBlockPointerType())
+      return true;
+    if (const ArrayType* AT = T->getAsArrayTypeUnsafe())
+      return containsIndirection(AT->getElementType());
+    const auto* RD = T->getAsCXXRecordDecl();
+    if (!RD)
+      return false;
+    if (!RD->hasDefinition())
+      return true;
+    for (const CXXBaseSpecifier& base : RD->bases())
+      if (containsIndirection(base.getType()))
+        return true;
+    for (const FieldDecl* field : RD->fields())
+      if (containsIndirection(field->getType()))
+        return true;
+    return false;
+  }
+
+  /// Finds whether a function, or a function it calls, may touch memory other
+  /// than what is reachable from its parameters: variables with static
+  /// storage, indirect calls, or calls to functions whose body is not
+  /// available.
+  class NonLocalEffectsFinder
+      : public RecursiveASTVisitor<NonLocalEffectsFinder> {
+    llvm::SmallPtrSet<const FunctionDecl*, 8> m_Visited;
+
+  public:
+    bool m_Found = false;
+
+    bool VisitDeclRefExpr(DeclRefExpr* DRE) {
+      if (const auto* VD = dyn_cast<VarDecl>(DRE->getDecl()))
+        if (VD->hasGlobalStorage() && !VD->getType().isConstQualified())
+          m_Found = true;
+      return !m_Found;
+    }
+    bool VisitDeclStmt(DeclStmt* DS) {
+      for (const Decl* D : DS->decls())
+        if (const auto* VD = dyn_cast<VarDecl>(D))
+          if (VD->isStaticLocal() && !VD->getType().isConstQualified())
+            m_Found = true;
+      return !m_Found;
+    }
+    bool VisitCallExpr(CallExpr* CE) {
+      const FunctionDecl* FD = CE->getDirectCallee();
+      if (!FD)
+        m_Found = true;
+      else
+        check(FD);
+      return !m_Found;
+    }
+    bool VisitCXXConstructExpr(CXXConstructExpr* CCE) {
+      check(CCE->getConstructor());
+      return !m_Found;
+    }
+    void check(const FunctionDecl* FD) {
+      if (m_Found || !m_Visited.insert(FD).second)
+        return;
+      // Builtins, e.g. the math functions, only compute values, and trivial
+      // special members only copy their arguments.
+      if (FD->getBuiltinID() || FD->isTrivial())
+        return;
+      const FunctionDecl* def = nullptr;
+      if (!FD->hasBody(def)) {
+        m_Found = true;
+        return;
+      }
+      TraverseStmt(def->getBody());
+    }
+  };
+
+  /// Collects in \p inputs the memory a checkpointed call may overwrite
+  /// through the argument \p arg passed as \p paramTy. \returns false if that
+  /// memory cannot be saved as a whole, e.g. through a pointer into a buffer of
+  /// unknown size or an object that holds pointers.
+  static bool collectCallInput(ASTContext& C, QualType paramTy, Expr* arg,
+                               llvm::SmallVectorImpl<Expr*>& inputs) {
+    QualType pointeeTy;
+    if (paramTy->isReferenceType())
+      pointeeTy = paramTy.getNonReferenceType();
+    else if (paramTy->isPointerType())
+      pointeeTy = paramTy->getPointeeType();
+    else
+      // A copy passed by value only exposes memory through its pointers.
+      return !containsIndirection(paramTy);
+    // The callee may write through the pointers even if the object is const.
+    if (containsIndirection(pointeeTy))
+      return false;
+    if (pointeeTy.isConstQualified())
+      return true;
+    // Real numbers passed by reference are stored by DifferentiateCallArg.
+    if (paramTy->isReferenceType() && pointeeTy->isRealType())
+      return true;
+    Expr* E = arg->IgnoreImpCasts();
+    if (paramTy->isPointerType() && !C.getAsConstantArrayType(E->getType()))
+      return false;
+    if (!E->isLValue() || !E->getType().isTriviallyCopyableType(C))
+      return false;
+    inputs.push_back(E);
+    return true;
+  }
+
   StmtDiff ReverseModeVisitor::VisitCallExpr(const CallExpr* CE) {
     // FIXME: Add general support for non-direct calls
     const Expr* callee = CE->getCallee();
@@ -2139,6 +2466,26 @@ Expr* ReverseModeVisitor::getStdInitListSizeExpr(const Expr* E) {
       }
     }
 
+    // A call to a callee annotated with `checkpoint` saves only the inputs the
+    // callee may overwrite and runs the primal function. The pullback re-runs
+    // the callee from the restored inputs, so none of its writes are recorded.
+    bool checkpointCall = utils::hasCheckpointAttribute(FD);
+    bool canCheckpoint = true;
+    llvm::SmallVector<Expr*, 4> checkpointInputs;
+    // Why the call cannot be checkpointed, if it cannot.
+    llvm::StringRef noCheckpointReason;
+    if (checkpointCall) {
+      NonLocalEffectsFinder finder;
+      finder.check(FD);
+      if (finder.m_Found)
+        noCheckpointReason = "the callee may access memory other than its "
+                             "arguments";
+      // The fixed-size GPU restore_tracker cannot hold whole objects.
+      else if (m_Context.getLangOpts().CUDA)
+        noCheckpointReason = "checkpoints are not supported in CUDA code";
+      canCheckpoint = noCheckpointReason.empty();
+    }
+
     // FIXME: consider moving non-diff analysis to DiffPlanner.
     bool nonDiff = clad::utils::hasNonDifferentiableAttribute(CE);
     // If the result does not depend on the result of the call, just clone
@@ -2258,6 +2605,16 @@ Expr* ReverseModeVisitor::getStdInitListSizeExpr(const Expr* E) {
           baseDiff = Visit(baseOriginalE);
         Expr* baseExpr = baseDiff.getExpr();
         CallArgs.push_back(baseExpr);
+        if (checkpointCall && !MD->isConst()) {
+          // The implicit object is a single object even if passed by pointer.
+          QualType objTy = m_Context.getLValueReferenceType(
+              MD->getThisType()->getPointeeType());
+          Expr* obj = baseExpr->getType()->isPointerType()
+                          ? BuildOp(UO_Deref, CloneNode(baseExpr))
+                          : baseExpr;
+          canCheckpoint &=
+              collectCallInput(m_Context, objTy, obj, checkpointInputs);
+        }
         if (isPassedByRef && !MD->isConst() &&
             m_DiffReq.shouldBeRecorded(baseOriginalE)) {
           hasStoredParams = true;
@@ -2322,6 +2679,9 @@ Expr* ReverseModeVisitor::getStdInitListSizeExpr(const Expr* E) {
         }
       }
       CallArgs.push_back(finalArg);
+      if (checkpointCall)
+        canCheckpoint &= collectCallInput(m_Context, PVD->getType(), finalArg,
+                                          checkpointInputs);
 
       // finalArg is already in CallArgs (the forward primal call); clone so the
       // reverse-forward call does not share the same argument node.
@@ -2528,48 +2888,81 @@ Expr* ReverseModeVisitor::getStdInitListSizeExpr(const Expr* E) {
       return {call, call_dx};
     }
 
-    if (calleeFnForwPassFD && !hasDynamicNonDiffParams &&
-        (hasStoredParams || needsForwPass)) {
+    // Build the restore_tracker for the call
+    // ```
+    // clad::restore_tracker _tracker0 = {};
+    // f_reverse_forw(..., _tracker0);
+    // ...
+    // _tracker0.restore();
+    // ```
+    auto getRestoreTracker = [&]() -> Expr* {
+      if (m_RestoreTracker)
+        // If the current function already has a restore tracker (i.e. a
+        // reverse_forw is being built), just propagate the restore_tracker.
+        // ```
+        // f_reverse_forw(..., clad::restore_tracker& _tracker0) {
+        //   g_reverse_forw(..., _tracker0); // do not generate a new tracker
+        // ```
+        return m_RestoreTracker;
+      // Otherwise, generate the declaration
+      // ``clad::restore_tracker _tracker0 = {};``
+      VarDecl* trackerDecl =
+          BuildVarDecl(trackerType, "_tracker", getZeroInit(trackerType));
+      addToCurrentBlock(BuildDeclStmt(trackerDecl));
+      Expr* restoreCall = BuildCallExprToMemFn(
+          BuildDeclRef(trackerDecl), /*MemberFunctionName=*/"restore",
+          /*ArgExprs=*/{}, Loc);
+      it = std::begin(block) + insertionPoint;
+      block.insert(it, restoreCall);
+      return BuildDeclRef(trackerDecl);
+    };
+
+    bool needsReverseForw = calleeFnForwPassFD && !hasDynamicNonDiffParams &&
+                            (hasStoredParams || needsForwPass);
+    if (needsReverseForw && checkpointCall) {
+      if (noCheckpointReason.empty()) {
+        if (!canCheckpoint)
+          noCheckpointReason = "an argument is not an object or an array of "
+                               "known size without pointers";
+        else if (!usingRestoreTracker || needsForwPass)
+          noCheckpointReason = "the callee returns memory";
+      }
+      if (noCheckpointReason.empty()) {
+        // Save the inputs as a whole and call the primal function:
+        // ```
+        // clad::restore_tracker _tracker0 = {};
+        // _tracker0.store(cell);
+        // update(cell, dt);
+        // ...
+        // _tracker0.restore();
+        // update_pullback(cell, dt, &_d_cell, &_r0);
+        // ```
+        if (!checkpointInputs.empty()) {
+          Expr* trackerExpr = getRestoreTracker();
+          for (Expr* input : checkpointInputs)
+            addToCurrentBlock(BuildCallExprToMemFn(
+                CloneNode(trackerExpr), /*MemberFunctionName=*/"store",
+                {CloneNode(input)}));
+        }
+        needsReverseForw = false;
+      } else {
+        diag(DiagnosticsEngine::Warning, Loc,
+             "cannot checkpoint this call, %0; the values the callee "
+             "overwrites are recorded instead")
+            << noCheckpointReason << Loc;
+      }
+    }
+
+    if (needsReverseForw) {
       if (const auto* CD = dyn_cast<CXXConversionDecl>(FD))
         CallArgs.push_back(
             utils::GetCladTagExpr(m_Sema, CD->getConversionType()));
       CallArgs.insert(CallArgs.end(), revForwAdjointArgs.begin(),
                       revForwAdjointArgs.end());
-      // Build the restore_tracker parameter
-      // ```
-      // clad::restore_tracker _tracker0 = {};
-      // f_reverse_forw(..., _tracker0);
-      // ...
-      // _tracker0.restore();
-      // ```
-      Expr* trackerExpr = nullptr;
-      if (usingRestoreTracker) {
-        if (m_RestoreTracker) {
-          // If the current function already has a restore tracker (i.e. a
-          // reverse_forw is being built), just propagate the restore_tracker.
-          // ```
-          // f_reverse_forw(..., clad::restore_tracker& _tracker0) {
-          //   g_reverse_forw(..., _tracker0); // do not generate a new tracker
-          // ```
-          trackerExpr = m_RestoreTracker;
-        } else {
-          // Otherwise, generate the declaration
-          // ``clad::restore_tracker _tracker0 = {};``
-          VarDecl* trackerDecl =
-              BuildVarDecl(trackerType, "_tracker", getZeroInit(trackerType));
-          addToCurrentBlock(BuildDeclStmt(trackerDecl));
-          trackerExpr = BuildDeclRef(trackerDecl);
-          Expr* restoreCall = BuildCallExprToMemFn(
-              BuildDeclRef(trackerDecl), /*MemberFunctionName=*/"restore",
-              /*ArgExprs=*/{}, Loc);
-          it = std::begin(block) + insertionPoint;
-          block.insert(it, restoreCall);
-        }
-      }
       // Add the tracker as the last argument of the reverse_forw. A propagated
       // m_RestoreTracker is reused across nested reverse_forw calls; clone it.
-      if (trackerExpr)
-        CallArgs.push_back(CloneNode(trackerExpr));
+      if (usingRestoreTracker)
+        CallArgs.push_back(CloneNode(getRestoreTracker()));
       call =
           BuildCallExprToFunction(calleeFnForwPassFD, CallArgs, CUDAExecConfig);
       if (!needsForwPass ||
@@ -3918,7 +4311,8 @@ Expr* ReverseModeVisitor::getStdInitListSizeExpr(const Expr* E) {
       return E;
 
     if (isInsideLoop) {
-      CladTapeResult CladTape = MakeCladTapeFor(E, prefix, Type);
+      CladTapeResult CladTape =
+          MakeCladTapeFor(E, prefix, Type, Type->isBooleanType());
       addToCurrentBlock(CladTape.Push, direction::forward);
       addToCurrentBlock(CladTape.Pop, direction::reverse);
 
@@ -3972,6 +4366,12 @@ Expr* ReverseModeVisitor::getStdInitListSizeExpr(const Expr* E) {
     Expr* Pop = nullptr;
     Expr* Ref = nullptr;
     if (isInsideLoop) {
+      // Arrays are saved with a single span copy when possible.
+      if (isa<ArrayType>(Type)) {
+        StmtDiff BulkStore = MakeCladBulkStoreFor(E, prefix);
+        if (BulkStore.getStmt())
+          return BulkStore;
+      }
       Expr* clone = Clone(E);
       if (moveToTape && Type->isRecordType()) {
         llvm::SmallVector<Expr*, 1> args = {clone};
@@ -4181,6 +4581,10 @@ Expr* ReverseModeVisitor::getStdInitListSizeExpr(const Expr* E) {
     m_Ref = m_RMV.GlobalStoreAndRef(m_RMV.getZeroInit(C.IntTy),
                                     clad_compat::getSizeType(C), "_t",
                                     /*force=*/true);
+    m_EnclosingFixedTapeLoop = m_RMV.m_FixedTapeLoop;
+    m_RMV.m_FixedTapeLoop = nullptr;
+    m_EnclosingFusedTapeLoop = m_RMV.m_FusedTapeLoop;
+    m_RMV.m_FusedTapeLoop = nullptr;
   }
 
   StmtDiff ReverseModeVisitor::VisitWhileStmt(const WhileStmt* WS) {
@@ -4229,7 +4633,7 @@ Expr* ReverseModeVisitor::getStdInitListSizeExpr(const Expr* E) {
     StmtDiff bodyDiff =
         DifferentiateLoopBody(body, loopCounter, condVarRes.getStmt_dx(),
                               /*forLoopIncDiff=*/nullptr,
-                              /*isForLoop=*/false, WS->getWhileLoc());
+                              /*isForLoop=*/false, WS->getWhileLoc(), WS);
     // Create forward-pass `while` loop.
     Stmt* forwardWS =
         m_Sema
@@ -4270,7 +4674,7 @@ Expr* ReverseModeVisitor::getStdInitListSizeExpr(const Expr* E) {
     StmtDiff bodyDiff =
         DifferentiateLoopBody(body, loopCounter, /*condVarDiff=*/nullptr,
                               /*forLoopIncDiff=*/nullptr,
-                              /*isForLoop=*/false, DS->getDoLoc());
+                              /*isForLoop=*/false, DS->getDoLoc(), DS);
 
     // Create forward-pass `do-while` statement.
     Stmt* forwardDS = m_Sema
@@ -4546,8 +4950,13 @@ Expr* ReverseModeVisitor::getStdInitListSizeExpr(const Expr* E) {
     return inner;
   }
 
+  /// \returns true if the loop at \p loopLoc is marked with
+  /// `#pragma clad checkpoint loop`. \p snapshots is set to the budget given
+  /// by `snapshots(S)`, or 0.
   static bool hasCheckpointingPragma(ASTContext& C, SourceLocation loopLoc,
-                                     const DiffRequest& request) {
+                                     const DiffRequest& request,
+                                     unsigned& snapshots) {
+    snapshots = 0;
     if (!loopLoc.isValid())
       return false;
 
@@ -4556,28 +4965,863 @@ Expr* ReverseModeVisitor::getStdInitListSizeExpr(const Expr* E) {
     for (const auto& entry : request.m_CladLoopCheckpoints) {
       if (!entry.second.isValid())
         continue;
-      if (SM.getExpansionLoc(entry.second) == expandedLoopLoc)
+      if (SM.getExpansionLoc(entry.second) == expandedLoopLoc) {
+        auto it = request.m_CladLoopSnapshots.find(entry.first);
+        if (it != request.m_CladLoopSnapshots.end())
+          snapshots = it->second;
         return true;
+      }
     }
     return false;
   }
 
+  namespace {
+  /// Collects the variables a statement may change: every reference to a
+  /// variable that is not immediately read as an rvalue.
+  class WrittenVarsFinder : public RecursiveASTVisitor<WrittenVarsFinder> {
+    std::set<const DeclRefExpr*> m_Reads;
+
+  public:
+    std::set<const VarDecl*> m_Written;
+
+    bool VisitImplicitCastExpr(ImplicitCastExpr* ICE) {
+      if (ICE->getCastKind() == CK_LValueToRValue)
+        if (const auto* DRE =
+                dyn_cast<DeclRefExpr>(ICE->getSubExpr()->IgnoreParens()))
+          m_Reads.insert(DRE);
+      return true;
+    }
+
+    bool VisitDeclRefExpr(DeclRefExpr* DRE) {
+      if (const auto* VD = dyn_cast<VarDecl>(DRE->getDecl()))
+        if (!m_Reads.count(DRE))
+          m_Written.insert(VD);
+      return true;
+    }
+  };
+
+  /// Finds the variables whose address escapes, e.g. with `&x`, by binding a
+  /// reference, calling a member function or capturing by reference, so that
+  /// a write through a pointer may change them. Reading, assigning and
+  /// incrementing a variable or a member of it does not expose its address.
+  class EscapedVarsFinder : public RecursiveASTVisitor<EscapedVarsFinder> {
+    std::set<const DeclRefExpr*> m_Accesses;
+    void markAccess(const Expr* E) {
+      E = E->IgnoreParens();
+      if (const auto* ME = dyn_cast<MemberExpr>(E)) {
+        if (!ME->isArrow())
+          markAccess(ME->getBase());
+      } else if (const auto* DRE = dyn_cast<DeclRefExpr>(E)) {
+        m_Accesses.insert(DRE);
+      }
+    }
+
+  public:
+    std::set<const VarDecl*> m_Escaped;
+
+    bool VisitImplicitCastExpr(ImplicitCastExpr* ICE) {
+      if (ICE->getCastKind() == CK_LValueToRValue)
+        markAccess(ICE->getSubExpr());
+      return true;
+    }
+    bool VisitBinaryOperator(BinaryOperator* BO) {
+      if (BO->isAssignmentOp())
+        markAccess(BO->getLHS());
+      return true;
+    }
+    bool VisitUnaryOperator(UnaryOperator* UO) {
+      if (UO->isIncrementDecrementOp())
+        markAccess(UO->getSubExpr());
+      return true;
+    }
+    bool VisitLambdaExpr(LambdaExpr* LE) {
+      for (const LambdaCapture& LC : LE->captures())
+        if (LC.capturesVariable() && LC.getCaptureKind() == LCK_ByRef)
+          if (const auto* VD = dyn_cast<VarDecl>(LC.getCapturedVar()))
+            m_Escaped.insert(VD);
+      return true;
+    }
+    bool VisitDeclRefExpr(DeclRefExpr* DRE) {
+      if (const auto* VD = dyn_cast<VarDecl>(DRE->getDecl()))
+        if (!m_Accesses.count(DRE))
+          m_Escaped.insert(VD);
+      return true;
+    }
+  };
+
+  /// Checks whether an expression reads memory other than named variables,
+  /// e.g. `*p`, `a[k]`, `p->n` or a member of `this`, which a loop may change
+  /// without naming a variable.
+  class MemoryReadFinder : public RecursiveASTVisitor<MemoryReadFinder> {
+  public:
+    bool m_ReadsMemory = false;
+
+    bool VisitUnaryOperator(UnaryOperator* UO) {
+      if (UO->getOpcode() == UO_Deref)
+        m_ReadsMemory = true;
+      return !m_ReadsMemory;
+    }
+    bool VisitArraySubscriptExpr(ArraySubscriptExpr*) {
+      m_ReadsMemory = true;
+      return false;
+    }
+    bool VisitMemberExpr(MemberExpr* ME) {
+      if (ME->isArrow())
+        m_ReadsMemory = true;
+      return !m_ReadsMemory;
+    }
+    bool VisitCXXThisExpr(CXXThisExpr*) {
+      m_ReadsMemory = true;
+      return false;
+    }
+  };
+
+  /// Checks that an expression only reads local variables, other than the
+  /// induction variable, that the loop does not change.
+  class LoopInvariantChecker
+      : public RecursiveASTVisitor<LoopInvariantChecker> {
+    const VarDecl* m_IV;
+    const std::set<const VarDecl*>& m_WrittenInLoop;
+
+  public:
+    bool m_Invariant = true;
+    LoopInvariantChecker(const VarDecl* IV,
+                         const std::set<const VarDecl*>& written)
+        : m_IV(IV), m_WrittenInLoop(written) {}
+
+    bool VisitDeclRefExpr(DeclRefExpr* DRE) {
+      if (const auto* VD = dyn_cast<VarDecl>(DRE->getDecl()))
+        if (VD == m_IV || m_WrittenInLoop.count(VD) ||
+            !VD->hasLocalStorage() || VD->getType()->isReferenceType())
+          m_Invariant = false;
+      return m_Invariant;
+    }
+  };
+
+  /// Finds the variables a loop iteration changes. Only iterations that
+  /// assign local scalar variables directly are supported: writes through
+  /// pointers, references or calls, and jumps out of the iteration clear
+  /// m_Supported.
+  class LoopStateFinder : public RecursiveASTVisitor<LoopStateFinder> {
+    void markWritten(const Expr* E) {
+      const auto* DRE = dyn_cast<DeclRefExpr>(E->IgnoreParens());
+      const auto* VD = DRE ? dyn_cast<VarDecl>(DRE->getDecl()) : nullptr;
+      if (!VD || !VD->hasLocalStorage() || !VD->getType()->isScalarType())
+        m_Supported = false;
+      else
+        m_Written.insert({VD, DRE});
+    }
+
+  public:
+    bool m_Supported = true;
+    llvm::MapVector<const VarDecl*, const DeclRefExpr*> m_Written;
+    /// Variables declared by the iteration itself.
+    std::set<const VarDecl*> m_Local;
+
+    bool VisitVarDecl(VarDecl* VD) {
+      m_Local.insert(VD);
+      return true;
+    }
+    bool VisitBinaryOperator(BinaryOperator* BO) {
+      if (BO->isAssignmentOp())
+        markWritten(BO->getLHS());
+      return m_Supported;
+    }
+    bool VisitUnaryOperator(UnaryOperator* UO) {
+      if (UO->isIncrementDecrementOp())
+        markWritten(UO->getSubExpr());
+      else if (UO->getOpcode() == UO_AddrOf)
+        m_Supported = false;
+      return m_Supported;
+    }
+    bool VisitCallExpr(CallExpr* CE) {
+      const FunctionDecl* FD = CE->getDirectCallee();
+      if (!FD)
+        return m_Supported = false;
+      if (const auto* MD = dyn_cast<CXXMethodDecl>(FD))
+        if (MD->isInstance() && !MD->isConst())
+          return m_Supported = false;
+      for (const ParmVarDecl* PVD : FD->parameters()) {
+        QualType T = PVD->getType();
+        if (utils::isNonConstReferenceType(T) ||
+            (T->isPointerType() && !T->getPointeeType().isConstQualified()))
+          return m_Supported = false;
+      }
+      return true;
+    }
+    bool VisitCXXNewExpr(CXXNewExpr*) { return m_Supported = false; }
+    bool VisitCXXDeleteExpr(CXXDeleteExpr*) { return m_Supported = false; }
+    bool VisitReturnStmt(ReturnStmt*) { return m_Supported = false; }
+    bool VisitBreakStmt(BreakStmt*) { return m_Supported = false; }
+    bool VisitContinueStmt(ContinueStmt*) { return m_Supported = false; }
+    bool VisitGotoStmt(GotoStmt*) { return m_Supported = false; }
+  };
+
+  /// Collects the array accesses of a reverse loop body. Bodies that call
+  /// functions, e.g. to pop tapes, branch, access memory through anything but
+  /// a variable or write anything other than array elements and local scalars
+  /// clear m_Supported.
+  class ReverseLoopAccesses : public RecursiveASTVisitor<ReverseLoopAccesses> {
+    void markWritten(const Expr* E) {
+      E = E->IgnoreParens();
+      if (const auto* ASE = dyn_cast<ArraySubscriptExpr>(E)) {
+        if (const VarDecl* VD = getArray(ASE))
+          m_Written.insert(VD);
+        return;
+      }
+      const auto* DRE = dyn_cast<DeclRefExpr>(E);
+      const auto* VD = DRE ? dyn_cast<VarDecl>(DRE->getDecl()) : nullptr;
+      if (!VD || !VD->hasLocalStorage() || isa<ParmVarDecl>(VD) ||
+          !VD->getType()->isScalarType())
+        m_Supported = false;
+      else
+        m_Modified.insert(VD);
+    }
+    const VarDecl* getArray(const ArraySubscriptExpr* ASE) {
+      return getBase(ASE->getBase());
+    }
+    const VarDecl* getBase(const Expr* E) {
+      const auto* DRE = dyn_cast<DeclRefExpr>(E->IgnoreParenImpCasts());
+      const auto* VD = DRE ? dyn_cast<VarDecl>(DRE->getDecl()) : nullptr;
+      if (!VD)
+        m_Supported = false;
+      return VD;
+    }
+
+  public:
+    bool m_Supported = true;
+    /// The indices each array is accessed with.
+    llvm::MapVector<const VarDecl*, llvm::SmallVector<const Expr*, 4>>
+        m_Indices;
+    llvm::SmallPtrSet<const VarDecl*, 4> m_Written;
+    llvm::SmallPtrSet<const VarDecl*, 8> m_Modified;
+    /// The pointers read through with `*p` or `p->m`.
+    llvm::SmallPtrSet<const VarDecl*, 4> m_Dereferenced;
+
+    bool VisitArraySubscriptExpr(ArraySubscriptExpr* ASE) {
+      if (const VarDecl* VD = getArray(ASE))
+        m_Indices[VD].push_back(ASE->getIdx());
+      return m_Supported;
+    }
+    bool VisitMemberExpr(MemberExpr* ME) {
+      if (ME->isArrow())
+        if (const VarDecl* VD = getBase(ME->getBase()))
+          m_Dereferenced.insert(VD);
+      return m_Supported;
+    }
+    bool VisitBinaryOperator(BinaryOperator* BO) {
+      if (BO->isAssignmentOp())
+        markWritten(BO->getLHS());
+      return m_Supported;
+    }
+    bool VisitUnaryOperator(UnaryOperator* UO) {
+      if (UO->isIncrementDecrementOp())
+        markWritten(UO->getSubExpr());
+      else if (UO->getOpcode() == UO_AddrOf)
+        m_Supported = false;
+      else if (UO->getOpcode() == UO_Deref)
+        if (const VarDecl* VD = getBase(UO->getSubExpr()))
+          m_Dereferenced.insert(VD);
+      return m_Supported;
+    }
+    bool VisitVarDecl(VarDecl* VD) {
+      if (VD->isStaticLocal())
+        m_Supported = false;
+      m_Modified.insert(VD);
+      return m_Supported;
+    }
+    bool VisitCallExpr(CallExpr*) { return m_Supported = false; }
+    bool VisitIfStmt(IfStmt*) { return m_Supported = false; }
+    bool VisitSwitchStmt(SwitchStmt*) { return m_Supported = false; }
+    bool VisitForStmt(ForStmt*) { return m_Supported = false; }
+    bool VisitWhileStmt(WhileStmt*) { return m_Supported = false; }
+    bool VisitDoStmt(DoStmt*) { return m_Supported = false; }
+    bool VisitReturnStmt(ReturnStmt*) { return m_Supported = false; }
+    bool VisitBreakStmt(BreakStmt*) { return m_Supported = false; }
+    bool VisitContinueStmt(ContinueStmt*) { return m_Supported = false; }
+    bool VisitGotoStmt(GotoStmt*) { return m_Supported = false; }
+  };
+  } // namespace
+
+  /// Collects the variables that live across the iterations of \p loop and
+  /// are changed by them, with a reference to each.
+  /// \returns false if an iteration may change anything else, so that it
+  /// cannot be replayed from a snapshot of these variables.
+  static bool
+  collectLoopState(ASTContext& C, const Stmt* loop,
+                   llvm::MapVector<const VarDecl*, const DeclRefExpr*>& state) {
+    LoopStateFinder finder;
+    const Stmt* body = nullptr;
+    // The replayed iteration does not evaluate the condition.
+    if (const auto* FS = dyn_cast<ForStmt>(loop)) {
+      if (FS->getConditionVariable() ||
+          (FS->getCond() && FS->getCond()->HasSideEffects(C)))
+        return false;
+      finder.TraverseStmt(const_cast<Expr*>(FS->getInc()));
+      body = FS->getBody();
+    } else if (const auto* WS = dyn_cast<WhileStmt>(loop)) {
+      if (WS->getConditionVariable() || WS->getCond()->HasSideEffects(C))
+        return false;
+      body = WS->getBody();
+    } else if (const auto* DS = dyn_cast<DoStmt>(loop)) {
+      if (DS->getCond()->HasSideEffects(C))
+        return false;
+      body = DS->getBody();
+    } else {
+      return false;
+    }
+    finder.TraverseStmt(const_cast<Stmt*>(body));
+    if (!finder.m_Supported)
+      return false;
+    for (const auto& entry : finder.m_Written)
+      if (!finder.m_Local.count(entry.first))
+        state.insert(entry);
+    return true;
+  }
+
+  /// \returns true if \p E can be evaluated before the loop to the value it
+  /// has in every iteration.
+  static bool isLoopInvariant(ASTContext& C, const Expr* E, const VarDecl* IV,
+                              const std::set<const VarDecl*>& written) {
+    if (E->HasSideEffects(C))
+      return false;
+    // Any use other than reading the value, e.g. taking the address, is not
+    // supported.
+    WrittenVarsFinder finder;
+    finder.TraverseStmt(const_cast<Expr*>(E));
+    if (!finder.m_Written.empty())
+      return false;
+    LoopInvariantChecker checker(IV, written);
+    checker.TraverseStmt(const_cast<Expr*>(E));
+    return checker.m_Invariant;
+  }
+
+  /// \returns true if the memory of the array \p VD cannot be reached
+  /// through any other variable of the derivative: it is a local array or a
+  /// `__restrict` pointer parameter, see clad::opts::restrict_adjoints.
+  static bool hasDisjointStorage(const VarDecl* VD) {
+    QualType T = VD->getType();
+    if (isa<ParmVarDecl>(VD))
+      return T->isPointerType() && T.isRestrictQualified();
+    return VD->hasLocalStorage() && T->isConstantArrayType();
+  }
+
+  /// \returns true if the iterations of a reverse loop over \p IV with body
+  /// \p body update disjoint array elements, so that they can run in SIMD
+  /// lanes: every array the body writes has disjoint storage and is only
+  /// accessed at one index injective in \p IV, and no other memory is
+  /// written. Bodies accessing a single array are not reported, the compiler
+  /// needs no hint for them.
+  static bool isVectorizableReverseLoop(ASTContext& C, const Stmt* body,
+                                        const VarDecl* IV) {
+    ReverseLoopAccesses accesses;
+    accesses.TraverseStmt(const_cast<Stmt*>(body));
+    if (!accesses.m_Supported || accesses.m_Written.empty() ||
+        accesses.m_Indices.size() < 2)
+      return false;
+    // A local pointer may point into any of the written arrays.
+    auto mayAliasLocal = [](const VarDecl* VD) {
+      return !isa<ParmVarDecl>(VD) && !VD->getType()->isConstantArrayType();
+    };
+    if (llvm::any_of(accesses.m_Dereferenced, mayAliasLocal))
+      return false;
+    for (const auto& entry : accesses.m_Indices) {
+      if (mayAliasLocal(entry.first))
+        return false;
+      if (!accesses.m_Written.count(entry.first))
+        continue;
+      if (!hasDisjointStorage(entry.first))
+        return false;
+      const Expr* first = entry.second.front();
+      if (!utils::isInjective(first, IV, accesses.m_Modified, C))
+        return false;
+      llvm::FoldingSetNodeID firstID;
+      first->IgnoreParenImpCasts()->Profile(firstID, C, /*Canonical=*/true);
+      for (const Expr* idx : entry.second) {
+        llvm::FoldingSetNodeID ID;
+        idx->IgnoreParenImpCasts()->Profile(ID, C, /*Canonical=*/true);
+        if (ID != firstID)
+          return false;
+      }
+    }
+    return true;
+  }
+
+  Expr* ReverseModeVisitor::BuildLoopTripCount(const ForStmt* FS) {
+    const Stmt* init = FS->getInit();
+    const Expr* cond = FS->getCond();
+    const Expr* inc = FS->getInc();
+    if (!init || !cond || !inc || FS->getConditionVariable())
+      return nullptr;
+
+    // Parse init: `int i = a` or `i = a`.
+    const VarDecl* IV = nullptr;
+    const Expr* first = nullptr;
+    if (const auto* DS = dyn_cast<DeclStmt>(init)) {
+      if (DS->isSingleDecl())
+        if ((IV = dyn_cast<VarDecl>(DS->getSingleDecl())))
+          first = IV->getInit();
+    } else if (const auto* BO = dyn_cast<BinaryOperator>(init)) {
+      if (BO->getOpcode() == BO_Assign)
+        if (const auto* DRE =
+                dyn_cast<DeclRefExpr>(BO->getLHS()->IgnoreParenImpCasts())) {
+          IV = dyn_cast<VarDecl>(DRE->getDecl());
+          first = BO->getRHS();
+        }
+    }
+    if (!IV || !first || !IV->hasLocalStorage() ||
+        !IV->getType()->isIntegerType())
+      return nullptr;
+
+    // Parse increment: `++i`, `i++`, `--i`, `i--`, `i += c` or `i -= c`.
+    int64_t step = 0;
+    if (const auto* UO = dyn_cast<UnaryOperator>(inc)) {
+      const auto* DRE =
+          dyn_cast<DeclRefExpr>(UO->getSubExpr()->IgnoreParenImpCasts());
+      if (!DRE || DRE->getDecl() != IV)
+        return nullptr;
+      if (UO->isIncrementOp())
+        step = 1;
+      else if (UO->isDecrementOp())
+        step = -1;
+      else
+        return nullptr;
+    } else if (const auto* CAO = dyn_cast<CompoundAssignOperator>(inc)) {
+      const auto* DRE =
+          dyn_cast<DeclRefExpr>(CAO->getLHS()->IgnoreParenImpCasts());
+      Expr::EvalResult res;
+      if (!DRE || DRE->getDecl() != IV ||
+          !CAO->getRHS()->EvaluateAsInt(res, m_Context))
+        return nullptr;
+      step = res.Val.getInt().getExtValue();
+      if (CAO->getOpcode() == BO_SubAssign)
+        step = -step;
+      else if (CAO->getOpcode() != BO_AddAssign)
+        return nullptr;
+    } else {
+      return nullptr;
+    }
+    if (step == 0)
+      return nullptr;
+
+    // Parse condition: `i op b` or `b op i`.
+    const auto* CO = dyn_cast<BinaryOperator>(cond->IgnoreParenImpCasts());
+    if (!CO)
+      return nullptr;
+    BinaryOperatorKind op = CO->getOpcode();
+    const Expr* last = nullptr;
+    const auto* LDRE =
+        dyn_cast<DeclRefExpr>(CO->getLHS()->IgnoreParenImpCasts());
+    const auto* RDRE =
+        dyn_cast<DeclRefExpr>(CO->getRHS()->IgnoreParenImpCasts());
+    if (LDRE && LDRE->getDecl() == IV) {
+      last = CO->getRHS();
+    } else if (RDRE && RDRE->getDecl() == IV) {
+      last = CO->getLHS();
+      op = BinaryOperator::reverseComparisonOp(op);
+    } else {
+      return nullptr;
+    }
+    bool inclusive = false;
+    if (step > 0 && (op == BO_LT || op == BO_LE))
+      inclusive = op == BO_LE;
+    else if (step < 0 && (op == BO_GT || op == BO_GE))
+      inclusive = op == BO_GE;
+    else if (op != BO_NE || (step != 1 && step != -1))
+      return nullptr;
+
+    // The body, condition and increment must not change the bounds, and only
+    // the increment may change the induction variable. Writes through
+    // pointers may change any variable whose address escapes and any memory,
+    // so the bounds may not read either.
+    WrittenVarsFinder finder;
+    finder.TraverseStmt(const_cast<Stmt*>(FS->getBody()));
+    finder.TraverseStmt(const_cast<Expr*>(cond));
+    EscapedVarsFinder escaped;
+    escaped.TraverseStmt(m_DiffReq->getBody());
+    if (finder.m_Written.count(IV) || escaped.m_Escaped.count(IV))
+      return nullptr;
+    finder.TraverseStmt(const_cast<Expr*>(inc));
+    std::set<const VarDecl*>& written = finder.m_Written;
+    written.insert(escaped.m_Escaped.begin(), escaped.m_Escaped.end());
+    MemoryReadFinder reads;
+    reads.TraverseStmt(const_cast<Expr*>(first));
+    reads.TraverseStmt(const_cast<Expr*>(last));
+    if (reads.m_ReadsMemory ||
+        !isLoopInvariant(m_Context, first, IV, written) ||
+        !isLoopInvariant(m_Context, last, IV, written))
+      return nullptr;
+
+    Expr* stepExpr = ConstantFolder::synthesizeLiteral(
+        m_Context.LongTy, m_Context, step < 0 ? -step : step);
+    if (step < 0)
+      stepExpr = BuildOp(UO_Minus, stepExpr);
+    llvm::SmallVector<Expr*, 4> args = {
+        Clone(first), Clone(last), stepExpr,
+        m_Sema.ActOnCXXBoolLiteral(noLoc, inclusive ? tok::kw_true
+                                                    : tok::kw_false)
+            .get()};
+    return GetFunctionCall("trip_count", "clad", args);
+  }
+
+  /// \returns true if \p E is `IV`, `IV + c`, `c + IV` or `IV - c` for an
+  /// integer constant `c`, stored in \p offset.
+  static bool getOffsetFromIV(ASTContext& C, const Expr* E, const VarDecl* IV,
+                              int64_t& offset) {
+    E = E->IgnoreParenImpCasts();
+    auto isIV = [IV](const Expr* E) {
+      const auto* DRE = dyn_cast<DeclRefExpr>(E->IgnoreParenImpCasts());
+      return DRE && DRE->getDecl() == IV;
+    };
+    if (isIV(E)) {
+      offset = 0;
+      return true;
+    }
+    const auto* BO = dyn_cast<BinaryOperator>(E);
+    if (!BO || (BO->getOpcode() != BO_Add && BO->getOpcode() != BO_Sub))
+      return false;
+    const Expr* c = nullptr;
+    if (isIV(BO->getLHS()))
+      c = BO->getRHS();
+    else if (BO->getOpcode() == BO_Add && isIV(BO->getRHS()))
+      c = BO->getLHS();
+    Expr::EvalResult res;
+    if (!c || !c->EvaluateAsInt(res, C))
+      return false;
+    offset = res.Val.getInt().getExtValue();
+    if (BO->getOpcode() == BO_Sub)
+      offset = -offset;
+    return true;
+  }
+
+  Stmt* ReverseModeVisitor::BuildGatherLoop(ForStmt* Forward,
+                                            ForStmt* Reverse, VarDecl* IV) {
+    // The gather loop starts before the first index, which must not wrap.
+    if (!IV->getType()->isSignedIntegerType() || !Forward->getInit() ||
+        !Forward->getCond() || !Forward->getInc() ||
+        Forward->getConditionVariable() || !Reverse->getBody())
+      return nullptr;
+
+    // Parse the forward loop: `i = a` or `int i = a`, `i < b` or `i <= b`,
+    // and `i++` or `++i`.
+    Expr* first = nullptr;
+    if (auto* BO = dyn_cast<BinaryOperator>(Forward->getInit())) {
+      if (BO->getOpcode() == BO_Assign)
+        first = BO->getRHS();
+    } else if (auto* DS = dyn_cast<DeclStmt>(Forward->getInit())) {
+      if (DS->isSingleDecl() && DS->getSingleDecl() == IV)
+        first = IV->getInit();
+    }
+    auto* CO =
+        dyn_cast<BinaryOperator>(Forward->getCond()->IgnoreParenImpCasts());
+    if (!first || !CO || (CO->getOpcode() != BO_LT && CO->getOpcode() != BO_LE))
+      return nullptr;
+    int64_t offset = 0;
+    if (!getOffsetFromIV(m_Context, CO->getLHS(), IV, offset) || offset)
+      return nullptr;
+    Expr* last = CO->getRHS();
+    BinaryOperatorKind cmp = CO->getOpcode();
+    const auto* inc = dyn_cast<UnaryOperator>(Forward->getInc());
+    if (!inc || !inc->isIncrementOp() ||
+        !getOffsetFromIV(m_Context, inc->getSubExpr(), IV, offset) || offset)
+      return nullptr;
+
+    // Everything the forward iterations change, so that the bounds and the
+    // values the updates read are the same in every iteration.
+    ReverseLoopAccesses forwardAccesses;
+    forwardAccesses.TraverseStmt(Forward->getBody());
+    if (!forwardAccesses.m_Supported || forwardAccesses.m_Modified.count(IV))
+      return nullptr;
+    std::set<const VarDecl*> written(forwardAccesses.m_Modified.begin(),
+                                     forwardAccesses.m_Modified.end());
+    written.insert(forwardAccesses.m_Written.begin(),
+                   forwardAccesses.m_Written.end());
+    // The forward iterations may write elements of the arrays the bounds
+    // read, and local pointers may point to the variables they read.
+    MemoryReadFinder reads;
+    reads.TraverseStmt(first);
+    reads.TraverseStmt(last);
+    if (reads.m_ReadsMemory ||
+        llvm::any_of(forwardAccesses.m_Written,
+                     [](const VarDecl* VD) {
+                       return !isa<ParmVarDecl>(VD) &&
+                              !VD->getType()->isConstantArrayType();
+                     }) ||
+        !isLoopInvariant(m_Context, first, IV, written) ||
+        !isLoopInvariant(m_Context, last, IV, written))
+      return nullptr;
+
+    // Match the reverse iteration: `i--`, then seeds `T s = A[i]`, clearings
+    // `A[i] = 0` and updates `B[i + c] += R`.
+    struct Update {
+      VarDecl* Array;
+      int64_t Offset;
+      Expr* Value;
+    };
+    llvm::SmallVector<std::pair<VarDecl*, Expr*>, 2> seeds;
+    llvm::SmallVector<Expr*, 2> clearings;
+    llvm::SmallVector<Update, 4> updates;
+    llvm::SmallPtrSet<const VarDecl*, 4> seedArrays;
+    llvm::SmallPtrSet<const VarDecl*, 4> clearedArrays;
+    llvm::SmallPtrSet<const VarDecl*, 4> updatedArrays;
+    // Finds the array `A` of `A[i + c]` and stores `c` in `offset`.
+    auto getArray = [&](Expr* E) -> VarDecl* {
+      auto* ASE = dyn_cast<ArraySubscriptExpr>(E->IgnoreParenImpCasts());
+      if (!ASE || !getOffsetFromIV(m_Context, ASE->getIdx(), IV, offset))
+        return nullptr;
+      auto* DRE = dyn_cast<DeclRefExpr>(ASE->getBase()->IgnoreParenImpCasts());
+      return DRE ? dyn_cast<VarDecl>(DRE->getDecl()) : nullptr;
+    };
+    llvm::SmallVector<Stmt*, 8> worklist = {Reverse->getBody()};
+    llvm::SmallVector<Stmt*, 8> stmts;
+    while (!worklist.empty()) {
+      Stmt* S = worklist.pop_back_val();
+      if (auto* CS = dyn_cast<CompoundStmt>(S))
+        worklist.append(CS->body_rbegin(), CS->body_rend());
+      else if (!isa<NullStmt>(S))
+        stmts.push_back(S);
+    }
+    auto* dec = stmts.empty() ? nullptr : dyn_cast<UnaryOperator>(stmts[0]);
+    if (!dec || !dec->isDecrementOp() ||
+        !getOffsetFromIV(m_Context, dec->getSubExpr(), IV, offset) || offset)
+      return nullptr;
+    for (Stmt* S : llvm::ArrayRef<Stmt*>(stmts).drop_front()) {
+      if (auto* DS = dyn_cast<DeclStmt>(S)) {
+        auto* VD = DS->isSingleDecl() ? dyn_cast<VarDecl>(DS->getSingleDecl())
+                                      : nullptr;
+        VarDecl* A = VD && VD->getInit() ? getArray(VD->getInit()) : nullptr;
+        if (!A || offset || !VD->getType()->isScalarType() ||
+            clearedArrays.count(A))
+          return nullptr;
+        seeds.push_back({VD, VD->getInit()});
+        seedArrays.insert(A);
+        continue;
+      }
+      auto* BO = dyn_cast<BinaryOperator>(S);
+      VarDecl* A = BO ? getArray(BO->getLHS()) : nullptr;
+      if (!A)
+        return nullptr;
+      if (BO->getOpcode() == BO_Assign && !offset &&
+          utils::IsZeroOrNullValue(BO->getRHS())) {
+        clearings.push_back(BO);
+        clearedArrays.insert(A);
+      } else if (BO->getOpcode() == BO_AddAssign) {
+        updates.push_back({A, offset, BO->getRHS()});
+        updatedArrays.insert(A);
+      } else {
+        return nullptr;
+      }
+    }
+    // Updates at the iteration's own index already are independent.
+    if (llvm::none_of(updates, [](const Update& U) { return U.Offset != 0; }))
+      return nullptr;
+    for (const VarDecl* B : updatedArrays)
+      if (seedArrays.count(B) || clearedArrays.count(B))
+        return nullptr;
+    // The gather reorders the updates and the clearings, which is only valid
+    // if no other variable reaches the arrays they write.
+    if (!llvm::all_of(updatedArrays, hasDisjointStorage) ||
+        !llvm::all_of(clearedArrays, hasDisjointStorage))
+      return nullptr;
+    // The updated values may only read the seeds, `i` and what no iteration
+    // changes.
+    written.insert(clearedArrays.begin(), clearedArrays.end());
+    written.insert(updatedArrays.begin(), updatedArrays.end());
+    for (const Update& U : updates)
+      if (!isLoopInvariant(m_Context, U.Value, /*IV=*/nullptr, written))
+        return nullptr;
+
+    // The bounds are stored before the forward loop. Only outermost loops get
+    // here, so they are stored once.
+    llvm::SaveAndRestore<bool> SaveIsInsideLoop(isInsideLoop);
+    isInsideLoop = false;
+    first = GlobalStoreAndRef(Clone(first), "_t");
+    last = GlobalStoreAndRef(Clone(last), "_t");
+    // Builds `E + k`, folding constant bounds.
+    auto offsetBy = [this](Expr* E, int64_t k) -> Expr* {
+      Expr::EvalResult res;
+      if (E->EvaluateAsInt(res, m_Context)) {
+        int64_t v = res.Val.getInt().getExtValue() + k;
+        Expr* lit = ConstantFolder::synthesizeLiteral(
+            m_Context.IntTy, m_Context, static_cast<uint64_t>(v < 0 ? -v : v));
+        return v < 0 ? BuildOp(UO_Minus, lit) : lit;
+      }
+      E = Clone(E);
+      if (!k)
+        return E;
+      Expr* lit = ConstantFolder::synthesizeLiteral(
+          m_Context.IntTy, m_Context, static_cast<uint64_t>(k < 0 ? -k : k));
+      return BuildOp(k < 0 ? BO_Sub : BO_Add, E, lit);
+    };
+
+    // for (int _j = a + min(c); _j < b + max(c); ++_j) {
+    //   T s = 0;
+    //   i = _j - c;
+    //   if (a <= i && i < b) {
+    //     s = A[i];
+    //     B[_j] += R;
+    //   }
+    //   ...
+    // }
+    int64_t minOffset = updates.front().Offset;
+    int64_t maxOffset = minOffset;
+    for (const Update& U : updates) {
+      minOffset = std::min(minOffset, U.Offset);
+      maxOffset = std::max(maxOffset, U.Offset);
+    }
+    VarDecl* J = BuildVarDecl(IV->getType(), "_j", offsetBy(first, minOffset));
+    beginBlock();
+    for (auto& seed : seeds) {
+      seed.first->setInit(getZeroInit(seed.first->getType()));
+      addToCurrentBlock(BuildDeclStmt(seed.first));
+    }
+    for (const Update& U : updates) {
+      addToCurrentBlock(BuildOp(BO_Assign, BuildDeclRef(IV),
+                                offsetBy(BuildDeclRef(J), -U.Offset)));
+      Expr* inRange =
+          BuildOp(BO_LAnd, BuildOp(BO_LE, Clone(first), BuildDeclRef(IV)),
+                  BuildOp(cmp, BuildDeclRef(IV), Clone(last)));
+      beginBlock();
+      for (const auto& seed : seeds)
+        addToCurrentBlock(
+            BuildOp(BO_Assign, BuildDeclRef(seed.first), Clone(seed.second)));
+      Expr* idx = BuildDeclRef(J);
+      addToCurrentBlock(BuildOp(BO_AddAssign,
+                                BuildArraySubscript(BuildDeclRef(U.Array), idx),
+                                Clone(U.Value)));
+      Stmt* then = utils::unwrapIfSingleStmt(endBlock());
+      addToCurrentBlock(clad_compat::IfStmt_Create(
+          m_Context, noLoc, false, nullptr, nullptr, inRange, noLoc, noLoc,
+          then, noLoc, nullptr));
+    }
+    Stmt* gather = new (m_Context)
+        ForStmt(m_Context, BuildDeclStmt(J),
+                BuildOp(cmp, BuildDeclRef(J), offsetBy(last, maxOffset)),
+                nullptr, BuildOp(UO_PreInc, BuildDeclRef(J)), endBlock(), noLoc,
+                noLoc, noLoc);
+    if (!m_Context.getLangOpts().CUDA) {
+      const Attr* hint = LoopHintAttr::CreateImplicit(
+          m_Context, LoopHintAttr::Vectorize, LoopHintAttr::AssumeSafety,
+          /*Value=*/nullptr);
+      gather = AttributedStmt::Create(m_Context, noLoc, {hint}, gather);
+    }
+
+    // The seeds are cleared once all the updates have read them:
+    // for (i = a; i < b; ++i)
+    //   A[i] = 0;
+    beginBlock();
+    addToCurrentBlock(gather);
+    if (!clearings.empty()) {
+      beginBlock();
+      for (Expr* E : clearings)
+        addToCurrentBlock(Clone(E));
+      Stmt* clear = new (m_Context) ForStmt(
+          m_Context, BuildOp(BO_Assign, BuildDeclRef(IV), Clone(first)),
+          BuildOp(cmp, BuildDeclRef(IV), Clone(last)), nullptr,
+          BuildOp(UO_PreInc, BuildDeclRef(IV)),
+          utils::unwrapIfSingleStmt(endBlock()), noLoc, noLoc, noLoc);
+      addToCurrentBlock(clear);
+    }
+    return endBlock();
+  }
+
   StmtDiff ReverseModeVisitor::DifferentiateLoopBody(
       const Stmt* body, LoopCounter& loopCounter, Stmt* condVarDiff,
-      Stmt* forLoopIncDiff, bool isForLoop, SourceLocation loopLoc) {
+      Stmt* forLoopIncDiff, bool isForLoop, SourceLocation loopLoc,
+      const Stmt* loop) {
     // If the user marked this loop with a checkpointing pragma,
     // we should avoid using tapes inside it in favor of recomputations.
     llvm::SaveAndRestore<bool> Saved(isInsideLoop);
     llvm::SaveAndRestore<bool> SavedCP(m_IsInsideCheckpointedLoop);
     if (!loopLoc.isValid())
       loopLoc = body->getBeginLoc();
+    unsigned snapshots = 0;
     bool shouldCheckpoint =
-        hasCheckpointingPragma(m_Context, loopLoc, m_DiffReq);
+        hasCheckpointingPragma(m_Context, loopLoc, m_DiffReq, snapshots);
+    // With `snapshots(S)`, the state before each iteration is recovered from
+    // at most S snapshots of the variables the loop changes. This needs the
+    // loop to run once per call and its state to be copyable by value.
+    llvm::MapVector<const VarDecl*, const DeclRefExpr*> loopState;
+    bool useSnapshots = false;
+    if (snapshots) {
+      useSnapshots = loop && !loopCounter.getPush() &&
+                     !m_IsInsideCheckpointedLoop && !isInsideOMPBlock &&
+                     collectLoopState(m_Context, loop, loopState);
+      if (!useSnapshots)
+        diag(DiagnosticsEngine::Warning, loopLoc,
+             "the state of this loop cannot be saved in snapshots; each "
+             "iteration is recomputed from the current state instead")
+            << loopLoc;
+    }
     if (shouldCheckpoint) {
       isInsideLoop = false;
       m_IsInsideCheckpointedLoop = true;
     }
     Expr* counterIncrement = loopCounter.getCounterIncrement();
+
+    // With clad::opts::fuse_tapes, the values saved directly in the body go to
+    // one record per iteration, see MakeCladTapeFor.
+    FusedTapeLoop fusedTapeLoop;
+    llvm::SaveAndRestore<FusedTapeLoop*> SaveFusedTapeLoop(m_FusedTapeLoop);
+    if (m_DiffReq.FuseTapes && isInsideLoop && !m_FixedTapeLoop &&
+        !isInsideOMPBlock && !m_DiffReq.UseTapeArena &&
+        GetCladTapeDecl() ==
+            utils::LookupTemplateDeclInCladNamespace(m_Sema, "tape"))
+      m_FusedTapeLoop = &fusedTapeLoop;
+
+    // The schedule and one clad::fixed_tape with a slot per snapshot for each
+    // state variable:
+    //   clad::revolve _t1 = {S};
+    //   clad::fixed_tape<double> _t2 = {};
+    //   _t2.reserve(S);
+    VarDecl* schedule = nullptr;
+    llvm::SmallVector<std::pair<const DeclRefExpr*, VarDecl*>, 4> snapshotTapes;
+    if (useSnapshots) {
+      auto snapshotsLiteral = [&]() {
+        return ConstantFolder::synthesizeLiteral(m_Context.IntTy, m_Context,
+                                                 snapshots);
+      };
+      QualType scheduleType = utils::GetRevolveType(m_Sema);
+      schedule = GlobalStoreImpl(
+          scheduleType, "_t",
+          m_Sema.ActOnInitList(noLoc, snapshotsLiteral(), noLoc).get());
+      schedule->setLocation(m_DiffReq->getLocation());
+      for (const auto& entry : loopState) {
+        QualType tapeType = utils::InstantiateTemplate(
+            m_Sema,
+            utils::LookupTemplateDeclInCladNamespace(m_Sema, "fixed_tape"),
+            {entry.first->getType().getUnqualifiedType()});
+        VarDecl* tape =
+            GlobalStoreImpl(tapeType, "_t", getZeroInit(tapeType));
+        tape->setLocation(m_DiffReq->getLocation());
+        llvm::SmallVector<Expr*, 1> args = {snapshotsLiteral()};
+        addToCurrentBlock(
+            BuildCallExprToMemFn(BuildDeclRef(tape), "reserve", args),
+            direction::forward);
+        snapshotTapes.emplace_back(entry.second, tape);
+      }
+    }
+    // Build `clad::push(_t2, slot, x);` or `x = clad::back(_t2, slot);` for
+    // every state variable.
+    auto buildSnapshotAccess = [&](const std::function<Expr*()>& slot,
+                                   bool store) {
+      Stmts stmts;
+      for (const auto& snapshot : snapshotTapes) {
+        Expr* var = Clone(snapshot.first);
+        if (store) {
+          llvm::SmallVector<Expr*, 3> args = {BuildDeclRef(snapshot.second),
+                                              slot(), var};
+          stmts.push_back(GetFunctionCall("push", "clad", args));
+        } else {
+          llvm::SmallVector<Expr*, 2> args = {BuildDeclRef(snapshot.second),
+                                              slot()};
+          stmts.push_back(
+              BuildOp(BO_Assign, var, GetFunctionCall("back", "clad", args)));
+        }
+      }
+      return MakeCompoundStmt(stmts);
+    };
+
     auto* activeBreakContHandler = PushBreakContStmtHandler();
     activeBreakContHandler->BeginCFSwitchStmtScope();
     m_LoopBlock.emplace_back();
@@ -4612,6 +5856,34 @@ Expr* ReverseModeVisitor::getStdInitListSizeExpr(const Expr* E) {
     activeBreakContHandler->EndCFSwitchStmtScope();
     activeBreakContHandler->UpdateForwAndRevBlocks(bodyDiff);
     PopBreakContStmtHandler();
+    m_FusedTapeLoop = nullptr;
+
+    // Now that all fields are known, size the record. Each iteration pushes
+    // its record first and pops it after its adjoint:
+    //   clad::record_tape _t1 = {16};
+    //   for (...) {
+    //     _t1.emplace_back();
+    //     ...
+    //   }
+    //   for (...) {
+    //     ...
+    //     _t1.pop_back();
+    //   }
+    if (VarDecl* recordTape = fusedTapeLoop.Tape) {
+      uint64_t size = llvm::alignTo(fusedTapeLoop.Size, fusedTapeLoop.Align);
+      Expr* sizeLiteral =
+          ConstantFolder::synthesizeLiteral(m_Context.IntTy, m_Context, size);
+      SetDeclInit(recordTape,
+                  m_Sema.ActOnInitList(noLoc, sizeLiteral, noLoc).get());
+      bodyDiff.updateStmt(utils::PrependAndCreateCompoundStmt(
+          m_Context, bodyDiff.getStmt(),
+          BuildCallExprToMemFn(BuildDeclRef(recordTape), "emplace_back", {})));
+      Stmts revRecordBlock;
+      utils::AppendIndividualStmts(revRecordBlock, bodyDiff.getStmt_dx());
+      revRecordBlock.push_back(
+          BuildCallExprToMemFn(BuildDeclRef(recordTape), "pop_back", {}));
+      bodyDiff.updateStmtDx(MakeCompoundStmt(revRecordBlock));
+    }
 
     Expr* revCounter = loopCounter.getCounterConditionResult().get().second;
     if (m_CurrentBreakFlagExpr) {
@@ -4629,6 +5901,54 @@ Expr* ReverseModeVisitor::getStdInitListSizeExpr(const Expr* E) {
         bodyDiff.updateStmtDx(utils::PrependAndCreateCompoundStmt(
             m_Context, bodyDiff.getStmt_dx(), CloneNode(S)));
     }
+    if (useSnapshots) {
+      // Before recomputing an iteration, bring the state to its beginning as
+      // the binomial schedule says:
+      //   while (_t1.next(_t0 - 1)) {
+      //     if (_t1.restoring())
+      //       x = clad::back(_t2, _t1.slot());
+      //     else if (_t1.storing())
+      //       clad::push(_t2, _t1.slot(), x);
+      //     else {
+      //       <iteration>
+      //     }
+      //   }
+      auto slot = [&]() {
+        return BuildCallExprToMemFn(BuildDeclRef(schedule), "slot", {});
+      };
+      Stmts iteration;
+      for (Stmt* S : cast<CompoundStmt>(bodyDiff.getStmt())->body())
+        iteration.push_back(CloneNode(S));
+      if (const auto* FS = dyn_cast<ForStmt>(loop))
+        if (const Expr* inc = FS->getInc())
+          iteration.push_back(Clone(inc));
+      Stmt* storeOrAdvance = clad_compat::IfStmt_Create(
+          m_Context, noLoc, /*IsConstexpr=*/false, /*Init=*/nullptr,
+          /*Var=*/nullptr,
+          BuildCallExprToMemFn(BuildDeclRef(schedule), "storing", {}), noLoc,
+          noLoc, buildSnapshotAccess(slot, /*store=*/true), noLoc,
+          MakeCompoundStmt(iteration));
+      Stmt* action = clad_compat::IfStmt_Create(
+          m_Context, noLoc, /*IsConstexpr=*/false, /*Init=*/nullptr,
+          /*Var=*/nullptr,
+          BuildCallExprToMemFn(BuildDeclRef(schedule), "restoring", {}), noLoc,
+          noLoc, buildSnapshotAccess(slot, /*store=*/false), noLoc,
+          storeOrAdvance);
+      Expr* iterationIndex =
+          BuildOp(BO_Sub, loopCounter.cloneRef(),
+                  ConstantFolder::synthesizeLiteral(m_Context.IntTy, m_Context,
+                                                    /*val=*/1));
+      llvm::SmallVector<Expr*, 1> nextArgs = {iterationIndex};
+      Sema::ConditionResult nextCond = m_Sema.ActOnCondition(
+          getCurrentScope(), noLoc,
+          BuildCallExprToMemFn(BuildDeclRef(schedule), "next", nextArgs),
+          Sema::ConditionKind::Boolean);
+      Stmt* replay = m_Sema
+                         .ActOnWhileStmt(noLoc, noLoc, nextCond, noLoc, action)
+                         .get();
+      bodyDiff.updateStmtDx(utils::PrependAndCreateCompoundStmt(
+          m_Context, bodyDiff.getStmt_dx(), replay));
+    }
     // Increment statement in the for-loop is executed for every case
     if (forLoopIncDiff) {
       Stmt* forLoopIncDiffExpr = forLoopIncDiff;
@@ -4671,6 +5991,45 @@ Expr* ReverseModeVisitor::getStdInitListSizeExpr(const Expr* E) {
     addToCurrentBlock(bodyDiff.getStmt_dx(), direction::reverse);
     bodyDiff = {bodyDiff.getStmt(),
                 utils::unwrapIfSingleStmt(endBlock(direction::reverse))};
+    if (useSnapshots) {
+      // If the trip count is known up front, the first iteration stores the
+      // state before the loop in slot 0 and the reverse sweep places all other
+      // snapshots. Otherwise, the schedule also records snapshots every few
+      // iterations of the forward sweep:
+      //   if (_t1.record(_t0 - 1))
+      //     clad::push(_t2, _t1.slot(), x);
+      const auto* FS = dyn_cast<ForStmt>(loop);
+      bool knownTripCount = FS && BuildLoopTripCount(FS);
+      Expr* shouldStore = nullptr;
+      std::function<Expr*()> slot;
+      if (knownTripCount) {
+        shouldStore = BuildOp(BO_EQ, loopCounter.cloneRef(),
+                              ConstantFolder::synthesizeLiteral(
+                                  m_Context.IntTy, m_Context, /*val=*/1));
+        slot = [&]() -> Expr* {
+          return ConstantFolder::synthesizeLiteral(m_Context.IntTy, m_Context,
+                                                   /*val=*/0);
+        };
+      } else {
+        Expr* iterationIndex = BuildOp(
+            BO_Sub, loopCounter.cloneRef(),
+            ConstantFolder::synthesizeLiteral(m_Context.IntTy, m_Context,
+                                              /*val=*/1));
+        llvm::SmallVector<Expr*, 1> recordArgs = {iterationIndex};
+        shouldStore =
+            BuildCallExprToMemFn(BuildDeclRef(schedule), "record", recordArgs);
+        slot = [&]() -> Expr* {
+          return BuildCallExprToMemFn(BuildDeclRef(schedule), "slot", {});
+        };
+      }
+      Stmt* storeSnapshot = clad_compat::IfStmt_Create(
+          m_Context, noLoc, /*IsConstexpr=*/false, /*Init=*/nullptr,
+          /*Var=*/nullptr, shouldStore, noLoc, noLoc,
+          buildSnapshotAccess(slot, /*store=*/true), noLoc,
+          /*Else=*/nullptr);
+      bodyDiff.updateStmt(utils::PrependAndCreateCompoundStmt(
+          m_Context, bodyDiff.getStmt(), storeSnapshot));
+    }
     bodyDiff.updateStmt(utils::PrependAndCreateCompoundStmt(
         m_Context, bodyDiff.getStmt(), counterIncrement));
     return bodyDiff;
@@ -4734,8 +6093,13 @@ Expr* ReverseModeVisitor::getStdInitListSizeExpr(const Expr* E) {
                                  "m_ControlFlowTape is already initialized");
 
     auto* zeroLiteral = CreateSizeTLiteralExpr(0);
-    m_ControlFlowTape.reset(
-        new CladTapeResult(m_RMV.MakeCladTapeFor(zeroLiteral)));
+    // CreateCFTapePushExpr pushes to the tape directly.
+    llvm::SaveAndRestore<FixedTapeLoop*> SaveFixedTapeLoop(
+        m_RMV.m_FixedTapeLoop, nullptr);
+    llvm::SaveAndRestore<FusedTapeLoop*> SaveFusedTapeLoop(
+        m_RMV.m_FusedTapeLoop, nullptr);
+    m_ControlFlowTape.reset(new CladTapeResult(m_RMV.MakeCladTapeFor(
+        zeroLiteral, /*prefix=*/"_t", /*type=*/{}, /*packed=*/true)));
   }
 
   Expr* ReverseModeVisitor::BreakContStmtHandler::CreateCFTapePushExpr(
@@ -4807,6 +6171,21 @@ Expr* ReverseModeVisitor::getStdInitListSizeExpr(const Expr* E) {
     auto* lastSC = GetNextCFCaseStmt();
     auto* pushExprToCurrentCase = CreateCFTapePushExprToCurrentCase();
 
+    // Now that the number of cases is known, give a packed tape enough bits
+    // per case: `clad::bit_tape _t1 = {2};`.
+    auto* tapeVD = cast<VarDecl>(
+        cast<DeclRefExpr>(m_ControlFlowTape->Ref)->getDecl());
+    if (tapeVD->getType() == utils::GetBitTapeType(m_RMV.m_Sema)) {
+      unsigned bits = llvm::Log2_64(m_CaseCounter) + 1;
+      if (bits > 1) {
+        Expr* bitsLiteral = ConstantFolder::synthesizeLiteral(
+            m_RMV.m_Context.IntTy, m_RMV.m_Context, bits);
+        m_RMV.SetDeclInit(
+            tapeVD,
+            m_RMV.m_Sema.ActOnInitList(noLoc, bitsLiteral, noLoc).get());
+      }
+    }
+
     Stmt* forwBlock = nullptr;
     Stmt* revBlock = nullptr;
 
@@ -5282,6 +6661,12 @@ Expr* ReverseModeVisitor::getStdInitListSizeExpr(const Expr* E) {
       std::string CleanName = Name.ltrim('_').str();
       IdentifierInfo* II = CreateUniqueIdentifier("_d_" + CleanName);
       QualType dPVDTy = FnType->getParamType(p++);
+      // Pullbacks are left alone, a caller may pass the same adjoint for two
+      // parameters.
+      if (m_DiffReq.RestrictAdjoints && m_DiffReq.Mode == DiffMode::reverse &&
+          !LE && dPVDTy->isPointerType() &&
+          utils::isArrayOrPointerType(oPVD->getType()))
+        dPVDTy = m_Context.getRestrictType(dPVDTy);
       auto* dPVD = utils::BuildParmVarDecl(m_Sema, m_Derivative, II, dPVDTy,
                                            PVD->getStorageClass());
       m_Sema.PushOnScopeChains(dPVD, getCurrentScope(), /*AddToContext=*/false);
@@ -5301,6 +6686,79 @@ Expr* ReverseModeVisitor::getStdInitListSizeExpr(const Expr* E) {
       params.push_back(dPVD);
     }
   }
+  bool ReverseModeVisitor::shouldReuseTapes() const {
+    // Threadprivate tapes are already static, and device code has no
+    // thread_local storage. The reentry guard calls the plain gradient, which
+    // cannot be done from a lambda or with the extra parameters of an
+    // external source.
+    return m_DiffReq.ReuseTapes && !isInsideOMPBlock &&
+           !m_Context.getLangOpts().CUDA && !m_ExternalSource &&
+           !isLambdaCallOperator(m_DiffReq.Function);
+  }
+
+  Stmt* ReverseModeVisitor::BuildTapeReentryGuard() {
+    llvm::SmallVector<VarDecl*, 8> reusedTapes;
+    for (Stmt* S : m_Globals)
+      if (auto* DS = dyn_cast<DeclStmt>(S))
+        for (Decl* D : DS->decls())
+          if (auto* VD = dyn_cast<VarDecl>(D))
+            if (VD->getTSCSpec() == TSCS_thread_local)
+              reusedTapes.push_back(VD);
+    if (reusedTapes.empty())
+      return nullptr;
+
+    // The plain gradient has the same parameters and keeps its tapes local.
+    DiffRequest plainRequest = m_DiffReq;
+    plainRequest.ReuseTapes = false;
+    plainRequest.CallContext = nullptr;
+    plainRequest.CallUpdateRequired = false;
+    plainRequest.DerivedFDPrototypes.clear();
+    FunctionDecl* plainFD = m_Builder.HandleNestedDiffRequest(plainRequest);
+    if (!plainFD)
+      return nullptr;
+
+    SourceLocation loc = m_DiffReq->getLocation();
+    VarDecl* active = BuildGlobalVarDecl(
+        m_Context.BoolTy, "_active",
+        m_Sema.ActOnCXXBoolLiteral(noLoc, tok::kw_false).get(),
+        /*DirectInit=*/false, /*TSI=*/nullptr, SC_Static);
+    active->setTSCSpec(TSCS_thread_local);
+    active->setLocation(loc);
+    addToCurrentBlock(BuildDeclStmt(active), direction::forward);
+
+    llvm::SmallVector<Expr*, 8> args;
+    for (ParmVarDecl* PVD : m_Derivative->parameters())
+      args.push_back(BuildDeclRef(PVD));
+    Expr* plainCall = nullptr;
+    auto* MD = dyn_cast<CXXMethodDecl>(plainFD);
+    if (MD && MD->isInstance())
+      plainCall = BuildCallExprToMemFn(MD, args);
+    else
+      plainCall = BuildCallExprToFunction(plainFD, args);
+    Stmts fallback = {plainCall, m_Sema.BuildReturnStmt(loc, nullptr).get()};
+    addToCurrentBlock(clad_compat::IfStmt_Create(
+                          m_Context, noLoc, false, nullptr, nullptr,
+                          BuildDeclRef(active), noLoc, noLoc,
+                          MakeCompoundStmt(fallback), noLoc, nullptr),
+                      direction::forward);
+
+    // clad::tape_reuse_guard<clad::tape<double>> _guard0 = {_active0, _t1};
+    llvm::SmallVector<QualType, 8> tapeTypes;
+    llvm::SmallVector<Expr*, 8> guardArgs = {BuildDeclRef(active)};
+    for (VarDecl* VD : reusedTapes) {
+      tapeTypes.push_back(VD->getType());
+      guardArgs.push_back(BuildDeclRef(VD));
+    }
+    QualType guardTy = utils::InstantiateTemplate(
+        m_Sema,
+        utils::LookupTemplateDeclInCladNamespace(m_Sema, "tape_reuse_guard"),
+        tapeTypes);
+    Expr* guardInit = m_Sema.ActOnInitList(noLoc, guardArgs, noLoc).get();
+    VarDecl* guard = BuildGlobalVarDecl(guardTy, "_guard", guardInit);
+    guard->setLocation(loc);
+    return BuildDeclStmt(guard);
+  }
+
   void ReverseModeVisitor::MarkDeclThreadPrivate(VarDecl* decl) {
     auto* Init = decl->getInit();
     // set to null to pass CheckOMPThreadPrivateDecl
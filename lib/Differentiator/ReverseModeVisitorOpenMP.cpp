@@ -19,6 +19,10 @@
 #include <clang/Basic/Specifiers.h>
 #include <clang/Sema/DeclSpec.h>
 #include <clang/Sema/Scope.h>
+#include <llvm/ADT/FoldingSet.h>
+#include <llvm/ADT/MapVector.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallVector.h>
 #include <llvm/Frontend/OpenMP/OMP.h.inc>
 #include <llvm/Support/ErrorHandling.h>
 
@@ -29,8 +33,10 @@ using namespace clang;
 using namespace llvm::omp;
 
 namespace clad {
-// TODO: Support dynamic scheduling
-StmtDiff ReverseModeVisitor::DifferentiateCanonicalLoop(const ForStmt* S) {
+StmtDiff
+ReverseModeVisitor::DifferentiateCanonicalLoop(const ForStmt* S,
+                                               const OMPScheduleClause* Schedule,
+                                               VarDecl* Chunks) {
   // OpenMP canonical loops have the form:
   // for (init-expr; test-expr; incr-expr) structured-block
   // where init-expr: var = lb
@@ -192,16 +198,58 @@ StmtDiff ReverseModeVisitor::DifferentiateCanonicalLoop(const ForStmt* S) {
   IdentifierInfo* ThreadHiII = CreateUniqueIdentifier("_t_chunkhi");
   VarDecl* ThreadHiDecl = BuildVarDecl(IntTy, ThreadHiII, getZeroInit(IntTy));
 
-  // Build call to GetStaticSchedule(lo, hi, stride, &threadlo, &threadhi)
+  // Build call to GetStaticSchedule(lo, hi, stride, &threadlo, &threadhi),
+  // or start the logged schedule with
+  // _t_schedule0.start_dynamic(lo, hi, stride, chunk).
   llvm::SmallVector<Expr*, 5> ScheduleCallArgs;
   ScheduleCallArgs.push_back(LowerBound);
   ScheduleCallArgs.push_back(AdjustedUpperBound);
   ScheduleCallArgs.push_back(Stride);
-  ScheduleCallArgs.push_back(BuildOp(UO_AddrOf, BuildDeclRef(ThreadLoDecl)));
-  ScheduleCallArgs.push_back(BuildOp(UO_AddrOf, BuildDeclRef(ThreadHiDecl)));
-
-  Expr* ScheduleCall =
-      GetFunctionCall("GetStaticSchedule", "clad", ScheduleCallArgs);
+  Expr* ScheduleCall = nullptr;
+  if (Chunks) {
+    OpenMPScheduleClauseKind Kind = Schedule->getScheduleKind();
+    llvm::StringRef StartFn = "start_static";
+    if (Kind == OMPC_SCHEDULE_dynamic)
+      StartFn = "start_dynamic";
+    else if (Kind == OMPC_SCHEDULE_guided)
+      StartFn = "start_guided";
+    else if (Kind == OMPC_SCHEDULE_runtime)
+      StartFn = "start_runtime";
+    if (Kind != OMPC_SCHEDULE_runtime) {
+      // A chunk size of 0 lets the runtime pick the default one.
+      Expr* ChunkSize =
+          ConstantFolder::synthesizeLiteral(m_Context.IntTy, m_Context,
+                                            /*val=*/0);
+      if (const Expr* CS = Schedule->getChunkSize()) {
+        // Non-constant chunk sizes refer to a copy captured by the directive.
+        if (const auto* DRE = dyn_cast<DeclRefExpr>(CS->IgnoreImpCasts()))
+          if (const auto* CED = dyn_cast<OMPCapturedExprDecl>(DRE->getDecl()))
+            CS = CED->getInit();
+        ChunkSize = Clone(CS);
+      }
+      ScheduleCallArgs.push_back(ChunkSize);
+    }
+    ScheduleCall =
+        BuildCallExprToMemFn(BuildDeclRef(Chunks), StartFn, ScheduleCallArgs);
+  } else {
+    ScheduleCallArgs.push_back(
+        BuildOp(UO_AddrOf, BuildDeclRef(ThreadLoDecl)));
+    ScheduleCallArgs.push_back(
+        BuildOp(UO_AddrOf, BuildDeclRef(ThreadHiDecl)));
+    ScheduleCall =
+        GetFunctionCall("GetStaticSchedule", "clad", ScheduleCallArgs);
+  }
+  // Builds `while (_t_schedule0.next(&threadlo, &threadhi)) Loop`.
+  auto BuildChunkLoop = [&](llvm::StringRef Fn, VarDecl* Lo, VarDecl* Hi,
+                            Stmt* Loop) -> Stmt* {
+    llvm::SmallVector<Expr*, 2> Args = {BuildOp(UO_AddrOf, BuildDeclRef(Lo)),
+                                        BuildOp(UO_AddrOf, BuildDeclRef(Hi))};
+    Sema::ConditionResult Cond = m_Sema.ActOnCondition(
+        getCurrentScope(), noLoc,
+        BuildCallExprToMemFn(BuildDeclRef(Chunks), Fn, Args),
+        Sema::ConditionKind::Boolean);
+    return m_Sema.ActOnWhileStmt(noLoc, noLoc, Cond, noLoc, Loop).get();
+  };
 
   // Create forward sweep loop: for (i = threadlo; i <= threadhi; i += stride)
   // Use unique identifier to avoid conflicts when differentiating multiple
@@ -291,6 +339,14 @@ StmtDiff ReverseModeVisitor::DifferentiateCanonicalLoop(const ForStmt* S) {
   // Forward: { int threadlo = 0, threadhi = 0;
   //            GetStaticSchedule(...);
   //            for (...) {...} }
+  // or, with a logged schedule:
+  //          { int threadlo = 0, threadhi = 0;
+  //            _t_schedule0.start_dynamic(...);
+  //            while (_t_schedule0.next(&threadlo, &threadhi))
+  //              for (...) {...} }
+  if (Chunks)
+    ForwardLoop = BuildChunkLoop("next", ThreadLoDecl, ThreadHiDecl,
+                                 ForwardLoop);
   beginBlock(direction::forward);
   addToCurrentBlock(BuildDeclStmt(ThreadLoDecl));
   addToCurrentBlock(BuildDeclStmt(ThreadHiDecl));
@@ -303,21 +359,29 @@ StmtDiff ReverseModeVisitor::DifferentiateCanonicalLoop(const ForStmt* S) {
 
   // Reverse: { int threadlo = 0, threadhi = 0;
   //            GetStaticSchedule(...);
-  //            for (...) {...} }
+  //            _d_x_priv.start();
+  //            for (...) {...}
+  //            _d_x_priv.reduce(_d_x); }
+  // or, with a logged schedule, the chunks of the forward sweep in reverse:
+  //          { int threadlo = 0, threadhi = 0;
+  //            while (_t_schedule0.prev(&threadlo, &threadhi))
+  //              for (...) {...} }
   Stmt* ReverseBlock = nullptr;
   if (ReverseLoopBody) {
     // Use the chunk variables we already created
-    llvm::SmallVector<Expr*, 5> RevScheduleCallArgs;
-    RevScheduleCallArgs.push_back(Clone(LowerBound));
-    RevScheduleCallArgs.push_back(Clone(AdjustedUpperBound));
-    RevScheduleCallArgs.push_back(Clone(Stride));
-    RevScheduleCallArgs.push_back(
-        BuildOp(UO_AddrOf, BuildDeclRef(RevThreadLoDecl)));
-    RevScheduleCallArgs.push_back(
-        BuildOp(UO_AddrOf, BuildDeclRef(RevThreadHiDecl)));
-
-    Expr* RevScheduleCall =
-        GetFunctionCall("GetStaticSchedule", "clad", RevScheduleCallArgs);
+    Expr* RevScheduleCall = nullptr;
+    if (!Chunks) {
+      llvm::SmallVector<Expr*, 5> RevScheduleCallArgs;
+      RevScheduleCallArgs.push_back(Clone(LowerBound));
+      RevScheduleCallArgs.push_back(Clone(AdjustedUpperBound));
+      RevScheduleCallArgs.push_back(Clone(Stride));
+      RevScheduleCallArgs.push_back(
+          BuildOp(UO_AddrOf, BuildDeclRef(RevThreadLoDecl)));
+      RevScheduleCallArgs.push_back(
+          BuildOp(UO_AddrOf, BuildDeclRef(RevThreadHiDecl)));
+      RevScheduleCall =
+          GetFunctionCall("GetStaticSchedule", "clad", RevScheduleCallArgs);
+    }
 
     // Create the reverse loop using the reverse loop variable
     Stmt* RevInit = BuildDeclStmt(RevLoopVar);
@@ -334,10 +398,26 @@ StmtDiff ReverseModeVisitor::DifferentiateCanonicalLoop(const ForStmt* S) {
     Stmt* ReverseLoop =
         new (m_Context) ForStmt(m_Context, RevInit, RevCond, nullptr, RevInc,
                                 ReverseLoopBody, noLoc, noLoc, noLoc);
+    if (Chunks)
+      ReverseLoop = BuildChunkLoop("prev", RevThreadLoDecl, RevThreadHiDecl,
+                                   ReverseLoop);
 
     beginBlock(direction::reverse);
+    // Merge the privatised adjoints once the team is done with the loop.
+    for (const auto& Buffer : m_OMPAdjointBuffers) {
+      llvm::SmallVector<Expr*, 1> Args = {BuildDeclRef(Buffer.first)};
+      addToCurrentBlock(
+          BuildCallExprToMemFn(BuildDeclRef(Buffer.second), "reduce", Args),
+          direction::reverse);
+    }
     addToCurrentBlock(ReverseLoop, direction::reverse);
-    addToCurrentBlock(RevScheduleCall, direction::reverse);
+    // Size the buffers for the team before any thread updates them.
+    for (const auto& Buffer : m_OMPAdjointBuffers)
+      addToCurrentBlock(
+          BuildCallExprToMemFn(BuildDeclRef(Buffer.second), "start", {}),
+          direction::reverse);
+    if (RevScheduleCall)
+      addToCurrentBlock(RevScheduleCall, direction::reverse);
     addToCurrentBlock(BuildDeclStmt(RevThreadHiDecl), direction::reverse);
     addToCurrentBlock(BuildDeclStmt(RevThreadLoDecl), direction::reverse);
     for (Stmt* S : m_OMPReverseBlocks)
@@ -349,6 +429,146 @@ StmtDiff ReverseModeVisitor::DifferentiateCanonicalLoop(const ForStmt* S) {
   return {ForwardBlock, ReverseBlock};
 }
 
+namespace {
+/// Collects how the body of an OpenMP loop accesses the arrays declared
+/// outside of it.
+class SharedArrayAccesses : public RecursiveASTVisitor<SharedArrayAccesses> {
+public:
+  struct ArrayInfo {
+    /// The indices of the real-valued elements read outside of critical
+    /// sections.
+    llvm::SmallVector<const Expr*, 4> Indices;
+    unsigned Refs = 0;
+    unsigned Subscripts = 0;
+    bool Written = false;
+    bool InCritical = false;
+  };
+  llvm::MapVector<const VarDecl*, ArrayInfo> Arrays;
+  /// Variables declared or assigned in the loop body.
+  llvm::SmallPtrSet<const VarDecl*, 8> Modified;
+
+  bool TraverseOMPCriticalDirective(OMPCriticalDirective* D) {
+    llvm::SaveAndRestore<bool> SaveInCritical(m_InCritical, true);
+    return RecursiveASTVisitor::TraverseOMPCriticalDirective(D);
+  }
+  bool VisitVarDecl(VarDecl* VD) {
+    Modified.insert(VD);
+    return true;
+  }
+  bool VisitDeclRefExpr(DeclRefExpr* DRE) {
+    if (const auto* VD = getArray(DRE))
+      Arrays[VD].Refs++;
+    return true;
+  }
+  bool VisitArraySubscriptExpr(ArraySubscriptExpr* ASE) {
+    const auto* DRE = dyn_cast<DeclRefExpr>(ASE->getBase()->IgnoreImpCasts());
+    const VarDecl* VD = DRE ? getArray(DRE) : nullptr;
+    if (!VD || !ASE->getType()->isRealType())
+      return true;
+    ArrayInfo& info = Arrays[VD];
+    info.Subscripts++;
+    if (m_InCritical)
+      info.InCritical = true;
+    else
+      info.Indices.push_back(ASE->getIdx());
+    return true;
+  }
+  bool VisitBinaryOperator(BinaryOperator* BO) {
+    if (BO->isAssignmentOp())
+      markWritten(BO->getLHS());
+    return true;
+  }
+  bool VisitUnaryOperator(UnaryOperator* UO) {
+    if (UO->isIncrementDecrementOp())
+      markWritten(UO->getSubExpr());
+    return true;
+  }
+
+private:
+  bool m_InCritical = false;
+
+  static const VarDecl* getArray(const DeclRefExpr* DRE) {
+    const auto* VD = dyn_cast<VarDecl>(DRE->getDecl());
+    if (VD && (VD->getType()->isPointerType() || VD->getType()->isArrayType()))
+      return VD;
+    return nullptr;
+  }
+  void markWritten(const Expr* E) {
+    E = E->IgnoreParenImpCasts();
+    if (const auto* ASE = dyn_cast<ArraySubscriptExpr>(E))
+      E = ASE->getBase()->IgnoreParenImpCasts();
+    if (const auto* DRE = dyn_cast<DeclRefExpr>(E)) {
+      if (const auto* VD = getArray(DRE))
+        Arrays[VD].Written = true;
+      else if (const auto* VD = dyn_cast<VarDecl>(DRE->getDecl()))
+        Modified.insert(VD);
+    }
+  }
+};
+} // namespace
+
+void ReverseModeVisitor::PrivatizeOMPAdjoints(const OMPLoopDirective* D) {
+  const auto* FS = dyn_cast<ForStmt>(
+      D->getInnermostCapturedStmt()->getCapturedStmt());
+  if (!FS || D->counters().size() != 1)
+    return;
+  const VarDecl* LoopVar = nullptr;
+  if (const auto* DRE =
+          dyn_cast<DeclRefExpr>(D->counters().front()->IgnoreParenImpCasts()))
+    LoopVar = dyn_cast<VarDecl>(DRE->getDecl());
+
+  SharedArrayAccesses Accesses;
+  Accesses.TraverseStmt(const_cast<Stmt*>(FS->getBody()));
+  for (const auto& Array : Accesses.Arrays) {
+    const VarDecl* VD = Array.first;
+    const SharedArrayAccesses::ArrayInfo& Info = Array.second;
+    // Adjoints of written arrays are also read and reset by the reverse
+    // pass, and arrays used other than through subscripts may be updated by
+    // pullbacks; neither can be redirected to a buffer.
+    if (Info.Written || Info.Refs != Info.Subscripts ||
+        Accesses.Modified.count(VD) || Info.Indices.empty())
+      continue;
+    // Updates of the same element come from the same iteration if all
+    // accesses share one injective index. Updates within critical sections
+    // are only safe if no update happens outside of them.
+    bool Shared = Info.InCritical || !LoopVar ||
+                  !utils::isInjective(Info.Indices.front(), LoopVar,
+                                      Accesses.Modified, m_Context);
+    llvm::FoldingSetNodeID FirstID;
+    Info.Indices.front()->IgnoreParenImpCasts()->Profile(FirstID, m_Context,
+                                                         /*Canonical=*/true);
+    for (const Expr* Idx : Info.Indices) {
+      llvm::FoldingSetNodeID ID;
+      Idx->IgnoreParenImpCasts()->Profile(ID, m_Context, /*Canonical=*/true);
+      Shared |= ID != FirstID;
+    }
+    if (!Shared)
+      continue;
+
+    auto it = m_Variables.find(VD);
+    if (it == m_Variables.end() || !it->second.Decl ||
+        it->second.Wrap != AdjointInfo::Plain)
+      continue;
+    VarDecl* Adjoint = it->second.Decl;
+    QualType AdjointTy = Adjoint->getType();
+    QualType ElemTy =
+        AdjointTy->isArrayType()
+            ? m_Context.getAsArrayType(AdjointTy)->getElementType()
+            : AdjointTy->getPointeeType();
+    if (ElemTy.isNull() || !ElemTy->isRealType() || ElemTy.isConstQualified())
+      continue;
+
+    // Declared with the tapes, as the forward region also captures it:
+    //   clad::omp_adjoint<double> _d_x_priv = {};
+    QualType BufferTy = utils::InstantiateTemplate(
+        m_Sema, utils::LookupTemplateDeclInCladNamespace(m_Sema, "omp_adjoint"),
+        {ElemTy.getUnqualifiedType()});
+    m_OMPAdjointBuffers[Adjoint] =
+        GlobalStoreImpl(BufferTy, (Adjoint->getName() + "_priv").str(),
+                        getZeroInit(BufferTy));
+  }
+}
+
 OMPClause* ReverseModeVisitor::BuildOMPPrivateClause(ArrayRef<Expr*> VarList,
                                                      SourceLocation StartLoc,
                                                      SourceLocation LParenLoc,
@@ -417,6 +637,18 @@ ReverseModeVisitor::VisitOMPPrivateClause(const OMPPrivateClause* C) {
               DiffVars, C->getBeginLoc(), C->getLParenLoc(), C->getEndLoc())};
 }
 
+std::array<OMPClause*, 3>
+ReverseModeVisitor::VisitOMPNumThreadsClause(const OMPNumThreadsClause* C) {
+  // Both regions run with the same team, so that every thread reverses the
+  // chunks it executed.
+  auto Build = [&]() {
+    return CLAD_COMPAT_CLANG19_SemaOpenMP(m_Sema).ActOnOpenMPSingleExprClause(
+        OMPC_num_threads, Clone(C->getNumThreads()), C->getBeginLoc(),
+        C->getLParenLoc(), C->getEndLoc());
+  };
+  return {Build(), Build(), nullptr};
+}
+
 std::array<OMPClause*, 3>
 ReverseModeVisitor::VisitOMPFirstprivateClause(const OMPFirstprivateClause* C) {
   llvm::SmallVector<Expr*, 16> Vars;
@@ -499,16 +731,39 @@ StmtDiff ReverseModeVisitor::VisitOMPExecutableDirective(
   ArrayRef<OMPClause*> Clauses = D->clauses();
   OrigClauses.reserve(Clauses.size());
   DiffClauses.reserve(Clauses.size());
+  const OMPScheduleClause* Schedule = nullptr;
   for (auto* I : Clauses) {
     assert(I);
+    // The schedule is reproduced by the chunk loops of both sweeps rather than
+    // by a clause of the generated regions.
+    if (const auto* SC = dyn_cast<OMPScheduleClause>(I)) {
+      Schedule = SC;
+      continue;
+    }
     CLAD_COMPAT_CLANG19_SemaOpenMP(m_Sema).StartOpenMPClause(
         I->getClauseKind());
     auto Clauses = Visit(I);
     CLAD_COMPAT_CLANG19_SemaOpenMP(m_Sema).EndOpenMPClause();
     OrigClauses.push_back(Clauses[0]);
-    assert(Clauses[2]);
+    assert(Clauses[1] && "unsupported clause");
     DiffClauses.push_back(Clauses[1]);
-    DiffClauses.push_back(Clauses[2]);
+    // The third clause carries the adjoints, if the clause has any.
+    if (Clauses[2])
+      DiffClauses.push_back(Clauses[2]);
+  }
+  // Created before both regions, so that both visits of the reverse loop
+  // refer to the same buffers.
+  if (const auto* LD = dyn_cast<OMPLoopDirective>(D))
+    PrivatizeOMPAdjoints(LD);
+  // Chunks handed out at run time are logged in the forward sweep so that
+  // every thread reverses the iterations it executed.
+  VarDecl* Chunks = nullptr;
+  if (Schedule && Schedule->getScheduleKind() != OMPC_SCHEDULE_auto &&
+      (Schedule->getScheduleKind() != OMPC_SCHEDULE_static ||
+       Schedule->getChunkSize())) {
+    QualType ScheduleTy = utils::GetOMPScheduleType(m_Sema);
+    Chunks =
+        GlobalStoreImpl(ScheduleTy, "_t_schedule", getZeroInit(ScheduleTy));
   }
   StmtDiff AssociatedSDiff;
   if (D->hasAssociatedStmt() && D->getAssociatedStmt()) {
@@ -528,7 +783,7 @@ StmtDiff ReverseModeVisitor::VisitOMPExecutableDirective(
       Sema::CompoundScopeRAII CompoundScope(m_Sema);
       if (isOpenMPLoopDirective(D->getDirectiveKind())) {
         const auto* FS = cast<ForStmt>(CS);
-        BodyDiff = DifferentiateCanonicalLoop(FS);
+        BodyDiff = DifferentiateCanonicalLoop(FS, Schedule, Chunks);
       } else {
         BodyDiff = Visit(CS);
       }
@@ -547,7 +802,7 @@ StmtDiff ReverseModeVisitor::VisitOMPExecutableDirective(
       m_Globals.swap(temp);
       if (isOpenMPLoopDirective(D->getDirectiveKind())) {
         const auto* FS = cast<ForStmt>(CS);
-        DifferentiateCanonicalLoop(FS);
+        DifferentiateCanonicalLoop(FS, Schedule, Chunks);
       } else {
         StmtDiff SecondDiff = Visit(CS);
         auto& II = m_Context.Idents.get("_clad_reverse_guard");
@@ -570,6 +825,7 @@ StmtDiff ReverseModeVisitor::VisitOMPExecutableDirective(
 
     AssociatedSDiff = {Forward, Reverse};
   }
+  m_OMPAdjointBuffers.clear();
   DeclarationNameInfo DirName;
   OpenMPDirectiveKind CancelRegion = OMPD_unknown;
   return {CLAD_COMPAT_CLANG19_SemaOpenMP(m_Sema)
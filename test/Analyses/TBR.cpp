@@ -48,8 +48,8 @@ double f2(double val) {
 //CHECK: void f2_grad(double val, double *_d_val) {
 //CHECK-NEXT:     int _d_i = 0;
 //CHECK-NEXT:     int i = 0;
-//CHECK-NEXT:     clad::tape<bool> _cond0 = {};
-//CHECK-NEXT:     clad::tape<unsigned {{int|long}}> _t1 = {};
+//CHECK-NEXT:     clad::bit_tape _cond0 = {};
+//CHECK-NEXT:     clad::bit_tape _t1 = {2};
 //CHECK-NEXT:     double _d_res = 0.;
 //CHECK-NEXT:     double res = 0;
 //CHECK-NEXT:     unsigned {{int|long}} _t0 = 0;
@@ -69,6 +69,41 @@ int main() {
   printf("File-Backed manager read/write ok: %d\n", file_mmap_ok);
   // CHECK-EXEC: File-Backed manager read/write ok: 1
 
+  clad::detail::DiskManager<double, 1024> compressed_manager(
+      /*use_file_offload=*/false, /*use_compression=*/true);
+  size_t compressed_offset = compressed_manager.write_slab(test_data);
+  double compressed_read_data[1024];
+  compressed_manager.read_slab(compressed_read_data, compressed_offset);
+
+  bool compressed_ok = true;
+  for (int i = 0; i < 1024; ++i)
+    compressed_ok &= compressed_read_data[i] == test_data[i];
+  printf("Compressed manager read/write ok: %d\n", compressed_ok);
+  // CHECK-EXEC: Compressed manager read/write ok: 1
+  printf("Compressed manager shrinks slab: %d\n",
+         compressed_manager.compression_ratio() > 1);
+  // CHECK-EXEC: Compressed manager shrinks slab: 1
+
+  // Tapes pick up the runtime configuration when they are created.
+  clad::tape_config config = clad::get_tape_config();
+  clad::tape_config default_config = config;
+  config.ram_budget = 2 * 1024 * sizeof(double);
+  config.target = clad::tape_config::offload_target::file;
+  clad::set_tape_config(config);
+  {
+    clad::tape_impl<double, 64, 1024, false, /*DiskOffload=*/true> budget_tape;
+    for (int i = 0; i < 10000; ++i)
+      budget_tape.emplace_back(i * 0.5);
+    bool budget_ok = true;
+    for (int i = 9999; i >= 0; --i) {
+      budget_ok &= budget_tape.back() == i * 0.5;
+      budget_tape.pop_back();
+    }
+    printf("Budgeted tape read/write ok: %d\n", budget_ok);
+    // CHECK-EXEC: Budgeted tape read/write ok: 1
+  }
+  clad::set_tape_config(default_config);
+
   float dx = 0, dy = 0;
   auto d_fn = clad::gradient(fn);
   d_fn.execute(1.0f, 2.0f, &dx, &dy);
@@ -58,6 +58,8 @@
 #include <cassert>
 #include <cstdlib>  // for getenv
 #include <iostream> // for std::cerr
+#include <limits>
+#include <map>
 #include <memory>
 #include <set>
 
@@ -70,7 +72,9 @@ void InitTimers();
     /// Keeps track if we encountered #pragma clad on/off.
     // FIXME: Figure out how to make it a member of CladPlugin.
     std::vector<clang::SourceRange> CladEnabledRange;
-    std::set<clang::SourceLocation> CladLoopCheckpoints;
+    /// Locations of #pragma clad checkpoint loop and their snapshot budget, 0
+    /// if none was given.
+    std::map<clang::SourceLocation, unsigned> CladLoopCheckpoints;
 
     // Define a pragma handler for #pragma clad
     class CladPragmaHandler : public PragmaHandler {
@@ -107,7 +111,7 @@ void InitTimers();
           }
           return;
         }
-        // Handle #pragma clad checkpoint loop
+        // Handle #pragma clad checkpoint loop [snapshots(S)]
         if (OptionName == "checkpoint") {
           PP.Lex(PragmaTok);
           // Ensure the next token is `loop`
@@ -119,7 +123,36 @@ void InitTimers();
                         "expected 'loop' after 'checkpoint' in #pragma clad"));
             return;
           }
-          CladLoopCheckpoints.insert(PragmaTok.getLocation());
+          SourceLocation LoopTokLoc = PragmaTok.getLocation();
+          PP.Lex(PragmaTok);
+          if (PragmaTok.is(tok::eod)) {
+            CladLoopCheckpoints.emplace(LoopTokLoc, 0);
+            return;
+          }
+          // Parse the optional `snapshots(S)` clause.
+          uint64_t Snapshots = 0;
+          bool Valid = PragmaTok.is(tok::identifier) &&
+                       PragmaTok.getIdentifierInfo()->getName() == "snapshots";
+          if (Valid) {
+            PP.Lex(PragmaTok);
+            Valid = PragmaTok.is(tok::l_paren);
+          }
+          if (Valid) {
+            PP.Lex(PragmaTok);
+            // Consumes the literal and lexes the next token.
+            Valid = PP.parseSimpleIntegerLiteral(PragmaTok, Snapshots) &&
+                    PragmaTok.is(tok::r_paren) && Snapshots > 0 &&
+                    Snapshots <= std::numeric_limits<unsigned>::max();
+          }
+          if (!Valid) {
+            PP.Diag(PragmaTok.getLocation(),
+                    PP.getDiagnostics().getCustomDiagID(
+                        DiagnosticsEngine::Error,
+                        "expected 'snapshots(<positive integer>)' after "
+                        "'loop' in #pragma clad"));
+            return;
+          }
+          CladLoopCheckpoints.emplace(LoopTokLoc, Snapshots);
           return;
         }
         // Diagnose unknown clad pragma option
@@ -316,9 +349,12 @@ void InitTimers();
       auto it = CladLoopCheckpoints.upper_bound(begin);
       auto e = CladLoopCheckpoints.end();
 
-      for (; it != e && SM.isBeforeInTranslationUnit(*it, end); ++it)
+      for (; it != e && SM.isBeforeInTranslationUnit(it->first, end); ++it) {
         request.m_CladLoopCheckpoints.emplace(
-            *it, getAttachedLoopLoc(request.Function, *it, SM));
+            it->first, getAttachedLoopLoc(request.Function, it->first, SM));
+        if (it->second)
+          request.m_CladLoopSnapshots.emplace(it->first, it->second);
+      }
     }
 
     static void diagnoseUnusedPragma(Sema& S, DiffRequest& request) {